@@ -4,171 +4,563 @@
 #include <time.h>
 #include <string.h>
 
+#include "../common/binary_file.h"
+#include "../common/dataset.h"
+#include "../common/random.h"
+#include "knn_batch.h"
+#include "knn_index.h"
+#include "knn_quant.h"
+
+// Largest k the model-selection sweep scores
+#define KNN_MAX_K 256
+
+// Largest --rerank: candidates re-ranked per neighbor wanted
+#define KNN_MAX_RERANK 64
+
+// Seed of the shuffle and of the HNSW layers when --seed is not given. The shuffle draws from stream 1 of the
+// seed, as the HNSW layers draw from stream 0.
+#define DEFAULT_SEED 42
+#define SHUFFLE_STREAM 1
+
+// Model file format: "KNNMODEL" header, version 1
+#define MODEL_MAGIC "KNNMODEL"
+#define MODEL_VERSION 1
+
+// How to build a model: the neighbor search and the storage of the training features
+typedef struct {
+    KnnIndexType index_type;
+    KnnHnswParams hnsw;  // HNSW only
+    KnnStorage storage;  // float32, or compressed for the brute-force scan
+    int rerank;          // compressed storage only; 0 keeps the approximate distances
+} ModelOptions;
+
+// A set of samples: features as row-major floats and class ids into the dataset's class table
+typedef struct {
+    float* features;
+    int* labels;
+    int count;
+    int dim;
+} Samples;
+
+// The trained classifier: the normalization applied to every query, the normalized training features in
+// column-major order, the class of every training row as an index into class_names, and the optional spatial index
 typedef struct {
-    float sepal_length;
-    float sepal_width;
-    float petal_length;
-    float petal_width;
-    char class_name[50];
-} Iris;
+    double* mean;
+    double* std_dev;
+    KnnFeatures features;
+    int* labels;
+    char** class_names;
+    int class_count;
+    KnnIndex* index;
+    KnnQuantized quantized;  // compressed copy of the features scanned instead of them, when storage is not float32
+    int rerank;              // candidates re-ranked with the full-precision features, per neighbor wanted
+    KnnScratch scratch;  // per-thread search buffers reused by every batch
+    MappedFile file;     // the model file, when the model was loaded from one
+    int mapped;          // the arrays point into `file` and are not freed
+    MappedFile spill;    // temporary file holding the float32 features of a compressed model that was trained here
+} KnnModel;
 
-// Function to read the data from the file and return the data as an array of Iris structures and the count of the data
-Iris* read_data(char* filename, int* count)
+// Function to shuffle the rows of the data using the Fisher-Yates algorithm to avoid any bias.
+// The same seed always gives the same order.
+void shuffle_data(Dataset* data, uint64_t seed)
 {
-    FILE* file = fopen(filename, "r");
-    if (file == NULL)
+    double* temp = (double*)malloc(data->cols * sizeof(double));
+    size_t row_size = data->cols * sizeof(double);
+    Rng rng;
+    rng_seed(&rng, seed, SHUFFLE_STREAM);
+    for (size_t i = data->rows - 1; i > 0; i--)
     {
-        printf("Could not open file %s\n", filename);
-        return NULL;
+        size_t j = rng_below(&rng, (uint32_t)(i + 1));
+        memcpy(temp, data->values + i * data->cols, row_size);
+        memcpy(data->values + i * data->cols, data->values + j * data->cols, row_size);
+        memcpy(data->values + j * data->cols, temp, row_size);
+        int label = data->labels[i];
+        data->labels[i] = data->labels[j];
+        data->labels[j] = label;
     }
-    Iris* data = (Iris*)malloc(150 * sizeof(Iris));  // The Iris dataset has 150 instances
-    *count = 0;
-    while (fscanf(file, "%f,%f,%f,%f,%s", &data[*count].sepal_length, &data[*count].sepal_width, &data[*count].petal_length, &data[*count].petal_width, data[*count].class_name) == 5)
-    {
-        (*count)++;
-    }
-    fclose(file);
-    return (data);
+    free(temp);
 }
 
-// Function to shuffle the data using the Fisher-Yates algorithm to avoid any bias
-void shuffle_data(Iris* data, int count)
+// Function to copy `count` rows of the data, starting at `first`, into a set of float samples
+void take_samples(const Dataset* data, size_t first, int count, Samples* samples)
 {
-    srand(time(NULL));
-    for (int i = count - 1; i > 0; i--)
+    samples->count = count;
+    samples->dim = data->cols;
+    samples->features = (float*)malloc((size_t)count * data->cols * sizeof(float));
+    samples->labels = (int*)malloc(count * sizeof(int));
+    for (size_t i = 0; i < (size_t)count * data->cols; i++)
     {
-        int j = rand() % (i + 1);
-        Iris temp = data[i];
-        data[i] = data[j];
-        data[j] = temp;
+        samples->features[i] = (float)data->values[first * data->cols + i];
+    }
+    for (int i = 0; i < count; i++)
+    {
+        samples->labels[i] = (data->labels != NULL) ? data->labels[first + i] : -1;  // -1: the file has no class column
     }
 }
 
 // Function to split the data into training and testing data using a 70-30 split
-void split_data(Iris* data, int count, Iris** train, int* train_count, Iris** test, int* test_count)
+void split_data(const Dataset* data, Samples* train, Samples* test)
 {
-    *train_count = (int)(0.7 * count);
-    *test_count = count - *train_count;
-    *train = (Iris*)malloc(*train_count * sizeof(Iris));
-    *test = (Iris*)malloc(*test_count * sizeof(Iris));
-    for (int i = 0; i < *train_count; i++)
+    int train_count = (int)(0.7 * data->rows);
+    take_samples(data, 0, train_count, train);
+    take_samples(data, train_count, (int)data->rows - train_count, test);
+}
+
+void free_samples(Samples* samples)
+{
+    free(samples->features);
+    free(samples->labels);
+}
+
+// Function to compute the mean and standard deviation of every feature (a constant feature gets a deviation of 1)
+void feature_stats(const Samples* data, double* mean, double* std_dev)
+{
+    for (int d = 0; d < data->dim; d++)
+    {
+        mean[d] = 0;
+        std_dev[d] = 0;
+    }
+    for (int i = 0; i < data->count; i++)
+    {
+        for (int d = 0; d < data->dim; d++)
+        {
+            mean[d] += data->features[(size_t)i * data->dim + d];
+        }
+    }
+    for (int d = 0; d < data->dim; d++)
     {
-        (*train)[i] = data[i];
+        mean[d] /= data->count;
     }
-    for (int i = 0; i < *test_count; i++)
+    for (int i = 0; i < data->count; i++)
     {
-        (*test)[i] = data[i + *train_count];
+        for (int d = 0; d < data->dim; d++)
+        {
+            double diff = data->features[(size_t)i * data->dim + d] - mean[d];
+            std_dev[d] += diff * diff;
+        }
+    }
+    for (int d = 0; d < data->dim; d++)
+    {
+        std_dev[d] = sqrt(std_dev[d] / data->count);
+        if (std_dev[d] == 0)
+            std_dev[d] = 1;  // a constant feature is only centered
     }
 }
 
-// Function to normalize the data using the z-score normalization technique
-void normalize_data(Iris* data, int count)
+// Function to apply the z-score normalization with the given statistics
+void apply_normalization(Samples* data, const double* mean, const double* std_dev)
 {
-    float mean[4] = {0, 0, 0, 0};
-    float std_dev[4] = {0, 0, 0, 0};
-    for (int i = 0; i < count; i++)
+    for (int i = 0; i < data->count; i++)
     {
-        mean[0] += data[i].sepal_length;
-        mean[1] += data[i].sepal_width;
-        mean[2] += data[i].petal_length;
-        mean[3] += data[i].petal_width;
+        for (int d = 0; d < data->dim; d++)
+        {
+            float* value = &data->features[(size_t)i * data->dim + d];
+            *value = (float)((*value - mean[d]) / std_dev[d]);
+        }
     }
-    for (int i = 0; i < 4; i++)
+}
+
+// Function to find the k-nearest neighbors of the query by scanning every training row, the reference for the indexes.
+// Stores the row indices of the neighbors, nearest first, and returns how many were found.
+int find_k_nearest_neighbors(const KnnFeatures* train, const float* query, int k, int* neighbors)
+{
+    KnnNeighbor* storage = (KnnNeighbor*)malloc(k * sizeof(KnnNeighbor));
+    KnnHeap heap;
+    knn_heap_init(&heap, storage, k);
+    knn_brute_search(train, query, &heap);
+    int found = knn_heap_sort(&heap);
+    for (int i = 0; i < found; i++)
     {
-        mean[i] /= count;
+        neighbors[i] = storage[i].index;
     }
-    for (int i = 0; i < count; i++)
+    free(storage);
+    return (found);
+}
+
+// Function to switch the model to compressed feature storage (float32 drops it). The scan then reads the compressed
+// copy and re-ranks k * rerank candidates with the float features, which spill_float_features moves out of memory;
+// without re-rank drop_float_features can free them.
+void compress_model(KnnModel* model, KnnStorage storage, int rerank)
+{
+    if (model->quantized.data != NULL)
+        knn_quantized_free(&model->quantized);
+    model->quantized.data = NULL;
+    model->quantized.storage = KNN_STORAGE_FLOAT32;
+    model->rerank = rerank;
+    if (storage != KNN_STORAGE_FLOAT32)
+        knn_quantize(&model->quantized, &model->features, storage);
+}
+
+// Function to tell whether searches still read the float32 features: the index and the float32 scan search them,
+// and the compressed scan re-ranks its candidates with them
+int needs_float_features(const KnnModel* model)
+{
+    return (model->index != NULL || model->quantized.data == NULL || model->rerank > 0);
+}
+
+size_t float_features_bytes(const KnnModel* model)
+{
+    return ((size_t)model->features.stride * model->features.dim * sizeof(float));
+}
+
+// Function to tell whether the float32 features are in a mapped file (the model's or the spill file), where their
+// pages are only read in as they are touched, rather than in the process's own memory
+int float_features_in_file(const KnnModel* model)
+{
+    return (model->mapped || model->spill.data != NULL);
+}
+
+// Function to move the float32 features of a compressed model to a temporary file mapped in their place, so the
+// re-rank only reads in the pages of its candidates and the OS can drop them again. If no temporary file can be
+// made they stay in memory.
+void spill_float_features(KnnModel* model)
+{
+    if (model->features.data == NULL || float_features_in_file(model))
+        return;
+    if (mapped_file_copy(&model->spill, model->features.data, float_features_bytes(model)) != 0)
+        return;
+    knn_aligned_free(model->features.data);
+    model->features.data = (float*)model->spill.data;
+}
+
+// Function to hand the pages of mapped float32 features back to the OS after a pass that read them all, such as
+// compressing them or scanning them for comparison; the re-rank reads back the few it needs
+void release_float_features(const KnnModel* model)
+{
+    if (model->features.data == NULL || !float_features_in_file(model))
+        return;
+    mapped_file_release(model->mapped ? &model->file : &model->spill, model->features.data, float_features_bytes(model));
+}
+
+// Function to free the float32 features once the compressed scan is all that reads the training rows. Features
+// mapped from a model file are handed back to the OS instead. The row count and dimension stay set.
+void drop_float_features(KnnModel* model)
+{
+    if (model->features.data == NULL || needs_float_features(model))
+        return;
+    if (model->mapped)
+        mapped_file_release(&model->file, model->features.data, float_features_bytes(model));
+    else if (model->spill.data != NULL)
+        mapped_file_close(&model->spill);
+    else
+        knn_aligned_free(model->features.data);
+    model->features.data = NULL;
+}
+
+// Function to build the model from the training samples, normalized with `mean` and `std_dev`: features are transposed
+// to column-major storage, then either the spatial index is built over them or they are compressed for the scan.
+// Class ids keep the numbering of the dataset's class table.
+void build_model(KnnModel* model, const Samples* train, const double* mean, const double* std_dev, const LabelTable* classes,
+                 const ModelOptions* options)
+{
+    model->mapped = 0;
+    model->quantized.data = NULL;
+    model->spill.data = NULL;
+    model->mean = (double*)malloc(train->dim * sizeof(double));
+    model->std_dev = (double*)malloc(train->dim * sizeof(double));
+    memcpy(model->mean, mean, train->dim * sizeof(double));
+    memcpy(model->std_dev, std_dev, train->dim * sizeof(double));
+    knn_features_from_rows(&model->features, train->features, train->count, train->dim);
+    if (options->index_type == KNN_INDEX_HNSW)
+        model->index = knn_index_build_hnsw(train->features, train->count, train->dim, &options->hnsw);
+    else
+        model->index = knn_index_build(train->features, train->count, train->dim, options->index_type);
+    compress_model(model, options->storage, options->rerank);
+    if (model->quantized.data != NULL)
     {
-        std_dev[0] += pow(data[i].sepal_length - mean[0], 2);
-        std_dev[1] += pow(data[i].sepal_width - mean[1], 2);
-        std_dev[2] += pow(data[i].petal_length - mean[2], 2);
-        std_dev[3] += pow(data[i].petal_width - mean[3], 2);
+        spill_float_features(model);
+        release_float_features(model);  // writing the spill file left them cached
     }
-    for (int i = 0; i < 4; i++)
+    model->labels = (int*)malloc(train->count * sizeof(int));
+    memcpy(model->labels, train->labels, train->count * sizeof(int));
+    model->class_count = classes->count;
+    model->class_names = (char**)malloc(classes->count * sizeof(char*));
+    for (int i = 0; i < classes->count; i++)
     {
-        std_dev[i] = sqrt(std_dev[i] / count);
+        model->class_names[i] = strdup(classes->names[i]);
     }
-    for (int i = 0; i < count; i++)
+    knn_scratch_init(&model->scratch);
+}
+
+void free_model(KnnModel* model)
+{
+    knn_scratch_free(&model->scratch);
+    knn_index_free(model->index);
+    if (model->quantized.data != NULL)
+        knn_quantized_free(&model->quantized);
+    if (model->mapped)
     {
-        data[i].sepal_length = (data[i].sepal_length - mean[0]) / std_dev[0];
-        data[i].sepal_width = (data[i].sepal_width - mean[1]) / std_dev[1];
-        data[i].petal_length = (data[i].petal_length - mean[2]) / std_dev[2];
-        data[i].petal_width = (data[i].petal_width - mean[3]) / std_dev[3];
+        free(model->class_names);  // the names themselves are in the file
+        mapped_file_close(&model->file);
+        return;
+    }
+    free(model->mean);
+    free(model->std_dev);
+    if (model->spill.data != NULL)
+        mapped_file_close(&model->spill);
+    else
+        knn_features_free(&model->features);
+    free(model->labels);
+    for (int i = 0; i < model->class_count; i++)
+    {
+        free(model->class_names[i]);
     }
+    free(model->class_names);
 }
 
-// Function to calculate the Euclidean distance between two data points
-double calculate_distance(Iris* a, Iris* b)
+// Sizes saved ahead of the model's arrays
+typedef struct {
+    int32_t count;
+    int32_t dim;
+    int32_t stride;
+    int32_t class_count;
+    int32_t index_type;
+    int32_t reserved;
+} ModelHeader;
+
+// Function to save the model to a binary file: the normalization, the column-major features exactly as they are in
+// memory (padding included), the class of every row, the class names and the built index.
+// Returns 0 on success and -1 if the file could not be written.
+int save_model(const KnnModel* model, const char* filename)
 {
-    double sum = pow(a->sepal_length - b->sepal_length, 2)
-               + pow(a->sepal_width - b->sepal_width, 2)
-               + pow(a->petal_length - b->petal_length, 2)
-               + pow(a->petal_width - b->petal_width, 2);
-    return (sqrt(sum));
+    BinaryWriter writer;
+    if (binary_writer_open(&writer, filename, MODEL_MAGIC, MODEL_VERSION) != 0)
+        return (-1);
+    ModelHeader header = {model->features.count, model->features.dim, model->features.stride, model->class_count,
+                          knn_index_type(model->index), 0};
+    binary_write(&writer, &header, sizeof(header));
+    binary_write(&writer, model->mean, header.dim * sizeof(double));
+    binary_write(&writer, model->std_dev, header.dim * sizeof(double));
+    binary_write(&writer, model->features.data, (size_t)header.stride * header.dim * sizeof(float));
+    binary_write(&writer, model->labels, header.count * sizeof(int));
+    size_t names_size = 0;
+    for (int i = 0; i < model->class_count; i++)
+    {
+        names_size += strlen(model->class_names[i]) + 1;
+    }
+    char* names = (char*)malloc(names_size);
+    char* cursor = names;
+    for (int i = 0; i < model->class_count; i++)
+    {
+        size_t length = strlen(model->class_names[i]) + 1;
+        memcpy(cursor, model->class_names[i], length);
+        cursor += length;
+    }
+    binary_write(&writer, names, names_size);
+    free(names);
+    if (model->index != NULL)
+        knn_index_save(model->index, &writer);
+    return (binary_writer_close(&writer));
 }
 
-// Function to find the k-nearest neighbors of the query data in the training data and return the neighbors
-void find_k_nearest_neighbors(Iris* train, int train_count, Iris* query, int k, Iris** neighbors)
+// Function to load a model saved by save_model. The file is mapped and used in place, so nothing is parsed, copied or
+// rebuilt, and pages are only read from disk as searches touch them. Returns 0 on success, -1 (after printing why) on error.
+int load_model(KnnModel* model, const char* filename)
 {
-    double* distances = (double*)malloc(train_count * sizeof(double));
-    for (int i = 0; i < train_count; i++)
+    memset(model, 0, sizeof(*model));
+    if (mapped_file_open(&model->file, filename) != 0)
     {
-        distances[i] = calculate_distance(&train[i], query);
+        printf("Could not open model %s\n", filename);
+        return (-1);
     }
-    for (int i = 0; i < k; i++)
+    model->mapped = 1;
+    BinaryReader reader;
+    uint32_t version = binary_reader_open(&reader, model->file.data, model->file.size, MODEL_MAGIC);
+    if (version != MODEL_VERSION)
     {
-        int min_index = i;
-        for (int j = i + 1; j < train_count; j++)
+        printf("%s is not a version %d model file\n", filename, MODEL_VERSION);
+        mapped_file_close(&model->file);
+        return (-1);
+    }
+    const ModelHeader* header = (const ModelHeader*)binary_read_exact(&reader, sizeof(ModelHeader));
+    // Every class has at least one training row, so there are never more classes than rows
+    if (header != NULL && header->count > 0 && header->dim > 0 && header->stride >= knn_padded_stride(header->count) && header->class_count > 0 &&
+        header->class_count <= header->count)
+    {
+        model->features.count = header->count;
+        model->features.dim = header->dim;
+        model->features.stride = header->stride;
+        model->class_count = header->class_count;
+        model->mean = (double*)binary_read_exact(&reader, header->dim * sizeof(double));
+        model->std_dev = (double*)binary_read_exact(&reader, header->dim * sizeof(double));
+        model->features.data = (float*)binary_read_exact(&reader, (size_t)header->stride * header->dim * sizeof(float));
+        model->labels = (int*)binary_read_exact(&reader, header->count * sizeof(int));
+        size_t names_size = 0;
+        const char* names = (const char*)binary_read(&reader, &names_size);
+        model->class_names = (char**)malloc(header->class_count * sizeof(char*));
+        if (model->class_names == NULL)
+            names = NULL;
+        size_t offset = 0;
+        for (int i = 0; i < header->class_count && names != NULL; i++)
+        {
+            const char* end = (offset < names_size) ? (const char*)memchr(names + offset, '\0', names_size - offset) : NULL;
+            if (end == NULL)
+            {
+                names = NULL;  // truncated name table
+                break;
+            }
+            model->class_names[i] = (char*)(names + offset);
+            offset = end - names + 1;
+        }
+        for (int i = 0; i < header->count && model->labels != NULL; i++)
+        {
+            if (model->labels[i] < 0 || model->labels[i] >= header->class_count)
+                names = NULL;  // a class with no name
+        }
+        if (header->index_type != KNN_INDEX_NONE && !reader.failed)
+            model->index = knn_index_map(&reader, header->count, header->dim);
+        if (!reader.failed && names != NULL && (header->index_type == KNN_INDEX_NONE || model->index != NULL))
         {
-            if (distances[j] < distances[min_index])
-                min_index = j;
+            knn_simd_init();  // the features were mapped, not built, so nothing has picked the kernel yet
+            knn_scratch_init(&model->scratch);
+            return (0);
         }
-        neighbors[i] = &train[min_index];
-        distances[min_index] = distances[i];
+        knn_index_free(model->index);
+        free(model->class_names);
     }
-    free(distances);
+    printf("%s is truncated or corrupt\n", filename);
+    mapped_file_close(&model->file);
+    return (-1);
 }
 
-// Function to classify the query data using the k-nearest neighbors algorithm and return the class
-char* classify(Iris* train, int train_count, Iris* query, int k)
+// Function to pick the most common class among the neighbors; on a tie the class of the nearer neighbor wins
+int majority_class(const KnnModel* model, const KnnNeighbor* neighbors, int found)
 {
-    Iris** neighbors = (Iris**)malloc(k * sizeof(Iris*));
-    find_k_nearest_neighbors(train, train_count, query, k, neighbors);
     int max_count = 0;
-    char* class = NULL;
-    for (int i = 0; i < k; i++)
+    int class = -1;
+    for (int i = 0; i < found; i++)
     {
+        int label = model->labels[neighbors[i].index];
         int count = 0;
-        for (int j = 0; j < k; j++)
+        for (int j = 0; j < found; j++)
         {
-            if (strcmp(neighbors[i]->class_name, neighbors[j]->class_name) == 0)
+            if (model->labels[neighbors[j].index] == label)
                 count++;
         }
         if (count > max_count)
         {
             max_count = count;
-            class = neighbors[i]->class_name;
+            class = label;
         }
     }
-    free(neighbors);
     return (class);
 }
 
-// Function to evaluate the accuracy of the model using the test data and k value
-double evaluate(Iris* train, int train_count, Iris* test, int test_count, int k)
+// Function to classify the query data using the k-nearest neighbors algorithm and return the class.
+// Uses the spatial index when one was built, otherwise scans the training rows.
+const char* classify(KnnModel* model, const float* query, int k)
+{
+    KnnNeighbor* neighbors = (KnnNeighbor*)malloc(k * sizeof(KnnNeighbor));
+    KnnHeap heap;
+    knn_heap_init(&heap, neighbors, k);
+    if (model->index != NULL)
+        knn_index_search(model->index, query, &heap);
+    else
+        knn_brute_search(&model->features, query, &heap);
+    int class = majority_class(model, neighbors, knn_heap_sort(&heap));
+    free(neighbors);
+    return (model->class_names[class]);
+}
+
+// Function to find the k nearest training rows of each query the way the model is set up to: through the index,
+// over the compressed features, or with a plain scan, handing each result to `on_result`
+void model_search(KnnModel* model, const float* queries, int query_count, int k, KnnResultFn on_result, void* context)
+{
+    if (model->quantized.data != NULL)
+        knn_batch_search_quantized(&model->quantized, &model->features, model->rerank, queries, query_count, k, &model->scratch, on_result,
+                                   context);
+    else
+        knn_batch_search(&model->features, model->index, queries, query_count, k, &model->scratch, on_result, context);
+}
+
+typedef struct {
+    const KnnModel* model;
+    int* predictions;
+    int* neighbors;  // optional, k row indices per query, -1 where fewer were found
+    int k;
+} BatchVotes;
+
+// Function called by the batch workers to store the vote of one query
+void store_prediction(void* context, int query, const KnnNeighbor* neighbors, int found)
+{
+    BatchVotes* votes = (BatchVotes*)context;
+    votes->predictions[query] = majority_class(votes->model, neighbors, found);
+    if (votes->neighbors != NULL)
+    {
+        int* row = votes->neighbors + (size_t)query * votes->k;
+        for (int i = 0; i < votes->k; i++)
+        {
+            row[i] = (i < found) ? neighbors[i].index : -1;
+        }
+    }
+}
+
+// Function to classify a block of row-major queries on all cores, storing the class id of each one in predictions.
+// The per-thread heaps live in the model, so only the first batch allocates.
+void classify_batch(KnnModel* model, const float* queries, int query_count, int k, int* predictions)
+{
+    BatchVotes votes = {model, predictions, NULL, k};
+    model_search(model, queries, query_count, k, store_prediction, &votes);
+}
+
+// Function to read a monotonic wall clock in seconds
+double now_seconds(void)
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (ts.tv_sec + ts.tv_nsec * 1e-9);
+}
+
+// Function to measure the share of predictions that match the labels; `stride` steps over the predictions of other k values
+double score_predictions(const int* predictions, int stride, const int* labels, int count)
 {
     int correct_predictions = 0;
-    for (int i = 0; i < test_count; i++)
+    for (int i = 0; i < count; i++)
     {
-        char* predicted_class = classify(train, train_count, &test[i], k);
-        if (strcmp(predicted_class, test[i].class_name) == 0)
+        if (predictions[(size_t)i * stride] == labels[i])
             correct_predictions++;
     }
-    return ((double)correct_predictions / test_count);
+    return (count ? (double)correct_predictions / count : 0.0);
 }
 
-// Function to write the results to a CSV file
-void write_results_to_csv(Iris* test, int test_count, Iris* train, int train_count, int k, const char* filename)
+// Function to evaluate the accuracy of the model using the test data and k value.
+// The predicted class ids are kept in `predictions` (test->count entries) so they can be written out without searching again.
+// With compressed storage the test set is also classified from the float32 features, and the accuracy lost, the bytes
+// scanned per row, the bytes the model keeps in memory once serving and the time of both scans are printed.
+double evaluate(KnnModel* model, const Samples* test, int k, int* predictions)
+{
+    double start = now_seconds();
+    classify_batch(model, test->features, test->count, k, predictions);
+    double seconds = now_seconds() - start;
+    double accuracy = score_predictions(predictions, 1, test->labels, test->count);
+    if (model->quantized.data == NULL)
+        return (accuracy);
+
+    int* exact = (int*)malloc(test->count * sizeof(int));
+    BatchVotes votes = {model, exact, NULL, k};
+    start = now_seconds();
+    knn_batch_search(&model->features, NULL, test->features, test->count, k, &model->scratch, store_prediction, &votes);
+    double exact_seconds = now_seconds() - start;
+    double exact_accuracy = score_predictions(exact, 1, test->labels, test->count);
+    int changed = 0;
+    for (int i = 0; i < test->count; i++)
+    {
+        changed += (exact[i] != predictions[i]);
+    }
+    release_float_features(model);  // the comparison scan read every page
+    // Float32 features in a mapped file are only partly resident, and the OS can drop them again
+    size_t float_bytes = float_features_bytes(model);
+    size_t resident = knn_quantized_bytes(&model->quantized) + (needs_float_features(model) && !float_features_in_file(model) ? float_bytes : 0);
+    printf("%s storage: %zu bytes/row vs %zu, %zu bytes resident vs %zu, scan %.3f ms vs %.3f ms, accuracy %.2f%% vs %.2f%% (%+.2f points, %d predictions changed, re-rank %d)\n",
+           knn_storage_name(model->quantized.storage), knn_quantized_row_bytes(&model->quantized), model->features.dim * sizeof(float), resident,
+           float_bytes, seconds * 1e3, exact_seconds * 1e3, accuracy * 100, exact_accuracy * 100, (accuracy - exact_accuracy) * 100, changed,
+           model->rerank);
+    free(exact);
+    return (accuracy);
+}
+
+// Function to write the samples with their actual and predicted classes to a CSV file
+void write_results_to_csv(const Samples* test, char** class_names, const int* predictions, int stride, const char* filename)
 {
     FILE* file = fopen(filename, "w");
     if (file == NULL)
@@ -176,15 +568,256 @@ void write_results_to_csv(Iris* test, int test_count, Iris* train, int train_cou
         printf("Could not open file %s\n", filename);
         return;
     }
-    fprintf(file, "sepal_length,sepal_width,petal_length,petal_width,actual_class,predicted_class\n");
-    for (int i = 0; i < test_count; i++)
+    for (int d = 0; d < test->dim; d++)
+    {
+        fprintf(file, "feature_%d,", d + 1);
+    }
+    fprintf(file, "actual_class,predicted_class\n");
+    for (int i = 0; i < test->count; i++)
     {
-        char* predicted_class = classify(train, train_count, &test[i], k);
-        fprintf(file, "%f,%f,%f,%f,%s,%s\n", test[i].sepal_length, test[i].sepal_width, test[i].petal_length, test[i].petal_width, test[i].class_name, predicted_class);
+        for (int d = 0; d < test->dim; d++)
+        {
+            fprintf(file, "%f,", test->features[(size_t)i * test->dim + d]);
+        }
+        fprintf(file, "%s,%s\n", (test->labels[i] >= 0) ? class_names[test->labels[i]] : "", class_names[predictions[(size_t)i * stride]]);
     }
     fclose(file);
 }
 
+// Function to predict the class of one query for every k from 1 to k_max out of its k_max nearest neighbors, sorted
+// nearest first. Votes are added one neighbor at a time, so out[k - 1] is exactly what majority_class gives for k
+// neighbors, tie rule included: classes are kept in order of first appearance and the earlier one wins a tie.
+void sweep_votes(const KnnModel* model, const KnnNeighbor* neighbors, int found, int k_max, int* out)
+{
+    int classes[KNN_MAX_K];
+    int counts[KNN_MAX_K];
+    int distinct = 0;
+    int best = 0;
+    for (int i = 0; i < k_max; i++)
+    {
+        if (i < found)
+        {
+            int label = model->labels[neighbors[i].index];
+            int slot = 0;
+            while (slot < distinct && classes[slot] != label)
+                slot++;
+            if (slot == distinct)
+            {
+                classes[distinct] = label;
+                counts[distinct++] = 0;
+            }
+            counts[slot]++;
+            if (counts[slot] > counts[best] || (counts[slot] == counts[best] && slot < best))
+                best = slot;
+        }
+        out[i] = (distinct > 0) ? classes[best] : -1;
+    }
+}
+
+typedef struct {
+    const KnnModel* model;
+    int k_max;
+    int* predictions;  // k_max class ids per query, the one for k at [query * k_max + k - 1]
+} SweepVotes;
+
+// Function called by the batch workers to store the votes of one query for every k
+void store_sweep(void* context, int query, const KnnNeighbor* neighbors, int found)
+{
+    SweepVotes* votes = (SweepVotes*)context;
+    sweep_votes(votes->model, neighbors, found, votes->k_max, votes->predictions + (size_t)query * votes->k_max);
+}
+
+// Function to classify the queries for every k from 1 to k_max with a single k_max-neighbor search per query
+void classify_sweep(KnnModel* model, const float* queries, int query_count, int k_max, int* predictions)
+{
+    SweepVotes votes = {model, k_max, predictions};
+    model_search(model, queries, query_count, k_max, store_sweep, &votes);
+}
+
+// Function to split the (shuffled) data for fold `fold` of `folds`: that fold is the test set and every other row trains
+void take_fold(const Dataset* data, int fold, int folds, Samples* train, Samples* test)
+{
+    size_t first = data->rows * fold / folds;
+    size_t last = data->rows * (fold + 1) / folds;
+    take_samples(data, first, (int)(last - first), test);
+    train->count = (int)(data->rows - (last - first));
+    train->dim = data->cols;
+    train->features = (float*)malloc((size_t)train->count * data->cols * sizeof(float));
+    train->labels = (int*)malloc(train->count * sizeof(int));
+    size_t row = 0;
+    for (size_t i = 0; i < data->rows; i++)
+    {
+        if (i >= first && i < last)
+            continue;
+        for (int d = 0; d < data->cols; d++)
+        {
+            train->features[row * data->cols + d] = (float)data->values[i * data->cols + d];
+        }
+        train->labels[row++] = data->labels[i];
+    }
+}
+
+// Function to run k-fold cross-validation for every k from 1 to k_max. Each row is predicted once, by the model
+// trained on the other folds, from one k_max-neighbor search; predictions (rows * k_max) receives every vote.
+// The folds run in parallel, each with its own model; the per-fold accuracies go to fold_accuracy (folds * k_max).
+void cross_validate(const Dataset* data, int folds, int k_max, const ModelOptions* options, int* predictions, double* fold_accuracy)
+{
+#ifdef _OPENMP
+    int threads = knn_thread_count();
+#endif
+    // Every fold builds a model, so the kernels are picked here rather than by whichever fold builds first
+    knn_simd_init();
+    knn_quant_init();
+#pragma omp parallel for schedule(dynamic, 1) num_threads(threads < folds ? threads : folds)
+    for (int fold = 0; fold < folds; fold++)
+    {
+        Samples train, test;
+        take_fold(data, fold, folds, &train, &test);
+        double* mean = (double*)malloc(train.dim * sizeof(double));
+        double* std_dev = (double*)malloc(train.dim * sizeof(double));
+        feature_stats(&train, mean, std_dev);
+        apply_normalization(&train, mean, std_dev);
+        apply_normalization(&test, mean, std_dev);  // the held-out fold is scaled like the data the model saw
+
+        KnnModel model;
+        build_model(&model, &train, mean, std_dev, &data->classes, options);
+        free(mean);
+        free(std_dev);
+        int* fold_predictions = predictions + (data->rows * fold / folds) * k_max;
+        classify_sweep(&model, test.features, test.count, k_max, fold_predictions);
+        for (int k = 1; k <= k_max; k++)
+        {
+            fold_accuracy[(size_t)fold * k_max + k - 1] = score_predictions(fold_predictions + k - 1, k_max, test.labels, test.count);
+        }
+        free_model(&model);
+        free_samples(&train);
+        free_samples(&test);
+    }
+}
+
+// Function to choose k by cross-validation: prints the mean and spread of the accuracy over the folds for every k,
+// writes the out-of-fold predictions for the best k to `filename` and returns that k (the smallest one on a tie).
+// The file holds the same rows as the one written without --select, the test split scaled by the training split.
+int select_k(const Dataset* data, int folds, int k_max, const ModelOptions* options, const char* filename)
+{
+    int* predictions = (int*)malloc(data->rows * k_max * sizeof(int));
+    double* fold_accuracy = (double*)malloc((size_t)folds * k_max * sizeof(double));
+    double start = now_seconds();
+    cross_validate(data, folds, k_max, options, predictions, fold_accuracy);
+    double seconds = now_seconds() - start;
+
+    printf("%d-fold cross-validation, k = 1..%d, %s, %.3f s\n", folds, k_max, knn_index_name(options->index_type), seconds);
+    printf("%4s %10s %8s\n", "k", "accuracy", "std");
+    int best_k = 1;
+    double best_accuracy = -1;
+    for (int k = 1; k <= k_max; k++)
+    {
+        double mean = 0, variance = 0;
+        for (int f = 0; f < folds; f++)
+        {
+            mean += fold_accuracy[(size_t)f * k_max + k - 1];
+        }
+        mean /= folds;
+        for (int f = 0; f < folds; f++)
+        {
+            double diff = fold_accuracy[(size_t)f * k_max + k - 1] - mean;
+            variance += diff * diff;
+        }
+        printf("%4d %9.2f%% %7.2f%%\n", k, mean * 100, sqrt(variance / folds) * 100);
+        if (mean > best_accuracy)
+        {
+            best_accuracy = mean;
+            best_k = k;
+        }
+    }
+    printf("Best k: %d (%.2f%%)\n", best_k, best_accuracy * 100);
+
+    Samples train, test;
+    split_data(data, &train, &test);
+    double* mean = (double*)malloc(train.dim * sizeof(double));
+    double* std_dev = (double*)malloc(train.dim * sizeof(double));
+    feature_stats(&train, mean, std_dev);
+    apply_normalization(&test, mean, std_dev);
+    write_results_to_csv(&test, data->classes.names, predictions + (size_t)train.count * k_max + best_k - 1, k_max, filename);
+    free(mean);
+    free(std_dev);
+    free_samples(&train);
+    free_samples(&test);
+    free(predictions);
+    free(fold_accuracy);
+    return (best_k);
+}
+
+// Function to measure the fraction of the exact k nearest neighbors that an approximate search also found
+double recall_at_k(const int* approximate, const int* exact, int query_count, int k)
+{
+    size_t hits = 0, total = 0;
+    for (int q = 0; q < query_count; q++)
+    {
+        const int* found = approximate + (size_t)q * k;
+        const int* truth = exact + (size_t)q * k;
+        for (int i = 0; i < k && truth[i] >= 0; i++)
+        {
+            total++;
+            for (int j = 0; j < k; j++)
+            {
+                if (found[j] == truth[i])
+                {
+                    hits++;
+                    break;
+                }
+            }
+        }
+    }
+    return (total ? (double)hits / total : 1.0);
+}
+
+// Function to compare an approximate index with the brute-force path on the test set: for a range of
+// search list sizes (ef) it prints the recall of the k nearest neighbors, the time per query and the accuracy
+void report_recall(KnnModel* model, const Samples* test, int k)
+{
+    int* exact = (int*)malloc((size_t)test->count * k * sizeof(int));
+    int* found = (int*)malloc((size_t)test->count * k * sizeof(int));
+    int* predictions = (int*)malloc(test->count * sizeof(int));
+
+    BatchVotes votes = {model, predictions, exact, k};
+    knn_batch_search(&model->features, NULL, test->features, test->count, k, &model->scratch, store_prediction, &votes);  // warm-up
+    double start = now_seconds();
+    knn_batch_search(&model->features, NULL, test->features, test->count, k, &model->scratch, store_prediction, &votes);
+    double brute_seconds = now_seconds() - start;
+    int correct = 0;
+    for (int i = 0; i < test->count; i++)
+    {
+        correct += (predictions[i] == test->labels[i]);
+    }
+    double brute_accuracy = (double)correct / test->count;
+    printf("%-10s %8s %12s %9s %9s\n", "search", "recall", "us/query", "speedup", "accuracy");
+    printf("%-10s %8.4f %12.3f %8.1fx %8.2f%%\n", "exact", 1.0, brute_seconds * 1e6 / test->count, 1.0, brute_accuracy * 100);
+
+    int ef_values[] = {10, 20, 40, 80, 160, 320};
+    votes.neighbors = found;
+    for (int e = 0; e < (int)(sizeof(ef_values) / sizeof(ef_values[0])); e++)
+    {
+        knn_index_set_ef(model->index, ef_values[e]);
+        knn_batch_search(&model->features, model->index, test->features, test->count, k, &model->scratch, store_prediction, &votes);  // warm-up
+        start = now_seconds();
+        knn_batch_search(&model->features, model->index, test->features, test->count, k, &model->scratch, store_prediction, &votes);
+        double seconds = now_seconds() - start;
+        correct = 0;
+        for (int i = 0; i < test->count; i++)
+        {
+            correct += (predictions[i] == test->labels[i]);
+        }
+        char label[32];
+        snprintf(label, sizeof(label), "ef=%d", ef_values[e]);
+        printf("%-10s %8.4f %12.3f %8.1fx %8.2f%%\n", label, recall_at_k(found, exact, test->count, k), seconds * 1e6 / test->count,
+               brute_seconds / seconds, (double)correct / test->count * 100);
+    }
+    free(exact);
+    free(found);
+    free(predictions);
+}
+
 // Function to plot the data using gnuplot (Bar chart)
 void plot_data() {
     FILE *pipe = popen("gnuplot", "w");
@@ -205,34 +838,382 @@ void plot_data() {
     pclose(pipe);
 }
 
-// MAIN Function free the memory and call the functions
-int main()
+// Function to benchmark the brute-force scan against the spatial indexes on uniform random data.
+// Reports queries per second for each path and how many queries disagree with the brute-force result.
+void run_benchmark(int count, int dim, int query_count, int k, uint64_t seed)
 {
-    int count;
-    Iris* data = read_data("iris.data", &count);
-    if (data == NULL)
+    float* points = (float*)malloc((size_t)count * dim * sizeof(float));
+    float* queries = (float*)malloc((size_t)query_count * dim * sizeof(float));
+    Rng rng;
+    rng_seed(&rng, seed, 0);
+    RngLanes lanes;
+    rng_lanes_init(&lanes, &rng);
+    rng_fill_uniform_float(&lanes, points, (size_t)count * dim);
+    rng_fill_uniform_float(&lanes, queries, (size_t)query_count * dim);
+    int* expected = (int*)malloc((size_t)query_count * k * sizeof(int));
+    int* neighbors = (int*)malloc((size_t)query_count * k * sizeof(int));
+    KnnFeatures features;
+    knn_features_from_rows(&features, points, count, dim);
+
+    printf("Benchmark: %d training points, %d dimensions, %d queries, k=%d, %s kernel\n", count, dim, query_count, k, knn_simd_name());
+    double start = now_seconds();
+    for (int q = 0; q < query_count; q++)
+    {
+        find_k_nearest_neighbors(&features, queries + (size_t)q * dim, k, expected + (size_t)q * k);
+    }
+    double brute_seconds = now_seconds() - start;
+    printf("%-12s build %8.3f s  %12.1f queries/s\n", knn_index_name(KNN_INDEX_NONE), 0.0, query_count / brute_seconds);
+
+    KnnIndexType types[] = {KNN_INDEX_KDTREE, KNN_INDEX_BALLTREE, KNN_INDEX_HNSW};
+    for (int t = 0; t < 3; t++)
+    {
+        start = now_seconds();
+        KnnIndex* index = knn_index_build(points, count, dim, types[t]);
+        double build_seconds = now_seconds() - start;
+        int mismatches = 0;
+        start = now_seconds();
+        for (int q = 0; q < query_count; q++)
+        {
+            knn_index_query(index, queries + (size_t)q * dim, k, neighbors + (size_t)q * k, NULL);
+        }
+        double seconds = now_seconds() - start;
+        for (int q = 0; q < query_count; q++)
+        {
+            if (memcmp(neighbors + (size_t)q * k, expected + (size_t)q * k, k * sizeof(int)) != 0)
+                mismatches++;
+        }
+        printf("%-12s build %8.3f s  %12.1f queries/s  speedup %6.1fx  mismatches %d  recall %.4f\n", knn_index_name(types[t]), build_seconds,
+               query_count / seconds, brute_seconds / seconds, mismatches, recall_at_k(neighbors, expected, query_count, k));
+        knn_index_free(index);
+    }
+
+    // Compressed scans, with and without the full-precision re-rank of 4k candidates
+    KnnNeighbor* storage = (KnnNeighbor*)malloc(5 * k * sizeof(KnnNeighbor));
+    KnnStorage storages[] = {KNN_STORAGE_FP16, KNN_STORAGE_INT8};
+    for (int t = 0; t < 2; t++)
+    {
+        KnnQuantized quantized;
+        knn_quantize(&quantized, &features, storages[t]);
+        for (int rerank = 4; rerank >= 0; rerank -= 4)
+        {
+            int mismatches = 0;
+            start = now_seconds();
+            for (int q = 0; q < query_count; q++)
+            {
+                KnnHeap heap, candidates;
+                knn_heap_init(&heap, storage, k);
+                knn_heap_init(&candidates, storage + k, rerank * k);
+                knn_quantized_search(&quantized, rerank ? &features : NULL, queries + (size_t)q * dim, &candidates, &heap);
+                int found = knn_heap_sort(&heap);
+                for (int i = 0; i < k; i++)
+                {
+                    neighbors[(size_t)q * k + i] = (i < found) ? storage[i].index : -1;
+                }
+            }
+            double seconds = now_seconds() - start;
+            for (int q = 0; q < query_count; q++)
+            {
+                if (memcmp(neighbors + (size_t)q * k, expected + (size_t)q * k, k * sizeof(int)) != 0)
+                    mismatches++;
+            }
+            char name[32];
+            snprintf(name, sizeof(name), "%s%s", knn_storage_name(storages[t]), rerank ? "+rerank" : "");
+            printf("%-12s %2zu B/row %7s  %12.1f queries/s  speedup %6.1fx  mismatches %d  recall %.4f\n", name,
+                   knn_quantized_row_bytes(&quantized), "", query_count / seconds, brute_seconds / seconds, mismatches,
+                   recall_at_k(neighbors, expected, query_count, k));
+        }
+        knn_quantized_free(&quantized);
+    }
+    free(storage);
+
+    // Batched search with 1, 2, 4, ... threads up to all of them
+    int max_threads = knn_thread_count();
+    KnnIndex* kdtree = knn_index_build(points, count, dim, KNN_INDEX_KDTREE);
+    KnnScratch scratch;
+    knn_scratch_init(&scratch);
+    for (int path = 0; path < 2; path++)
+    {
+        const KnnIndex* index = (path == 0) ? NULL : kdtree;
+        double single_rate = 0;
+        for (int threads = 1; threads <= max_threads; threads = (threads < max_threads && 2 * threads > max_threads) ? max_threads : 2 * threads)
+        {
+            knn_set_threads(threads);
+            knn_batch_search(&features, index, queries, query_count, k, &scratch, NULL, NULL);  // warm-up
+            start = now_seconds();
+            knn_batch_search(&features, index, queries, query_count, k, &scratch, NULL, NULL);
+            double rate = query_count / (now_seconds() - start);
+            if (threads == 1)
+                single_rate = rate;
+            printf("batch %-12s %3d threads  %12.1f queries/s  scaling %5.2fx\n", knn_index_name(path == 0 ? KNN_INDEX_NONE : KNN_INDEX_KDTREE), threads, rate,
+                   rate / single_rate);
+        }
+    }
+    knn_set_threads(max_threads);
+    knn_scratch_free(&scratch);
+    knn_index_free(kdtree);
+
+    knn_features_free(&features);
+    free(points);
+    free(queries);
+    free(expected);
+    free(neighbors);
+}
+
+// Function to classify every row of a CSV file with a saved model: the rows are normalized with the training set's
+// statistics stored in the model, the predictions go to `output` and, when the file has a class column, the accuracy
+// is printed. Returns 0 on success, 1 on error.
+int predict_file(const char* model_path, const char* data_path, int k, const ModelOptions* options, const char* output)
+{
+    double start = now_seconds();
+    KnnModel model;
+    if (load_model(&model, model_path) != 0)
+        return (1);
+    printf("Loaded %s: %d training rows, %d features, %s, in %.3f ms\n", model_path, model.features.count, model.features.dim,
+           knn_index_name(knn_index_type(model.index)), (now_seconds() - start) * 1e3);
+
+    Dataset data;
+    if (dataset_load(data_path, &data) != 0)
+    {
+        free_model(&model);
+        return (1);
+    }
+    if (data.cols != model.features.dim)
+    {
+        printf("%s has %d features, the model expects %d\n", data_path, data.cols, model.features.dim);
+        dataset_free(&data);
+        free_model(&model);
+        return (1);
+    }
+    if (options->storage != KNN_STORAGE_FLOAT32 && model.index == NULL)
+    {
+        compress_model(&model, options->storage, options->rerank);  // compressed after loading: the file holds float32
+        drop_float_features(&model);
+        release_float_features(&model);  // with re-rank, only the candidates' pages are read back
+    }
+    Samples queries;
+    take_samples(&data, 0, (int)data.rows, &queries);
+    apply_normalization(&queries, model.mean, model.std_dev);
+    int* predictions = (int*)malloc(queries.count * sizeof(int));
+    classify_batch(&model, queries.features, queries.count, k, predictions);
+
+    // Give the predictions the ids of the file's class table, adding the classes the file does not have
+    int* class_ids = (int*)malloc(model.class_count * sizeof(int));
+    for (int c = 0; c < model.class_count; c++)
+    {
+        class_ids[c] = label_table_intern(&data.classes, model.class_names[c], strlen(model.class_names[c]));
+    }
+    for (int i = 0; i < queries.count; i++)
+    {
+        predictions[i] = class_ids[predictions[i]];
+    }
+    if (data.labels != NULL)
+        printf("Accuracy: %.2f%% (k=%d, %s kernel)\n", score_predictions(predictions, 1, queries.labels, queries.count) * 100, k,
+               knn_simd_name());
+    write_results_to_csv(&queries, data.classes.names, predictions, 1, output);
+
+    free(class_ids);
+    free(predictions);
+    free_samples(&queries);
+    dataset_free(&data);
+    free_model(&model);
+    return (0);
+}
+
+// MAIN Function free the memory and call the functions.
+// Usage: knn [--data file.csv] [--k n] [--select k_max [--folds n]] [--save model.bin | --model model.bin] [--index none|kd|ball|hnsw] [--storage float32|fp16|int8 [--rerank n]] [--hnsw-m m] [--ef-construction n] [--ef n] [--threads n] [--seed n] [--bench [points [dimensions [queries]]]]
+int main(int argc, char** argv)
+{
+    ModelOptions options;
+    options.index_type = KNN_INDEX_KDTREE;
+    knn_hnsw_default_params(&options.hnsw);
+    options.storage = KNN_STORAGE_FLOAT32;
+    options.rerank = 4;
+    int index_given = 0;
+    const char* data_path = "iris.data";
+    int k = 3;
+    int k_max = 0;  // > 0 selects k by cross-validation
+    int folds = 5;
+    const char* save_path = NULL;   // train, then write the model here
+    const char* model_path = NULL;  // classify --data with this saved model instead of training
+    uint64_t seed = DEFAULT_SEED;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--index") == 0 && i + 1 < argc)
+        {
+            if (!knn_index_parse(argv[++i], &options.index_type))
+            {
+                printf("Unknown index %s (expected none, kd, ball or hnsw)\n", argv[i]);
+                return (1);
+            }
+            index_given = 1;
+        }
+        else if (strcmp(argv[i], "--storage") == 0 && i + 1 < argc)
+        {
+            if (!knn_storage_parse(argv[++i], &options.storage))
+            {
+                printf("Unknown storage %s (expected float32, fp16 or int8)\n", argv[i]);
+                return (1);
+            }
+        }
+        else if (strcmp(argv[i], "--rerank") == 0 && i + 1 < argc)
+        {
+            options.rerank = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--data") == 0 && i + 1 < argc)
+        {
+            data_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--hnsw-m") == 0 && i + 1 < argc)
+        {
+            options.hnsw.m = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--ef-construction") == 0 && i + 1 < argc)
+        {
+            options.hnsw.ef_construction = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--ef") == 0 && i + 1 < argc)
+        {
+            options.hnsw.ef_search = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--k") == 0 && i + 1 < argc)
+        {
+            k = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--select") == 0 && i + 1 < argc)
+        {
+            k_max = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--folds") == 0 && i + 1 < argc)
+        {
+            folds = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--save") == 0 && i + 1 < argc)
+        {
+            save_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--model") == 0 && i + 1 < argc)
+        {
+            model_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            knn_set_threads(atoi(argv[++i]));
+        }
+        else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+        {
+            seed = strtoull(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--bench") == 0)
+        {
+            int params[3] = {200000, 4, 2000};
+            for (int p = 0; p < 3 && i + 1 < argc && argv[i + 1][0] != '-'; p++)
+            {
+                params[p] = atoi(argv[++i]);
+            }
+            run_benchmark(params[0], params[1], params[2], k, seed);
+            return (0);
+        }
+        else
+        {
+            printf("Usage: %s [--data file.csv] [--k n] [--select k_max [--folds n]] [--save model.bin | --model model.bin] [--index none|kd|ball|hnsw] [--storage float32|fp16|int8 [--rerank n]] [--hnsw-m m] [--ef-construction n] [--ef n] [--threads n] [--seed n] [--bench [points [dimensions [queries]]]]\n", argv[0]);
+            return (1);
+        }
+    }
+
+    if (k < 1 || k > KNN_MAX_K)
+    {
+        printf("k must be between 1 and %d\n", KNN_MAX_K);
+        return (1);
+    }
+    if (options.rerank < 0 || options.rerank > KNN_MAX_RERANK)
+    {
+        printf("rerank must be between 0 and %d\n", KNN_MAX_RERANK);
+        return (1);
+    }
+    if (options.storage != KNN_STORAGE_FLOAT32 && options.index_type != KNN_INDEX_NONE)
+    {
+        if (index_given)
+        {
+            printf("Compressed storage is scanned without an index; use --index none\n");
+            return (1);
+        }
+        options.index_type = KNN_INDEX_NONE;
+    }
+    options.hnsw.seed = seed;
+    if (model_path != NULL)
+        return (predict_file(model_path, data_path, k, &options, "results.csv"));
+
+    Dataset data;
+    if (dataset_load(data_path, &data) != 0)
     {
         printf("No se pudo abrir el archivo\n");
         return (1);
     }
+    if (data.labels == NULL || data.rows < 2)
+    {
+        printf("%s needs a class column and at least two samples\n", data_path);
+        dataset_free(&data);
+        return (1);
+    }
+
+    if (k_max < 0 || k_max > KNN_MAX_K || folds < 2)
+    {
+        printf("k_max must be between 1 and %d and there must be at least 2 folds\n", KNN_MAX_K);
+        dataset_free(&data);
+        return (1);
+    }
+
+    shuffle_data(&data, seed);
+
+    if (k_max > 0)
+    {
+        if ((size_t)folds > data.rows)
+            folds = (int)data.rows;
+        select_k(&data, folds, k_max, &options, "results.csv");
+        plot_data();
+        dataset_free(&data);
+        return 0;
+    }
 
-    shuffle_data(data, count);
+    Samples train, test;
+    split_data(&data, &train, &test);
 
-    Iris *train, *test;
-    int train_count, test_count;
-    split_data(data, count, &train, &train_count, &test, &test_count);
+    // The test set stands for unseen data, so it is scaled with the training set's statistics, like any later query
+    double* mean = (double*)malloc(train.dim * sizeof(double));
+    double* std_dev = (double*)malloc(train.dim * sizeof(double));
+    feature_stats(&train, mean, std_dev);
+    apply_normalization(&train, mean, std_dev);
+    apply_normalization(&test, mean, std_dev);
 
-    normalize_data(train, train_count);
-    normalize_data(test, test_count);
+    KnnModel model;
+    build_model(&model, &train, mean, std_dev, &data.classes, &options);
+    free(mean);
+    free(std_dev);
 
-    int k = 3;
-    double accuracy = evaluate(train, train_count, test, test_count, k);
-    printf("Accuracy: %.2f%%\n", accuracy * 100);
-    write_results_to_csv(test, test_count, train, train_count, k, "results.csv");
+    int* predictions = (int*)malloc(test.count * sizeof(int));
+    double accuracy = evaluate(&model, &test, k, predictions);
+    printf("Accuracy: %.2f%% (%s, %s, %s kernel)\n", accuracy * 100, knn_index_name(options.index_type), knn_storage_name(options.storage),
+           knn_simd_name());
+    if (!knn_index_is_exact(options.index_type))
+    {
+        report_recall(&model, &test, k);
+        knn_index_set_ef(model.index, options.hnsw.ef_search);
+    }
+    write_results_to_csv(&test, model.class_names, predictions, 1, "results.csv");
+    if (save_path != NULL)
+    {
+        if (save_model(&model, save_path) == 0)
+            printf("Model saved to %s\n", save_path);
+        else
+            printf("Could not write model %s\n", save_path);
+    }
     plot_data();
 
-    free(data);
-    free(train);
-    free(test);
+    free(predictions);
+    free_model(&model);
+
+    free_samples(&train);
+    free_samples(&test);
+    dataset_free(&data);
     return 0;
 }
\ No newline at end of file
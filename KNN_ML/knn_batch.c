@@ -0,0 +1,114 @@
+#include <stdlib.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "knn_batch.h"
+
+// Entries in one cache line. Every thread's block starts on its own line, so no two threads ever write to the same line.
+#define LINE_ENTRIES (64 / sizeof(KnnNeighbor))
+// Queries handed to a thread at a time; small enough to balance uneven tree searches, large enough to amortize scheduling
+#define QUERY_CHUNK 64
+
+static int requested_threads = 0;
+
+void knn_set_threads(int threads)
+{
+    requested_threads = threads;
+}
+
+int knn_thread_count(void)
+{
+#ifdef _OPENMP
+    return (requested_threads > 0 ? requested_threads : omp_get_max_threads());
+#else
+    return (1);
+#endif
+}
+
+void knn_scratch_init(KnnScratch* scratch)
+{
+    scratch->storage = NULL;
+    scratch->stride = 0;
+    scratch->k = 0;
+    scratch->thread_count = 0;
+}
+
+void knn_scratch_reserve(KnnScratch* scratch, int k)
+{
+    int threads = knn_thread_count();
+    if (scratch->storage != NULL && scratch->k >= k && scratch->thread_count >= threads)
+        return;
+    if (k < scratch->k)
+        k = scratch->k;
+    if (threads < scratch->thread_count)
+        threads = scratch->thread_count;
+    knn_aligned_free(scratch->storage);
+    scratch->k = k;
+    scratch->thread_count = threads;
+    scratch->stride = (int)((k + LINE_ENTRIES - 1) / LINE_ENTRIES * LINE_ENTRIES);
+    scratch->storage = (KnnNeighbor*)knn_aligned_alloc((size_t)threads * scratch->stride * sizeof(KnnNeighbor));
+}
+
+void knn_scratch_free(KnnScratch* scratch)
+{
+    knn_aligned_free(scratch->storage);
+    knn_scratch_init(scratch);
+}
+
+void knn_batch_search(const KnnFeatures* features, const KnnIndex* index, const float* queries, int query_count, int k, KnnScratch* scratch,
+                      KnnResultFn on_result, void* context)
+{
+    int dim = features->dim;
+    knn_scratch_reserve(scratch, k);
+#pragma omp parallel num_threads(knn_thread_count())
+    {
+        int thread = 0;
+#ifdef _OPENMP
+        thread = omp_get_thread_num();
+#endif
+        KnnNeighbor* storage = scratch->storage + (size_t)thread * scratch->stride;
+        KnnHeap heap;
+#pragma omp for schedule(dynamic, QUERY_CHUNK)
+        for (int q = 0; q < query_count; q++)
+        {
+            const float* query = queries + (size_t)q * dim;
+            knn_heap_init(&heap, storage, k);
+            if (index != NULL)
+                knn_index_search(index, query, &heap);
+            else
+                knn_brute_search(features, query, &heap);
+            int found = knn_heap_sort(&heap);
+            if (on_result != NULL)
+                on_result(context, q, storage, found);
+        }
+    }
+}
+
+void knn_batch_search_quantized(const KnnQuantized* quantized, const KnnFeatures* exact, int rerank, const float* queries, int query_count,
+                                int k, KnnScratch* scratch, KnnResultFn on_result, void* context)
+{
+    int dim = quantized->dim;
+    int candidate_count = (rerank > 0) ? k * rerank : 0;
+    knn_scratch_reserve(scratch, k + candidate_count);  // each thread's block holds the result heap, then the candidates
+#pragma omp parallel num_threads(knn_thread_count())
+    {
+        int thread = 0;
+#ifdef _OPENMP
+        thread = omp_get_thread_num();
+#endif
+        KnnNeighbor* storage = scratch->storage + (size_t)thread * scratch->stride;
+        KnnHeap heap, candidates;
+#pragma omp for schedule(dynamic, QUERY_CHUNK)
+        for (int q = 0; q < query_count; q++)
+        {
+            knn_heap_init(&heap, storage, k);
+            knn_heap_init(&candidates, storage + k, candidate_count);
+            knn_quantized_search(quantized, rerank > 0 ? exact : NULL, queries + (size_t)q * dim, &candidates, &heap);
+            int found = knn_heap_sort(&heap);
+            if (on_result != NULL)
+                on_result(context, q, storage, found);
+        }
+    }
+}
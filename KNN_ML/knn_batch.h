@@ -0,0 +1,42 @@
+#ifndef KNN_BATCH_H
+#define KNN_BATCH_H
+
+#include "knn_index.h"
+#include "knn_quant.h"
+
+// Batched neighbor search across all cores. Built with -fopenmp the queries of a batch are
+// spread over the OpenMP thread pool; without it the same code runs on one thread.
+
+// Per-thread top-k heaps reused by every batch, so a batch does no allocations after the first one
+typedef struct {
+    KnnNeighbor* storage;  // one cache-line aligned block of `stride` entries per thread, from knn_aligned_alloc
+    int stride;
+    int k;
+    int thread_count;
+} KnnScratch;
+
+// Called from the worker threads with the neighbors of one query, nearest first
+typedef void (*KnnResultFn)(void* context, int query, const KnnNeighbor* neighbors, int found);
+
+void knn_scratch_init(KnnScratch* scratch);
+
+// Makes sure there is a heap of k entries for every thread that may run a batch
+void knn_scratch_reserve(KnnScratch* scratch, int k);
+
+void knn_scratch_free(KnnScratch* scratch);
+
+// Number of worker threads a batch will use; `knn_set_threads` overrides it (0 keeps the default)
+int knn_thread_count(void);
+void knn_set_threads(int threads);
+
+// Finds the k nearest training rows of each of the `query_count` row-major queries, using the index
+// when there is one and a brute-force scan of `features` otherwise, and hands each result to `on_result`
+void knn_batch_search(const KnnFeatures* features, const KnnIndex* index, const float* queries, int query_count, int k, KnnScratch* scratch,
+                      KnnResultFn on_result, void* context);
+
+// Same as knn_batch_search over compressed features: each query scans `quantized` for its k * rerank best
+// candidates and re-ranks them with the full-precision `exact` features (rerank 0 skips the re-rank)
+void knn_batch_search_quantized(const KnnQuantized* quantized, const KnnFeatures* exact, int rerank, const float* queries, int query_count,
+                                int k, KnnScratch* scratch, KnnResultFn on_result, void* context);
+
+#endif
@@ -0,0 +1,104 @@
+#ifndef KNN_HEAP_H
+#define KNN_HEAP_H
+
+// A candidate neighbor: squared distance to the query and row index in the training data
+typedef struct {
+    float distance;
+    int index;
+} KnnNeighbor;
+
+// Fixed-size max-heap holding the k best candidates seen so far, the worst one at the root.
+// The storage is owned by the caller so a search does no allocations.
+typedef struct {
+    KnnNeighbor* items;
+    int size;
+    int capacity;
+} KnnHeap;
+
+// Candidates are ordered by distance and then by row index, so every search path breaks ties the same way
+static inline int knn_neighbor_less(float da, int ia, float db, int ib)
+{
+    return (da < db || (da == db && ia < ib));
+}
+
+static inline void knn_heap_init(KnnHeap* heap, KnnNeighbor* storage, int capacity)
+{
+    heap->items = storage;
+    heap->size = 0;
+    heap->capacity = capacity;
+}
+
+// Function to check whether a subtree whose distance lower bound is `bound` can be skipped
+static inline int knn_heap_prunes(const KnnHeap* heap, float bound)
+{
+    return (heap->size == heap->capacity && bound > heap->items[0].distance);
+}
+
+// Function to offer a candidate to the heap, replacing the current worst one when the heap is full
+static inline void knn_heap_push(KnnHeap* heap, float distance, int index)
+{
+    KnnNeighbor* items = heap->items;
+    int i;
+    if (heap->size < heap->capacity)
+    {
+        i = heap->size++;
+        while (i > 0)
+        {
+            int parent = (i - 1) / 2;
+            if (!knn_neighbor_less(items[parent].distance, items[parent].index, distance, index))
+                break;
+            items[i] = items[parent];
+            i = parent;
+        }
+        items[i].distance = distance;
+        items[i].index = index;
+        return;
+    }
+    if (heap->capacity == 0 || !knn_neighbor_less(distance, index, items[0].distance, items[0].index))
+        return;
+    i = 0;
+    for (;;)
+    {
+        int child = 2 * i + 1;
+        if (child >= heap->size)
+            break;
+        if (child + 1 < heap->size && knn_neighbor_less(items[child].distance, items[child].index, items[child + 1].distance, items[child + 1].index))
+            child++;
+        if (!knn_neighbor_less(distance, index, items[child].distance, items[child].index))
+            break;
+        items[i] = items[child];
+        i = child;
+    }
+    items[i].distance = distance;
+    items[i].index = index;
+}
+
+// Function to sort the heap contents in place from nearest to farthest and return how many there are
+static inline int knn_heap_sort(KnnHeap* heap)
+{
+    int count = heap->size;
+    while (heap->size > 1)
+    {
+        KnnNeighbor last = heap->items[heap->size - 1];
+        heap->items[heap->size - 1] = heap->items[0];
+        heap->size--;
+        int i = 0;
+        for (;;)
+        {
+            int child = 2 * i + 1;
+            if (child >= heap->size)
+                break;
+            if (child + 1 < heap->size && knn_neighbor_less(heap->items[child].distance, heap->items[child].index, heap->items[child + 1].distance, heap->items[child + 1].index))
+                child++;
+            if (!knn_neighbor_less(last.distance, last.index, heap->items[child].distance, heap->items[child].index))
+                break;
+            heap->items[i] = heap->items[child];
+            i = child;
+        }
+        heap->items[i] = last;
+    }
+    heap->size = count;
+    return (count);
+}
+
+#endif
@@ -0,0 +1,436 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../common/random.h"
+#include "knn_hnsw.h"
+#include "knn_simd.h"
+
+struct KnnHnsw {
+    int mapped;         // the arrays point into a mapped model file and are not freed
+    int count;
+    int dim;
+    int m;              // link limit on the upper layers
+    int m0;             // link limit on layer 0
+    int ef_construction;
+    int ef_search;
+    float* points;      // row-major copy; a graph walk visits points in no particular order
+    int* levels;        // top layer of every point
+    int* base_links;    // layer 0, m0 + 1 ints per point: the link count, then the links
+    int* upper_links;   // layers 1.. of every point, levels[i] blocks of m + 1 ints each, one after another
+    int64_t* upper_offset;  // where the blocks of each point start in upper_links
+    int entry;          // the point every search starts from, one on the top layer
+    int max_level;
+};
+
+// Search buffers, one set per thread, grown on demand and reused by every later search on that thread
+typedef struct {
+    unsigned* visited;  // visited[i] == epoch when point i was reached by the current search
+    int visited_capacity;
+    unsigned epoch;
+    KnnNeighbor* candidates;  // min-heap of points still to expand
+    int candidate_capacity;
+    KnnNeighbor* results;     // storage of the ef best points found
+    int result_capacity;
+} SearchScratch;
+
+static _Thread_local SearchScratch thread_scratch;
+
+void knn_hnsw_default_params(KnnHnswParams* params)
+{
+    params->m = 16;
+    params->ef_construction = 200;
+    params->ef_search = 64;
+    params->seed = 42;
+}
+
+static int* links_at(const KnnHnsw* graph, int point, int level)
+{
+    if (level == 0)
+        return (graph->base_links + (size_t)point * (graph->m0 + 1));
+    return (graph->upper_links + graph->upper_offset[point] + (size_t)(level - 1) * (graph->m + 1));
+}
+
+static float point_distance2(const KnnHnsw* graph, int point, const float* query)
+{
+    return (knn_distance2(graph->points + (size_t)point * graph->dim, query, graph->dim));
+}
+
+// Function to prepare the per-thread buffers for a search over `count` points keeping `ef` results
+static SearchScratch* begin_search(int count, int ef)
+{
+    SearchScratch* scratch = &thread_scratch;
+    if (scratch->visited_capacity < count)
+    {
+        free(scratch->visited);
+        scratch->visited = (unsigned*)calloc(count, sizeof(unsigned));
+        scratch->visited_capacity = count;
+        scratch->epoch = 0;
+    }
+    if (scratch->result_capacity < ef)
+    {
+        free(scratch->results);
+        scratch->results = (KnnNeighbor*)malloc(ef * sizeof(KnnNeighbor));
+        scratch->result_capacity = ef;
+    }
+    if (++scratch->epoch == 0)  // the marks wrapped around: clear them once every 2^32 searches
+    {
+        memset(scratch->visited, 0, scratch->visited_capacity * sizeof(unsigned));
+        scratch->epoch = 1;
+    }
+    return (scratch);
+}
+
+static void candidate_push(SearchScratch* scratch, int* size, float distance, int index)
+{
+    if (*size == scratch->candidate_capacity)
+    {
+        scratch->candidate_capacity = scratch->candidate_capacity ? 2 * scratch->candidate_capacity : 256;
+        scratch->candidates = (KnnNeighbor*)realloc(scratch->candidates, scratch->candidate_capacity * sizeof(KnnNeighbor));
+    }
+    KnnNeighbor* items = scratch->candidates;
+    int i = (*size)++;
+    while (i > 0 && items[(i - 1) / 2].distance > distance)
+    {
+        items[i] = items[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    items[i].distance = distance;
+    items[i].index = index;
+}
+
+static KnnNeighbor candidate_pop(SearchScratch* scratch, int* size)
+{
+    KnnNeighbor* items = scratch->candidates;
+    KnnNeighbor top = items[0];
+    KnnNeighbor last = items[--(*size)];
+    int i = 0;
+    for (;;)
+    {
+        int child = 2 * i + 1;
+        if (child >= *size)
+            break;
+        if (child + 1 < *size && items[child + 1].distance < items[child].distance)
+            child++;
+        if (items[child].distance >= last.distance)
+            break;
+        items[i] = items[child];
+        i = child;
+    }
+    items[i] = last;
+    return (top);
+}
+
+// Function to walk greedily towards the query on one layer, moving while some link is closer
+static int greedy_step(const KnnHnsw* graph, const float* query, int current, float* current_distance, int level)
+{
+    int moved = 1;
+    while (moved)
+    {
+        moved = 0;
+        const int* links = links_at(graph, current, level);
+        for (int i = 1; i <= links[0]; i++)
+        {
+            float distance = point_distance2(graph, links[i], query);
+            if (distance < *current_distance)
+            {
+                *current_distance = distance;
+                current = links[i];
+                moved = 1;
+            }
+        }
+    }
+    return (current);
+}
+
+// Function to explore one layer from the entry point, keeping the best points found in `results` (capacity ef)
+static void search_layer(const KnnHnsw* graph, SearchScratch* scratch, const float* query, int entry, float entry_distance, int level,
+                         KnnHeap* results)
+{
+    int candidate_count = 0;
+    scratch->visited[entry] = scratch->epoch;
+    candidate_push(scratch, &candidate_count, entry_distance, entry);
+    knn_heap_push(results, entry_distance, entry);
+    while (candidate_count > 0)
+    {
+        KnnNeighbor nearest = candidate_pop(scratch, &candidate_count);
+        if (knn_heap_prunes(results, nearest.distance))
+            break;  // every remaining candidate is farther than all the results
+        const int* links = links_at(graph, nearest.index, level);
+        for (int i = 1; i <= links[0]; i++)
+        {
+            int next = links[i];
+            if (scratch->visited[next] == scratch->epoch)
+                continue;
+            scratch->visited[next] = scratch->epoch;
+            float distance = point_distance2(graph, next, query);
+            if (!knn_heap_prunes(results, distance))
+            {
+                candidate_push(scratch, &candidate_count, distance, next);
+                knn_heap_push(results, distance, next);
+            }
+        }
+    }
+}
+
+// Function to choose at most `limit` links out of the candidates, sorted nearest first, keeping a candidate only
+// if it is closer to the base point than to every link already chosen. That spreads the links in all directions
+// instead of spending them on one tight cluster. Returns how many were kept, moved to the front of the array.
+static int select_links(const KnnHnsw* graph, KnnNeighbor* candidates, int count, int limit)
+{
+    int kept = 0;
+    for (int i = 0; i < count && kept < limit; i++)
+    {
+        const float* point = graph->points + (size_t)candidates[i].index * graph->dim;
+        int diverse = 1;
+        for (int j = 0; j < kept && diverse; j++)
+        {
+            if (point_distance2(graph, candidates[j].index, point) < candidates[i].distance)
+                diverse = 0;
+        }
+        if (diverse)
+            candidates[kept++] = candidates[i];
+    }
+    return (kept);
+}
+
+// Function to add a link from `from` to `to` on a layer, re-selecting the links of `from` when it is full
+static void add_link(const KnnHnsw* graph, int from, int to, int level, KnnNeighbor* buffer)
+{
+    int* links = links_at(graph, from, level);
+    int limit = (level == 0) ? graph->m0 : graph->m;
+    if (links[0] < limit)
+    {
+        links[++links[0]] = to;
+        return;
+    }
+    const float* base = graph->points + (size_t)from * graph->dim;
+    KnnHeap sorted;
+    knn_heap_init(&sorted, buffer, limit + 1);
+    for (int i = 1; i <= links[0]; i++)
+    {
+        knn_heap_push(&sorted, point_distance2(graph, links[i], base), links[i]);
+    }
+    knn_heap_push(&sorted, point_distance2(graph, to, base), to);
+    int count = knn_heap_sort(&sorted);
+    links[0] = select_links(graph, buffer, count, limit);
+    for (int i = 0; i < links[0]; i++)
+    {
+        links[i + 1] = buffer[i].index;
+    }
+}
+
+// Function to draw the top layer of a new point: P(level >= l) = m^-l
+static int random_level(Rng* rng, double level_scale)
+{
+    double uniform = ((rng_next(rng) >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+    return ((int)(-log(uniform) * level_scale));
+}
+
+static void insert_point(KnnHnsw* graph, int point, KnnNeighbor* buffer)
+{
+    const float* query = graph->points + (size_t)point * graph->dim;
+    int level = graph->levels[point];
+    if (point == 0)
+    {
+        graph->entry = 0;
+        graph->max_level = level;
+        return;
+    }
+    int current = graph->entry;
+    float current_distance = point_distance2(graph, current, query);
+    for (int l = graph->max_level; l > level; l--)
+    {
+        current = greedy_step(graph, query, current, &current_distance, l);
+    }
+    for (int l = (level < graph->max_level ? level : graph->max_level); l >= 0; l--)
+    {
+        SearchScratch* scratch = begin_search(graph->count, graph->ef_construction);
+        KnnHeap results;
+        knn_heap_init(&results, scratch->results, graph->ef_construction);
+        search_layer(graph, scratch, query, current, current_distance, l, &results);
+        int found = knn_heap_sort(&results);
+        current = scratch->results[0].index;
+        current_distance = scratch->results[0].distance;
+
+        int kept = select_links(graph, scratch->results, found, graph->m);
+        int* links = links_at(graph, point, l);
+        links[0] = kept;
+        for (int i = 0; i < kept; i++)
+        {
+            links[i + 1] = scratch->results[i].index;
+        }
+        for (int i = 0; i < kept; i++)
+        {
+            add_link(graph, links[i + 1], point, l, buffer);
+        }
+    }
+    if (level > graph->max_level)
+    {
+        graph->entry = point;
+        graph->max_level = level;
+    }
+}
+
+KnnHnsw* knn_hnsw_build(const float* points, int count, int dim, const KnnHnswParams* params)
+{
+    if (count <= 0)
+        return (NULL);
+    KnnHnsw* graph = (KnnHnsw*)calloc(1, sizeof(KnnHnsw));
+    graph->count = count;
+    graph->dim = dim;
+    graph->m = params->m < 2 ? 2 : params->m;
+    graph->m0 = 2 * graph->m;
+    graph->ef_construction = params->ef_construction < graph->m ? graph->m : params->ef_construction;
+    graph->ef_search = params->ef_search;
+    graph->points = (float*)malloc((size_t)count * dim * sizeof(float));
+    memcpy(graph->points, points, (size_t)count * dim * sizeof(float));
+    graph->levels = (int*)malloc(count * sizeof(int));
+    graph->base_links = (int*)calloc((size_t)count * (graph->m0 + 1), sizeof(int));
+    graph->upper_offset = (int64_t*)malloc(count * sizeof(int64_t));
+
+    Rng rng;
+    rng_seed(&rng, params->seed, 0);
+    double level_scale = 1 / log(graph->m);
+    int64_t upper_size = 0;
+    for (int i = 0; i < count; i++)
+    {
+        graph->levels[i] = random_level(&rng, level_scale);
+        graph->upper_offset[i] = upper_size;
+        upper_size += (int64_t)graph->levels[i] * (graph->m + 1);
+    }
+    graph->upper_links = (int*)calloc(upper_size > 0 ? upper_size : 1, sizeof(int));
+
+    // Points are inserted one after another, so the graph only depends on the data and the seed
+    KnnNeighbor* buffer = (KnnNeighbor*)malloc((graph->m0 + 1) * sizeof(KnnNeighbor));
+    for (int i = 0; i < count; i++)
+    {
+        insert_point(graph, i, buffer);
+    }
+    free(buffer);
+    return (graph);
+}
+
+void knn_hnsw_search(const KnnHnsw* graph, const float* query, KnnHeap* heap)
+{
+    int ef = graph->ef_search > heap->capacity ? graph->ef_search : heap->capacity;
+    int current = graph->entry;
+    float current_distance = point_distance2(graph, current, query);
+    for (int l = graph->max_level; l > 0; l--)
+    {
+        current = greedy_step(graph, query, current, &current_distance, l);
+    }
+    SearchScratch* scratch = begin_search(graph->count, ef);
+    KnnHeap results;
+    knn_heap_init(&results, scratch->results, ef);
+    search_layer(graph, scratch, query, current, current_distance, 0, &results);
+    for (int i = 0; i < results.size; i++)
+    {
+        knn_heap_push(heap, results.items[i].distance, results.items[i].index);
+    }
+}
+
+void knn_hnsw_set_ef(KnnHnsw* graph, int ef_search)
+{
+    graph->ef_search = ef_search;
+}
+
+// Sizes and parameters saved ahead of the arrays
+typedef struct {
+    int32_t count;
+    int32_t dim;
+    int32_t m;
+    int32_t ef_construction;
+    int32_t ef_search;
+    int32_t entry;
+    int32_t max_level;
+    int32_t reserved;
+    int64_t upper_size;
+} HnswHeader;
+
+void knn_hnsw_save(const KnnHnsw* graph, BinaryWriter* writer)
+{
+    HnswHeader header = {graph->count, graph->dim, graph->m, graph->ef_construction, graph->ef_search, graph->entry, graph->max_level, 0, 0};
+    header.upper_size = graph->upper_offset[graph->count - 1] + (int64_t)graph->levels[graph->count - 1] * (graph->m + 1);
+    binary_write(writer, &header, sizeof(header));
+    binary_write(writer, graph->points, (size_t)graph->count * graph->dim * sizeof(float));
+    binary_write(writer, graph->levels, graph->count * sizeof(int));
+    binary_write(writer, graph->base_links, (size_t)graph->count * (graph->m0 + 1) * sizeof(int));
+    binary_write(writer, graph->upper_offset, graph->count * sizeof(int64_t));
+    binary_write(writer, graph->upper_links, header.upper_size * sizeof(int));
+}
+
+// Function to check that every link of a mapped graph can be followed: each point's layers lie inside
+// upper_links, no list holds more links than its layer allows, and every link goes to a point that is on
+// that layer, so a search never reads outside the arrays
+static int links_valid(const KnnHnsw* graph, int64_t upper_size)
+{
+    if (graph->levels[graph->entry] != graph->max_level)
+        return (0);
+    for (int i = 0; i < graph->count; i++)
+    {
+        int levels = graph->levels[i];
+        int64_t offset = graph->upper_offset[i];
+        if (levels < 0 || levels > graph->max_level || offset < 0 || offset > upper_size - (int64_t)levels * (graph->m + 1))
+            return (0);
+        for (int l = 0; l <= levels; l++)
+        {
+            const int* links = links_at(graph, i, l);
+            if (links[0] < 0 || links[0] > (l == 0 ? graph->m0 : graph->m))
+                return (0);
+            for (int j = 1; j <= links[0]; j++)
+            {
+                if (links[j] < 0 || links[j] >= graph->count || graph->levels[links[j]] < l)
+                    return (0);
+            }
+        }
+    }
+    return (1);
+}
+
+KnnHnsw* knn_hnsw_map(BinaryReader* reader, int count, int dim)
+{
+    const HnswHeader* header = (const HnswHeader*)binary_read_exact(reader, sizeof(HnswHeader));
+    if (header == NULL || header->count != count || header->dim != dim || header->m < 2 || header->m > (1 << 20) || header->entry < 0 ||
+        header->entry >= header->count || header->max_level < 0 || header->upper_size < 0)
+        return (NULL);
+    KnnHnsw* graph = (KnnHnsw*)calloc(1, sizeof(KnnHnsw));
+    graph->mapped = 1;
+    graph->count = header->count;
+    graph->dim = header->dim;
+    graph->m = header->m;
+    graph->m0 = 2 * header->m;
+    graph->ef_construction = header->ef_construction;
+    graph->ef_search = header->ef_search;
+    graph->entry = header->entry;
+    graph->max_level = header->max_level;
+    graph->points = (float*)binary_read_exact(reader, (size_t)graph->count * graph->dim * sizeof(float));
+    graph->levels = (int*)binary_read_exact(reader, graph->count * sizeof(int));
+    graph->base_links = (int*)binary_read_exact(reader, (size_t)graph->count * (graph->m0 + 1) * sizeof(int));
+    graph->upper_offset = (int64_t*)binary_read_exact(reader, graph->count * sizeof(int64_t));
+    graph->upper_links = (int*)binary_read_exact(reader, header->upper_size * sizeof(int));
+    if (reader->failed || !links_valid(graph, header->upper_size))
+    {
+        free(graph);
+        return (NULL);
+    }
+    return (graph);
+}
+
+void knn_hnsw_free(KnnHnsw* graph)
+{
+    if (graph == NULL)
+        return;
+    if (graph->mapped)
+    {
+        free(graph);
+        return;
+    }
+    free(graph->upper_offset);
+    free(graph->upper_links);
+    free(graph->base_links);
+    free(graph->levels);
+    free(graph->points);
+    free(graph);
+}
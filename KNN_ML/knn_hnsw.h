@@ -0,0 +1,44 @@
+#ifndef KNN_HNSW_H
+#define KNN_HNSW_H
+
+#include <stdint.h>
+
+#include "../common/binary_file.h"
+#include "knn_heap.h"
+
+// Approximate nearest-neighbor search over a hierarchical navigable small world (HNSW) graph.
+// Every point is linked to near points on layer 0, and a random, geometrically shrinking subset
+// of them also on higher layers; a search walks greedily down the layers and then explores
+// layer 0 with a candidate list of `ef` entries. Larger m and ef raise recall and cost.
+
+typedef struct {
+    int m;                // links per point on the upper layers (twice as many on layer 0)
+    int ef_construction;  // candidate list size while inserting points
+    int ef_search;        // candidate list size while answering queries, raised to k if smaller
+    uint64_t seed;        // seed of the random layer assignment
+} KnnHnswParams;
+
+typedef struct KnnHnsw KnnHnsw;
+
+void knn_hnsw_default_params(KnnHnswParams* params);
+
+// Builds the graph over `count` row-major points of `dim` features each. The points are copied.
+KnnHnsw* knn_hnsw_build(const float* points, int count, int dim, const KnnHnswParams* params);
+
+// Offers the approximate nearest points to the caller-owned heap; its capacity is the k searched for.
+// The visited set and candidate lists are kept per thread and reused, so searches do not allocate once warm.
+void knn_hnsw_search(const KnnHnsw* graph, const float* query, KnnHeap* heap);
+
+void knn_hnsw_set_ef(KnnHnsw* graph, int ef_search);
+
+// Writes the graph as blocks of a model file
+void knn_hnsw_save(const KnnHnsw* graph, BinaryWriter* writer);
+
+// Reads a graph saved by knn_hnsw_save in place: the links and points stay in the mapped file,
+// which must outlive the graph. Returns NULL if the blocks are missing or malformed, or are not a
+// graph over `count` points of `dim` features.
+KnnHnsw* knn_hnsw_map(BinaryReader* reader, int count, int dim);
+
+void knn_hnsw_free(KnnHnsw* graph);
+
+#endif
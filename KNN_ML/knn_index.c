@@ -0,0 +1,507 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "knn_index.h"
+
+#define LEAF_SIZE 16
+// Relative slack on the node distance bounds. The kernel sums float squares in its own order (and with FMA),
+// so a bound is not guaranteed to stay below the distance it computes for a point in the node without it.
+#define BOUND_SLACK 1e-4f
+// Rows scanned per kernel call
+#define SCAN_BLOCK 256
+
+typedef struct {
+    int start;
+    int end;
+    int left;      // -1 for leaves
+    int right;
+    double radius; // ball-tree only
+} KnnNode;
+
+struct KnnIndex {
+    KnnIndexType type;
+    int mapped;     // the arrays point into a mapped model file and are not freed
+    int count;
+    int dim;
+    KnnFeatures features;  // copy of the points in tree order, so every leaf is a contiguous block of each column
+    int* order;     // tree position -> original row index
+    KnnNode* nodes;
+    int node_count;
+    int node_capacity;
+    float* bounds;  // kd-tree: lower and upper corner per node, ball-tree: center per node
+    int bounds_stride;
+    KnnHnsw* graph; // HNSW only, which has no tree
+};
+
+// Function to partially sort keys[lo..hi) so that position nth holds the value it would have if sorted (quickselect)
+static void select_nth(float* keys, int* order, int lo, int hi, int nth)
+{
+    while (hi - lo > 1)
+    {
+        float pivot = keys[lo + (hi - lo) / 2];
+        int i = lo, j = hi - 1;
+        while (i <= j)
+        {
+            while (keys[i] < pivot)
+                i++;
+            while (keys[j] > pivot)
+                j--;
+            if (i <= j)
+            {
+                float tk = keys[i];
+                keys[i] = keys[j];
+                keys[j] = tk;
+                int to = order[i];
+                order[i] = order[j];
+                order[j] = to;
+                i++;
+                j--;
+            }
+        }
+        if (nth <= j)
+            hi = j + 1;
+        else if (nth >= i)
+            lo = i;
+        else
+            return;
+    }
+}
+
+static int add_node(KnnIndex* index, int start, int end)
+{
+    if (index->node_count == index->node_capacity)
+    {
+        index->node_capacity = index->node_capacity ? 2 * index->node_capacity : 64;
+        index->nodes = (KnnNode*)realloc(index->nodes, index->node_capacity * sizeof(KnnNode));
+        index->bounds = (float*)realloc(index->bounds, (size_t)index->node_capacity * index->bounds_stride * sizeof(float));
+    }
+    KnnNode* node = &index->nodes[index->node_count];
+    node->start = start;
+    node->end = end;
+    node->left = -1;
+    node->right = -1;
+    node->radius = 0;
+    return (index->node_count++);
+}
+
+// Function to build the kd-tree below a node, splitting at the median of the widest dimension
+static int build_kdtree(KnnIndex* index, const float* points, float* keys, int start, int end)
+{
+    int dim = index->dim;
+    int id = add_node(index, start, end);
+    float* lo = index->bounds + (size_t)id * index->bounds_stride;
+    float* hi = lo + dim;
+    for (int d = 0; d < dim; d++)
+    {
+        lo[d] = hi[d] = points[(size_t)index->order[start] * dim + d];
+    }
+    for (int i = start + 1; i < end; i++)
+    {
+        const float* p = points + (size_t)index->order[i] * dim;
+        for (int d = 0; d < dim; d++)
+        {
+            if (p[d] < lo[d])
+                lo[d] = p[d];
+            if (p[d] > hi[d])
+                hi[d] = p[d];
+        }
+    }
+    if (end - start <= LEAF_SIZE)
+        return (id);
+
+    int split = 0;
+    for (int d = 1; d < dim; d++)
+    {
+        if (hi[d] - lo[d] > hi[split] - lo[split])
+            split = d;
+    }
+    if (hi[split] == lo[split])  // all points are identical
+        return (id);
+    for (int i = start; i < end; i++)
+    {
+        keys[i] = points[(size_t)index->order[i] * dim + split];
+    }
+    int mid = start + (end - start) / 2;
+    select_nth(keys, index->order, start, end, mid);
+
+    int left = build_kdtree(index, points, keys, start, mid);
+    int right = build_kdtree(index, points, keys, mid, end);
+    index->nodes[id].left = left;
+    index->nodes[id].right = right;
+    return (id);
+}
+
+// Function to build the ball tree below a node, splitting along the direction between two far-apart points
+static int build_balltree(KnnIndex* index, const float* points, float* keys, int start, int end)
+{
+    int dim = index->dim;
+    int id = add_node(index, start, end);
+    float* center = index->bounds + (size_t)id * index->bounds_stride;
+    double* sum = (double*)calloc(dim, sizeof(double));
+    for (int i = start; i < end; i++)
+    {
+        const float* p = points + (size_t)index->order[i] * dim;
+        for (int d = 0; d < dim; d++)
+        {
+            sum[d] += p[d];
+        }
+    }
+    for (int d = 0; d < dim; d++)
+    {
+        center[d] = (float)(sum[d] / (end - start));
+    }
+    free(sum);
+
+    double radius2 = 0;
+    int far_a = index->order[start];
+    for (int i = start; i < end; i++)
+    {
+        double d2 = knn_distance2(points + (size_t)index->order[i] * dim, center, dim);
+        if (d2 > radius2)
+        {
+            radius2 = d2;
+            far_a = index->order[i];
+        }
+    }
+    index->nodes[id].radius = sqrt(radius2);
+    if (end - start <= LEAF_SIZE || radius2 == 0)
+        return (id);
+
+    const float* a = points + (size_t)far_a * dim;
+    double best = -1;
+    int far_b = far_a;
+    for (int i = start; i < end; i++)
+    {
+        double d2 = knn_distance2(points + (size_t)index->order[i] * dim, a, dim);
+        if (d2 > best)
+        {
+            best = d2;
+            far_b = index->order[i];
+        }
+    }
+    const float* b = points + (size_t)far_b * dim;
+    for (int i = start; i < end; i++)
+    {
+        const float* p = points + (size_t)index->order[i] * dim;
+        double projection = 0;
+        for (int d = 0; d < dim; d++)
+        {
+            projection += (double)(b[d] - a[d]) * p[d];
+        }
+        keys[i] = (float)projection;
+    }
+    int mid = start + (end - start) / 2;
+    select_nth(keys, index->order, start, end, mid);
+
+    int left = build_balltree(index, points, keys, start, mid);
+    int right = build_balltree(index, points, keys, mid, end);
+    index->nodes[id].left = left;
+    index->nodes[id].right = right;
+    return (id);
+}
+
+KnnIndex* knn_index_build_hnsw(const float* points, int count, int dim, const KnnHnswParams* params)
+{
+    if (count <= 0)
+        return (NULL);
+    KnnIndex* index = (KnnIndex*)calloc(1, sizeof(KnnIndex));
+    index->type = KNN_INDEX_HNSW;
+    index->count = count;
+    index->dim = dim;
+    index->graph = knn_hnsw_build(points, count, dim, params);
+    return (index);
+}
+
+KnnIndex* knn_index_build(const float* points, int count, int dim, KnnIndexType type)
+{
+    if (type == KNN_INDEX_HNSW)
+    {
+        KnnHnswParams params;
+        knn_hnsw_default_params(&params);
+        return (knn_index_build_hnsw(points, count, dim, &params));
+    }
+    if (type == KNN_INDEX_NONE || count <= 0)
+        return (NULL);
+    KnnIndex* index = (KnnIndex*)calloc(1, sizeof(KnnIndex));
+    index->type = type;
+    index->count = count;
+    index->dim = dim;
+    index->bounds_stride = (type == KNN_INDEX_KDTREE) ? 2 * dim : dim;
+    index->order = (int*)malloc(count * sizeof(int));
+    for (int i = 0; i < count; i++)
+    {
+        index->order[i] = i;
+    }
+
+    float* keys = (float*)malloc(count * sizeof(float));
+    if (type == KNN_INDEX_KDTREE)
+        build_kdtree(index, points, keys, 0, count);
+    else
+        build_balltree(index, points, keys, 0, count);
+    free(keys);
+
+    float* sorted = (float*)malloc((size_t)count * dim * sizeof(float));
+    for (int i = 0; i < count; i++)
+    {
+        memcpy(sorted + (size_t)i * dim, points + (size_t)index->order[i] * dim, dim * sizeof(float));
+    }
+    knn_features_from_rows(&index->features, sorted, count, dim);
+    free(sorted);
+    return (index);
+}
+
+// Squared distance from the query to the node's bounding box (0 inside it)
+static float box_distance2(const KnnIndex* index, int node, const float* query)
+{
+    const float* lo = index->bounds + (size_t)node * index->bounds_stride;
+    const float* hi = lo + index->dim;
+    float sum = 0;
+    for (int d = 0; d < index->dim; d++)
+    {
+        float diff = 0;
+        if (query[d] < lo[d])
+            diff = lo[d] - query[d];
+        else if (query[d] > hi[d])
+            diff = query[d] - hi[d];
+        sum += diff * diff;
+    }
+    return (sum * (1 - BOUND_SLACK));
+}
+
+// Lower bound of the squared distance from the query to any point inside the node's ball
+static float ball_distance2(const KnnIndex* index, int node, const float* query)
+{
+    const float* center = index->bounds + (size_t)node * index->bounds_stride;
+    double center_distance = sqrt(knn_distance2(query, center, index->dim));
+    double gap = center_distance - index->nodes[node].radius;
+    return (gap > 0 ? (float)(gap * gap) * (1 - BOUND_SLACK) : 0);
+}
+
+static float node_distance2(const KnnIndex* index, int node, const float* query)
+{
+    if (index->type == KNN_INDEX_KDTREE)
+        return (box_distance2(index, node, query));
+    return (ball_distance2(index, node, query));
+}
+
+// Function to offer rows [start, end) of the features to the heap, mapping them through `order` when it is given
+static void scan_rows(const KnnFeatures* features, const int* order, int start, int end, const float* query, KnnHeap* heap)
+{
+    float distances[SCAN_BLOCK];
+    for (int block = start; block < end; block += SCAN_BLOCK)
+    {
+        int block_end = (end - block > SCAN_BLOCK) ? block + SCAN_BLOCK : end;
+        knn_distances(features, block, block_end, query, distances);
+        for (int i = block; i < block_end; i++)
+        {
+            knn_heap_push(heap, distances[i - block], order ? order[i] : i);
+        }
+    }
+}
+
+static void search_node(const KnnIndex* index, int id, const float* query, KnnHeap* heap)
+{
+    const KnnNode* node = &index->nodes[id];
+    if (node->left < 0)
+    {
+        scan_rows(&index->features, index->order, node->start, node->end, query, heap);
+        return;
+    }
+    // Visit the nearer child first so the heap tightens before the other one is tested
+    float left_bound = node_distance2(index, node->left, query);
+    float right_bound = node_distance2(index, node->right, query);
+    int first = node->left, second = node->right;
+    float first_bound = left_bound, second_bound = right_bound;
+    if (right_bound < left_bound)
+    {
+        first = node->right;
+        second = node->left;
+        first_bound = right_bound;
+        second_bound = left_bound;
+    }
+    if (!knn_heap_prunes(heap, first_bound))
+        search_node(index, first, query, heap);
+    if (!knn_heap_prunes(heap, second_bound))
+        search_node(index, second, query, heap);
+}
+
+void knn_brute_search(const KnnFeatures* features, const float* query, KnnHeap* heap)
+{
+    scan_rows(features, NULL, 0, features->count, query, heap);
+}
+
+void knn_index_search(const KnnIndex* index, const float* query, KnnHeap* heap)
+{
+    if (index->type == KNN_INDEX_HNSW)
+        knn_hnsw_search(index->graph, query, heap);
+    else
+        search_node(index, 0, query, heap);
+}
+
+void knn_index_set_ef(KnnIndex* index, int ef_search)
+{
+    if (index != NULL && index->type == KNN_INDEX_HNSW)
+        knn_hnsw_set_ef(index->graph, ef_search);
+}
+
+int knn_index_is_exact(KnnIndexType type)
+{
+    return (type != KNN_INDEX_HNSW);
+}
+
+int knn_index_query(const KnnIndex* index, const float* query, int k, int* neighbors, float* distances)
+{
+    KnnNeighbor* storage = (KnnNeighbor*)malloc(k * sizeof(KnnNeighbor));
+    KnnHeap heap;
+    knn_heap_init(&heap, storage, k);
+    knn_index_search(index, query, &heap);
+    int found = knn_heap_sort(&heap);
+    for (int i = 0; i < found; i++)
+    {
+        neighbors[i] = storage[i].index;
+        if (distances)
+            distances[i] = storage[i].distance;
+    }
+    free(storage);
+    return (found);
+}
+
+// Sizes saved ahead of the arrays
+typedef struct {
+    int32_t type;
+    int32_t count;
+    int32_t dim;
+    int32_t stride;
+    int32_t node_count;
+    int32_t bounds_stride;
+} IndexHeader;
+
+void knn_index_save(const KnnIndex* index, BinaryWriter* writer)
+{
+    IndexHeader header = {index->type, index->count, index->dim, index->features.stride, index->node_count, index->bounds_stride};
+    binary_write(writer, &header, sizeof(header));
+    if (index->type == KNN_INDEX_HNSW)
+    {
+        knn_hnsw_save(index->graph, writer);
+        return;
+    }
+    binary_write(writer, index->features.data, (size_t)index->features.stride * index->dim * sizeof(float));
+    binary_write(writer, index->order, index->count * sizeof(int));
+    binary_write(writer, index->nodes, index->node_count * sizeof(KnnNode));
+    binary_write(writer, index->bounds, (size_t)index->node_count * index->bounds_stride * sizeof(float));
+}
+
+// Function to check that a mapped tree can be searched without reading outside its arrays: every row of
+// `order` is a training row, every node covers rows inside the index, and the children of a node come after
+// it, so a search always ends at the leaves
+static int tree_valid(const KnnIndex* index)
+{
+    for (int i = 0; i < index->count; i++)
+    {
+        if (index->order[i] < 0 || index->order[i] >= index->count)
+            return (0);
+    }
+    for (int id = 0; id < index->node_count; id++)
+    {
+        const KnnNode* node = &index->nodes[id];
+        if (node->start < 0 || node->start > node->end || node->end > index->count)
+            return (0);
+        if (node->left < 0 && node->right < 0)
+            continue;
+        if (node->left <= id || node->left >= index->node_count || node->right <= id || node->right >= index->node_count)
+            return (0);
+    }
+    return (1);
+}
+
+KnnIndex* knn_index_map(BinaryReader* reader, int count, int dim)
+{
+    const IndexHeader* header = (const IndexHeader*)binary_read_exact(reader, sizeof(IndexHeader));
+    if (header == NULL || header->type <= KNN_INDEX_NONE || header->type > KNN_INDEX_HNSW || header->count != count || header->dim != dim)
+        return (NULL);
+    KnnIndex* index = (KnnIndex*)calloc(1, sizeof(KnnIndex));
+    index->type = (KnnIndexType)header->type;
+    index->mapped = 1;
+    index->count = header->count;
+    index->dim = header->dim;
+    if (index->type == KNN_INDEX_HNSW)
+    {
+        index->graph = knn_hnsw_map(reader, count, dim);
+        if (index->graph == NULL)
+        {
+            free(index);
+            return (NULL);
+        }
+        return (index);
+    }
+    index->features.count = header->count;
+    index->features.dim = header->dim;
+    index->features.stride = header->stride;
+    index->node_count = index->node_capacity = header->node_count;
+    index->bounds_stride = header->bounds_stride;
+    index->features.data = (float*)binary_read_exact(reader, (size_t)header->stride * header->dim * sizeof(float));
+    index->order = (int*)binary_read_exact(reader, header->count * sizeof(int));
+    index->nodes = (KnnNode*)binary_read_exact(reader, header->node_count * sizeof(KnnNode));
+    index->bounds = (float*)binary_read_exact(reader, (size_t)header->node_count * header->bounds_stride * sizeof(float));
+    int bounds_stride = (index->type == KNN_INDEX_KDTREE) ? 2 * dim : dim;
+    if (reader->failed || header->stride < knn_padded_stride(count) || header->node_count <= 0 || header->bounds_stride != bounds_stride ||
+        !tree_valid(index))
+    {
+        free(index);
+        return (NULL);
+    }
+    return (index);
+}
+
+KnnIndexType knn_index_type(const KnnIndex* index)
+{
+    return (index != NULL ? index->type : KNN_INDEX_NONE);
+}
+
+void knn_index_free(KnnIndex* index)
+{
+    if (index == NULL)
+        return;
+    knn_hnsw_free(index->graph);
+    if (index->mapped)
+    {
+        free(index);
+        return;
+    }
+    knn_features_free(&index->features);
+    free(index->order);
+    free(index->nodes);
+    free(index->bounds);
+    free(index);
+}
+
+const char* knn_index_name(KnnIndexType type)
+{
+    switch (type)
+    {
+    case KNN_INDEX_KDTREE:
+        return ("kd-tree");
+    case KNN_INDEX_BALLTREE:
+        return ("ball-tree");
+    case KNN_INDEX_HNSW:
+        return ("hnsw");
+    default:
+        return ("brute-force");
+    }
+}
+
+int knn_index_parse(const char* name, KnnIndexType* type)
+{
+    if (strcmp(name, "none") == 0 || strcmp(name, "brute") == 0)
+        *type = KNN_INDEX_NONE;
+    else if (strcmp(name, "kd") == 0)
+        *type = KNN_INDEX_KDTREE;
+    else if (strcmp(name, "ball") == 0)
+        *type = KNN_INDEX_BALLTREE;
+    else if (strcmp(name, "hnsw") == 0)
+        *type = KNN_INDEX_HNSW;
+    else
+        return (0);
+    return (1);
+}
@@ -0,0 +1,61 @@
+#ifndef KNN_INDEX_H
+#define KNN_INDEX_H
+
+#include "knn_heap.h"
+#include "knn_hnsw.h"
+#include "knn_simd.h"
+
+// Spatial indexes for k-nearest-neighbor search over the normalized training set.
+// The trees are exact: they return the same neighbors, in the same order, as a brute-force scan
+// (leaves are stored column-major and scanned with the same distance kernel, and ties are broken
+// by row index). The HNSW graph is approximate and trades a little recall for much faster queries.
+
+typedef enum {
+    KNN_INDEX_NONE,      // brute-force scan, no index
+    KNN_INDEX_KDTREE,    // axis-aligned splits, best for low dimensions
+    KNN_INDEX_BALLTREE,  // hypersphere nodes, degrades more gracefully as dimensions grow
+    KNN_INDEX_HNSW       // approximate proximity graph, for large training sets
+} KnnIndexType;
+
+typedef struct KnnIndex KnnIndex;
+
+// Offers every training row to the heap, the brute-force reference search
+void knn_brute_search(const KnnFeatures* features, const float* query, KnnHeap* heap);
+
+// Builds an index over `count` row-major points of `dim` features each. The points are copied.
+// An HNSW index is built with the default parameters.
+KnnIndex* knn_index_build(const float* points, int count, int dim, KnnIndexType type);
+
+// Builds an HNSW index with the given build and search parameters
+KnnIndex* knn_index_build_hnsw(const float* points, int count, int dim, const KnnHnswParams* params);
+
+// Changes the candidate list size of later HNSW searches; no effect on exact indexes
+void knn_index_set_ef(KnnIndex* index, int ef_search);
+
+int knn_index_is_exact(KnnIndexType type);
+
+// Finds the k nearest points to the query, nearest first, and returns how many were found.
+// `neighbors` receives row indices of the original points, `distances` (optional) the squared distances.
+int knn_index_query(const KnnIndex* index, const float* query, int k, int* neighbors, float* distances);
+
+// Offers the points near the query to a caller-owned heap; its capacity is the k searched for
+void knn_index_search(const KnnIndex* index, const float* query, KnnHeap* heap);
+
+// Writes the index as blocks of a model file
+void knn_index_save(const KnnIndex* index, BinaryWriter* writer);
+
+// Reads an index saved by knn_index_save in place, without rebuilding it: its arrays stay in the
+// mapped file, which must outlive the index. Returns NULL if the blocks are missing or malformed, or
+// are not an index over `count` points of `dim` features.
+KnnIndex* knn_index_map(BinaryReader* reader, int count, int dim);
+
+KnnIndexType knn_index_type(const KnnIndex* index);
+
+void knn_index_free(KnnIndex* index);
+
+const char* knn_index_name(KnnIndexType type);
+
+// Parses "none", "kd", "ball" or "hnsw"; returns 0 if the name is not recognised
+int knn_index_parse(const char* name, KnnIndexType* type);
+
+#endif
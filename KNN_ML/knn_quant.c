@@ -0,0 +1,497 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "knn_quant.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KNN_X86_DISPATCH 1
+#include <immintrin.h>
+#endif
+
+// Tiles scanned per kernel call
+#define SCAN_TILES 16
+// How far ahead of the scan the kernels ask for the data; the hardware prefetcher alone does not keep a narrow-element stream fed
+#define PREFETCH_TILES 8
+
+// A kernel writes the distances of the rows of tiles [first, first + tiles) to out, KNN_BLOCK per tile.
+// `query` is already in the storage's units and `weight` (int8 only) holds the squared scale of every feature.
+typedef void (*QuantKernel)(const void* data, int dim, int first, int tiles, const float* query, const float* weight, float* out);
+
+static QuantKernel fp16_kernel = NULL;
+static QuantKernel int8_kernel = NULL;
+
+// Per-thread buffers, grown on demand: the query converted to code units and one gathered full-precision row
+static _Thread_local float* thread_query = NULL;
+static _Thread_local float* thread_row = NULL;
+static _Thread_local int thread_capacity = 0;
+
+// Function to round a float to the nearest half-precision value (ties to even)
+static uint16_t float_to_half(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint32_t sign = (bits >> 16) & 0x8000;
+    int exponent = (int)((bits >> 23) & 0xff) - 127 + 15;
+    uint32_t mantissa = bits & 0x7fffff;
+    if (((bits >> 23) & 0xff) == 0xff)
+        return ((uint16_t)(sign | 0x7c00 | (mantissa ? 0x200 : 0)));  // infinity or NaN
+    if (exponent >= 31)
+        return ((uint16_t)(sign | 0x7c00));  // too large: infinity
+    if (exponent <= 0)
+    {
+        if (exponent < -10)
+            return ((uint16_t)sign);  // too small even for a subnormal
+        mantissa |= 0x800000;
+        int shift = 14 - exponent;
+        uint32_t half = mantissa >> shift;
+        uint32_t rest = mantissa & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (half & 1)))
+            half++;
+        return ((uint16_t)(sign | half));
+    }
+    uint32_t half = ((uint32_t)exponent << 10) | (mantissa >> 13);
+    uint32_t rest = mantissa & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+        half++;  // a carry into the exponent is the correct rounding
+    return ((uint16_t)(sign | half));
+}
+
+static float half_to_float(uint16_t half)
+{
+    uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+    uint32_t exponent = (half >> 10) & 0x1f;
+    uint32_t mantissa = half & 0x3ff;
+    uint32_t bits;
+    if (exponent == 0)
+    {
+        if (mantissa == 0)
+        {
+            bits = sign;
+        }
+        else
+        {
+            exponent = 127 - 14;  // subnormal: shift the mantissa up until it has the implicit bit
+            while (!(mantissa & 0x400))
+            {
+                mantissa <<= 1;
+                exponent--;
+            }
+            bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+        }
+    }
+    else if (exponent == 31)
+    {
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    }
+    else
+    {
+        bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+    }
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return (value);
+}
+
+static void fp16_scalar(const void* data, int dim, int first, int tiles, const float* query, const float* weight, float* out)
+{
+    (void)weight;
+    for (int t = 0; t < tiles; t++, out += KNN_BLOCK)
+    {
+        const uint16_t* tile = (const uint16_t*)data + (size_t)(first + t) * dim * KNN_BLOCK;
+        for (int i = 0; i < KNN_BLOCK; i++)
+        {
+            out[i] = 0;
+        }
+        for (int d = 0; d < dim; d++, tile += KNN_BLOCK)
+        {
+            for (int i = 0; i < KNN_BLOCK; i++)
+            {
+                float diff = half_to_float(tile[i]) - query[d];
+                out[i] += diff * diff;
+            }
+        }
+    }
+}
+
+static void int8_scalar(const void* data, int dim, int first, int tiles, const float* query, const float* weight, float* out)
+{
+    for (int t = 0; t < tiles; t++, out += KNN_BLOCK)
+    {
+        const int8_t* tile = (const int8_t*)data + (size_t)(first + t) * dim * KNN_BLOCK;
+        for (int i = 0; i < KNN_BLOCK; i++)
+        {
+            out[i] = 0;
+        }
+        for (int d = 0; d < dim; d++, tile += KNN_BLOCK)
+        {
+            for (int i = 0; i < KNN_BLOCK; i++)
+            {
+                float diff = tile[i] - query[d];
+                out[i] += diff * diff * weight[d];
+            }
+        }
+    }
+}
+
+#ifdef KNN_X86_DISPATCH
+// The kernels below work on several tiles at once: every tile is its own chain of dependent FMAs, so running
+// independent chains side by side keeps the FMA units busy while each one waits for the previous result.
+
+__attribute__((target("avx2,fma,f16c")))
+static void fp16_avx2(const void* data, int dim, int first, int tiles, const float* query, const float* weight, float* out)
+{
+    (void)weight;
+    size_t tile_size = (size_t)dim * KNN_BLOCK;
+    const uint16_t* base = (const uint16_t*)data + first * tile_size;
+    for (int t = 0; t < tiles; t += 2)
+    {
+        int pair = (t + 1 < tiles);  // the second tile of the pair, absent at the end of an odd count
+        const uint16_t* a = base + t * tile_size;
+        const uint16_t* b = pair ? a + tile_size : a;
+        __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+        __m256 acc2 = _mm256_setzero_ps(), acc3 = _mm256_setzero_ps();
+        const uint16_t* ahead = base + (t + PREFETCH_TILES) * tile_size;
+        for (int d = 0; d < dim; d++, a += KNN_BLOCK, b += KNN_BLOCK)
+        {
+            _mm_prefetch((const char*)(ahead + 2 * d * KNN_BLOCK), _MM_HINT_T0);
+            __m256 q = _mm256_set1_ps(query[d]);
+            __m256 diff0 = _mm256_sub_ps(_mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)a)), q);
+            __m256 diff1 = _mm256_sub_ps(_mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(a + 8))), q);
+            __m256 diff2 = _mm256_sub_ps(_mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)b)), q);
+            __m256 diff3 = _mm256_sub_ps(_mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(b + 8))), q);
+            acc0 = _mm256_fmadd_ps(diff0, diff0, acc0);
+            acc1 = _mm256_fmadd_ps(diff1, diff1, acc1);
+            acc2 = _mm256_fmadd_ps(diff2, diff2, acc2);
+            acc3 = _mm256_fmadd_ps(diff3, diff3, acc3);
+        }
+        _mm256_storeu_ps(out + t * KNN_BLOCK, acc0);
+        _mm256_storeu_ps(out + t * KNN_BLOCK + 8, acc1);
+        if (pair)
+        {
+            _mm256_storeu_ps(out + (t + 1) * KNN_BLOCK, acc2);
+            _mm256_storeu_ps(out + (t + 1) * KNN_BLOCK + 8, acc3);
+        }
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void int8_avx2(const void* data, int dim, int first, int tiles, const float* query, const float* weight, float* out)
+{
+    size_t tile_size = (size_t)dim * KNN_BLOCK;
+    const int8_t* base = (const int8_t*)data + first * tile_size;
+    for (int t = 0; t < tiles; t += 2)
+    {
+        int pair = (t + 1 < tiles);
+        const int8_t* a = base + t * tile_size;
+        const int8_t* b = pair ? a + tile_size : a;
+        __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+        __m256 acc2 = _mm256_setzero_ps(), acc3 = _mm256_setzero_ps();
+        const int8_t* ahead = base + (t + PREFETCH_TILES) * tile_size;
+        for (int d = 0; d < dim; d++, a += KNN_BLOCK, b += KNN_BLOCK)
+        {
+            _mm_prefetch((const char*)(ahead + 2 * d * KNN_BLOCK), _MM_HINT_T0);
+            __m256 q = _mm256_set1_ps(query[d]);
+            __m256 w = _mm256_set1_ps(weight[d]);
+            __m128i codes_a = _mm_loadu_si128((const __m128i*)a);
+            __m128i codes_b = _mm_loadu_si128((const __m128i*)b);
+            __m256 diff0 = _mm256_sub_ps(_mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(codes_a)), q);
+            __m256 diff1 = _mm256_sub_ps(_mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_srli_si128(codes_a, 8))), q);
+            __m256 diff2 = _mm256_sub_ps(_mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(codes_b)), q);
+            __m256 diff3 = _mm256_sub_ps(_mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_srli_si128(codes_b, 8))), q);
+            acc0 = _mm256_fmadd_ps(_mm256_mul_ps(diff0, diff0), w, acc0);
+            acc1 = _mm256_fmadd_ps(_mm256_mul_ps(diff1, diff1), w, acc1);
+            acc2 = _mm256_fmadd_ps(_mm256_mul_ps(diff2, diff2), w, acc2);
+            acc3 = _mm256_fmadd_ps(_mm256_mul_ps(diff3, diff3), w, acc3);
+        }
+        _mm256_storeu_ps(out + t * KNN_BLOCK, acc0);
+        _mm256_storeu_ps(out + t * KNN_BLOCK + 8, acc1);
+        if (pair)
+        {
+            _mm256_storeu_ps(out + (t + 1) * KNN_BLOCK, acc2);
+            _mm256_storeu_ps(out + (t + 1) * KNN_BLOCK + 8, acc3);
+        }
+    }
+}
+
+__attribute__((target("avx512f")))
+static void fp16_avx512(const void* data, int dim, int first, int tiles, const float* query, const float* weight, float* out)
+{
+    (void)weight;
+    size_t tile_size = (size_t)dim * KNN_BLOCK;
+    const uint16_t* base = (const uint16_t*)data + first * tile_size;
+    for (int t = 0; t < tiles; t += 4)
+    {
+        int count = (tiles - t < 4) ? tiles - t : 4;
+        // Missing tiles at the end repeat the last one; their results are not stored
+        const uint16_t* p0 = base + t * tile_size;
+        const uint16_t* p1 = p0 + (count > 1 ? tile_size : 0);
+        const uint16_t* p2 = p0 + (count > 2 ? 2 * tile_size : 0);
+        const uint16_t* p3 = p0 + (count > 3 ? 3 * tile_size : 0);
+        __m512 acc[4] = {_mm512_setzero_ps(), _mm512_setzero_ps(), _mm512_setzero_ps(), _mm512_setzero_ps()};
+        for (int d = 0; d < dim; d++)
+        {
+            size_t o = (size_t)d * KNN_BLOCK;
+            _mm_prefetch((const char*)(p0 + PREFETCH_TILES * tile_size + 4 * o), _MM_HINT_T0);
+            _mm_prefetch((const char*)(p0 + PREFETCH_TILES * tile_size + 4 * o + 32), _MM_HINT_T0);
+            __m512 q = _mm512_set1_ps(query[d]);
+            __m512 diff0 = _mm512_sub_ps(_mm512_cvtph_ps(_mm256_loadu_si256((const __m256i*)(p0 + o))), q);
+            __m512 diff1 = _mm512_sub_ps(_mm512_cvtph_ps(_mm256_loadu_si256((const __m256i*)(p1 + o))), q);
+            __m512 diff2 = _mm512_sub_ps(_mm512_cvtph_ps(_mm256_loadu_si256((const __m256i*)(p2 + o))), q);
+            __m512 diff3 = _mm512_sub_ps(_mm512_cvtph_ps(_mm256_loadu_si256((const __m256i*)(p3 + o))), q);
+            acc[0] = _mm512_fmadd_ps(diff0, diff0, acc[0]);
+            acc[1] = _mm512_fmadd_ps(diff1, diff1, acc[1]);
+            acc[2] = _mm512_fmadd_ps(diff2, diff2, acc[2]);
+            acc[3] = _mm512_fmadd_ps(diff3, diff3, acc[3]);
+        }
+        for (int i = 0; i < count; i++)
+        {
+            _mm512_storeu_ps(out + (t + i) * KNN_BLOCK, acc[i]);
+        }
+    }
+}
+
+__attribute__((target("avx512f")))
+static void int8_avx512(const void* data, int dim, int first, int tiles, const float* query, const float* weight, float* out)
+{
+    size_t tile_size = (size_t)dim * KNN_BLOCK;
+    const int8_t* base = (const int8_t*)data + first * tile_size;
+    for (int t = 0; t < tiles; t += 4)
+    {
+        int count = (tiles - t < 4) ? tiles - t : 4;
+        const int8_t* p0 = base + t * tile_size;
+        const int8_t* p1 = p0 + (count > 1 ? tile_size : 0);
+        const int8_t* p2 = p0 + (count > 2 ? 2 * tile_size : 0);
+        const int8_t* p3 = p0 + (count > 3 ? 3 * tile_size : 0);
+        __m512 acc[4] = {_mm512_setzero_ps(), _mm512_setzero_ps(), _mm512_setzero_ps(), _mm512_setzero_ps()};
+        for (int d = 0; d < dim; d++)
+        {
+            size_t o = (size_t)d * KNN_BLOCK;
+            _mm_prefetch((const char*)(p0 + PREFETCH_TILES * tile_size + 4 * o), _MM_HINT_T0);
+            __m512 q = _mm512_set1_ps(query[d]);
+            __m512 w = _mm512_set1_ps(weight[d]);
+            __m512 diff0 = _mm512_sub_ps(_mm512_cvtepi32_ps(_mm512_cvtepi8_epi32(_mm_loadu_si128((const __m128i*)(p0 + o)))), q);
+            __m512 diff1 = _mm512_sub_ps(_mm512_cvtepi32_ps(_mm512_cvtepi8_epi32(_mm_loadu_si128((const __m128i*)(p1 + o)))), q);
+            __m512 diff2 = _mm512_sub_ps(_mm512_cvtepi32_ps(_mm512_cvtepi8_epi32(_mm_loadu_si128((const __m128i*)(p2 + o)))), q);
+            __m512 diff3 = _mm512_sub_ps(_mm512_cvtepi32_ps(_mm512_cvtepi8_epi32(_mm_loadu_si128((const __m128i*)(p3 + o)))), q);
+            acc[0] = _mm512_fmadd_ps(_mm512_mul_ps(diff0, diff0), w, acc[0]);
+            acc[1] = _mm512_fmadd_ps(_mm512_mul_ps(diff1, diff1), w, acc[1]);
+            acc[2] = _mm512_fmadd_ps(_mm512_mul_ps(diff2, diff2), w, acc[2]);
+            acc[3] = _mm512_fmadd_ps(_mm512_mul_ps(diff3, diff3), w, acc[3]);
+        }
+        for (int i = 0; i < count; i++)
+        {
+            _mm512_storeu_ps(out + (t + i) * KNN_BLOCK, acc[i]);
+        }
+    }
+}
+#endif
+
+// Picks the widest kernels the CPU supports, following the same order as the float32 kernels
+void knn_quant_init(void)
+{
+    if (fp16_kernel != NULL)
+        return;
+    QuantKernel fp16 = fp16_scalar;
+    QuantKernel int8 = int8_scalar;
+#ifdef KNN_X86_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+    {
+        fp16 = fp16_avx512;
+        int8 = int8_avx512;
+    }
+    else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    {
+        int8 = int8_avx2;
+        if (__builtin_cpu_supports("f16c"))
+            fp16 = fp16_avx2;
+    }
+#endif
+    int8_kernel = int8;
+    fp16_kernel = fp16;
+}
+
+// Position of feature d of row i: the rows are grouped in tiles of KNN_BLOCK, each tile holding every feature
+// of its rows one after another, so a scan reads the storage front to back
+static size_t tile_position(const KnnQuantized* quantized, int i, int d)
+{
+    return (((size_t)(i / KNN_BLOCK) * quantized->dim + d) * KNN_BLOCK + i % KNN_BLOCK);
+}
+
+void knn_quantize(KnnQuantized* quantized, const KnnFeatures* features, KnnStorage storage)
+{
+    knn_quant_init();
+    quantized->storage = storage;
+    quantized->count = features->count;
+    quantized->dim = features->dim;
+    quantized->tiles = (features->count + KNN_BLOCK - 1) / KNN_BLOCK;
+    quantized->offset = NULL;
+    quantized->scale = NULL;
+    quantized->weight = NULL;
+    size_t elements = (size_t)quantized->tiles * KNN_BLOCK * (features->dim > 0 ? features->dim : 1);
+    if (storage == KNN_STORAGE_FP16)
+    {
+        uint16_t* halves = (uint16_t*)knn_aligned_alloc(elements * sizeof(uint16_t));
+        for (int i = 0; i < quantized->tiles * KNN_BLOCK; i++)
+        {
+            for (int d = 0; d < features->dim; d++)
+            {
+                halves[tile_position(quantized, i, d)] = float_to_half(features->data[(size_t)d * features->stride + i]);  // padding rows are 0
+            }
+        }
+        quantized->data = halves;
+        return;
+    }
+    if (storage != KNN_STORAGE_INT8)
+    {
+        quantized->data = NULL;
+        return;
+    }
+    int8_t* codes = (int8_t*)knn_aligned_alloc(elements);
+    memset(codes, 0, elements);
+    quantized->offset = (float*)malloc(features->dim * sizeof(float));
+    quantized->scale = (float*)malloc(features->dim * sizeof(float));
+    quantized->weight = (float*)malloc(features->dim * sizeof(float));
+    for (int d = 0; d < features->dim; d++)
+    {
+        const float* column = features->data + (size_t)d * features->stride;
+        float lo = column[0], hi = column[0];
+        for (int i = 1; i < features->count; i++)
+        {
+            lo = column[i] < lo ? column[i] : lo;
+            hi = column[i] > hi ? column[i] : hi;
+        }
+        // The range is centered on 0 and split into 254 steps, so every value is within half a step of its code
+        float offset = 0.5f * (lo + hi);
+        float scale = (hi - lo) / 254;
+        if (!(scale > 0))
+            scale = 1;  // a constant feature: every code is 0
+        quantized->offset[d] = offset;
+        quantized->scale[d] = scale;
+        quantized->weight[d] = scale * scale;
+        for (int i = 0; i < features->count; i++)
+        {
+            float code = roundf((column[i] - offset) / scale);
+            codes[tile_position(quantized, i, d)] = (int8_t)(code < -127 ? -127 : (code > 127 ? 127 : code));
+        }
+    }
+    quantized->data = codes;
+}
+
+void knn_quantized_free(KnnQuantized* quantized)
+{
+    knn_aligned_free(quantized->data);
+    free(quantized->offset);
+    free(quantized->scale);
+    free(quantized->weight);
+    quantized->data = NULL;
+    quantized->offset = NULL;
+    quantized->scale = NULL;
+    quantized->weight = NULL;
+    quantized->count = 0;
+}
+
+size_t knn_quantized_row_bytes(const KnnQuantized* quantized)
+{
+    switch (quantized->storage)
+    {
+    case KNN_STORAGE_FP16:
+        return (quantized->dim * sizeof(uint16_t));
+    case KNN_STORAGE_INT8:
+        return (quantized->dim * sizeof(int8_t));
+    default:
+        return (quantized->dim * sizeof(float));
+    }
+}
+
+size_t knn_quantized_bytes(const KnnQuantized* quantized)
+{
+    size_t bytes = (size_t)quantized->tiles * KNN_BLOCK * knn_quantized_row_bytes(quantized);
+    if (quantized->storage == KNN_STORAGE_INT8)
+        bytes += 3 * quantized->dim * sizeof(float);  // offset, scale and weight
+    return (bytes);
+}
+
+static void reserve_thread_buffers(int dim)
+{
+    if (thread_capacity >= dim)
+        return;
+    free(thread_query);
+    free(thread_row);
+    thread_query = (float*)malloc(dim * sizeof(float));
+    thread_row = (float*)malloc(dim * sizeof(float));
+    thread_capacity = dim;
+}
+
+
+void knn_quantized_search(const KnnQuantized* quantized, const KnnFeatures* exact, const float* query, KnnHeap* candidates, KnnHeap* heap)
+{
+    int dim = quantized->dim;
+    reserve_thread_buffers(dim);
+    const float* target = query;
+    if (quantized->storage == KNN_STORAGE_INT8)
+    {
+        // (offset + scale * code - q)^2 = scale^2 * (code - (q - offset) / scale)^2, so the kernel works in code units
+        for (int d = 0; d < dim; d++)
+        {
+            thread_query[d] = (query[d] - quantized->offset[d]) / quantized->scale[d];
+        }
+        target = thread_query;
+    }
+
+    KnnHeap* scan = (exact != NULL) ? candidates : heap;
+    QuantKernel kernel = (quantized->storage == KNN_STORAGE_FP16) ? fp16_kernel : int8_kernel;
+    float distances[SCAN_TILES * KNN_BLOCK];
+    for (int tile = 0; tile < quantized->tiles; tile += SCAN_TILES)
+    {
+        int tiles = (quantized->tiles - tile > SCAN_TILES) ? SCAN_TILES : quantized->tiles - tile;
+        kernel(quantized->data, dim, tile, tiles, target, quantized->weight, distances);
+        int first = tile * KNN_BLOCK;
+        int end = (first + tiles * KNN_BLOCK < quantized->count) ? first + tiles * KNN_BLOCK : quantized->count;
+        for (int i = first; i < end; i++)
+        {
+            knn_heap_push(scan, distances[i - first], i);
+        }
+    }
+    if (exact == NULL)
+        return;
+
+    // Re-rank: the few candidates get their full-precision distance, read from the float columns
+    for (int c = 0; c < candidates->size; c++)
+    {
+        int row = candidates->items[c].index;
+        for (int d = 0; d < dim; d++)
+        {
+            thread_row[d] = exact->data[(size_t)d * exact->stride + row];
+        }
+        knn_heap_push(heap, knn_distance2(thread_row, query, dim), row);
+    }
+}
+
+const char* knn_storage_name(KnnStorage storage)
+{
+    switch (storage)
+    {
+    case KNN_STORAGE_FP16:
+        return ("fp16");
+    case KNN_STORAGE_INT8:
+        return ("int8");
+    default:
+        return ("float32");
+    }
+}
+
+int knn_storage_parse(const char* name, KnnStorage* storage)
+{
+    if (strcmp(name, "float32") == 0 || strcmp(name, "float") == 0)
+        *storage = KNN_STORAGE_FLOAT32;
+    else if (strcmp(name, "fp16") == 0)
+        *storage = KNN_STORAGE_FP16;
+    else if (strcmp(name, "int8") == 0)
+        *storage = KNN_STORAGE_INT8;
+    else
+        return (0);
+    return (1);
+}
@@ -0,0 +1,56 @@
+#ifndef KNN_QUANT_H
+#define KNN_QUANT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "knn_heap.h"
+#include "knn_simd.h"
+
+// Compressed copies of the column-major training features for the brute-force scan, which reads every
+// training row per query and is limited by memory bandwidth once the set outgrows the caches.
+// fp16 halves the bytes read per row and int8 quarters them; the scan then ranks rows by the
+// approximate distance and the best candidates are re-ranked with the full-precision features.
+
+typedef enum {
+    KNN_STORAGE_FLOAT32,  // the plain KnnFeatures, no compression
+    KNN_STORAGE_FP16,     // IEEE half precision, about 3 significant digits
+    KNN_STORAGE_INT8      // per-feature scaled: value = offset[d] + scale[d] * code, codes in [-127, 127]
+} KnnStorage;
+
+typedef struct {
+    KnnStorage storage;
+    int count;
+    int dim;
+    int tiles;      // groups of KNN_BLOCK rows, the last one padded with zero rows
+    void* data;     // 64-byte aligned uint16_t halves or int8_t codes; tile by tile, each holding feature 0 of
+                    // its KNN_BLOCK rows, then feature 1, ..., so a scan reads it front to back
+    float* offset;  // int8 only, per feature
+    float* scale;   // int8 only, per feature
+    float* weight;  // int8 only, scale squared
+} KnnQuantized;
+
+// Picks the compressed-scan kernels for this CPU. knn_quantize calls it; code that quantizes inside a parallel
+// region calls it before, like knn_simd_init.
+void knn_quant_init(void);
+
+// Compresses the features; they are not referenced afterwards
+void knn_quantize(KnnQuantized* quantized, const KnnFeatures* features, KnnStorage storage);
+void knn_quantized_free(KnnQuantized* quantized);
+
+// Bytes of compressed storage scanned per training row
+size_t knn_quantized_row_bytes(const KnnQuantized* quantized);
+// Bytes the compressed copy holds in memory, the padding rows and the int8 tables included
+size_t knn_quantized_bytes(const KnnQuantized* quantized);
+
+// Offers every training row to `candidates` ranked by the compressed distance, then, when `exact` is given,
+// offers the candidates to `heap` with their full-precision distances; without it `heap` gets the
+// approximate distances. `candidates` should hold a few times more entries than `heap`.
+void knn_quantized_search(const KnnQuantized* quantized, const KnnFeatures* exact, const float* query, KnnHeap* candidates, KnnHeap* heap);
+
+const char* knn_storage_name(KnnStorage storage);
+
+// Parses "float32", "fp16" or "int8"; returns 0 if the name is not recognised
+int knn_storage_parse(const char* name, KnnStorage* storage);
+
+#endif
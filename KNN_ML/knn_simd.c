@@ -0,0 +1,180 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "knn_simd.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KNN_X86_DISPATCH 1
+#include <immintrin.h>
+#endif
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+#define ALIGNMENT 64
+
+// A kernel writes the distances of `rows` rows starting at any `start`; `rows` is a multiple of its block width
+typedef void (*DistanceKernel)(const float* data, int stride, int dim, int start, int rows, const float* query, float* out);
+
+static DistanceKernel kernel = NULL;
+static int kernel_width = 1;
+static const char* kernel_name = "scalar";
+
+void* knn_aligned_alloc(size_t size)
+{
+    size = (size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+#ifdef _WIN32
+    return (_aligned_malloc(size, ALIGNMENT));
+#else
+    return (aligned_alloc(ALIGNMENT, size));
+#endif
+}
+
+void knn_aligned_free(void* ptr)
+{
+#ifdef _WIN32
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
+static void distances_scalar(const float* data, int stride, int dim, int start, int rows, const float* query, float* out)
+{
+    for (int i = 0; i < rows; i++)
+    {
+        out[i] = 0;
+    }
+    for (int d = 0; d < dim; d++)
+    {
+        const float* column = data + (size_t)d * stride + start;
+        float q = query[d];
+        for (int i = 0; i < rows; i++)
+        {
+            float diff = column[i] - q;
+            out[i] += diff * diff;
+        }
+    }
+}
+
+#ifdef KNN_X86_DISPATCH
+__attribute__((target("avx2,fma")))
+static void distances_avx2(const float* data, int stride, int dim, int start, int rows, const float* query, float* out)
+{
+    for (int i = 0; i < rows; i += 16)
+    {
+        __m256 acc0 = _mm256_setzero_ps();
+        __m256 acc1 = _mm256_setzero_ps();
+        const float* column = data + start + i;
+        for (int d = 0; d < dim; d++, column += stride)
+        {
+            __m256 q = _mm256_set1_ps(query[d]);
+            __m256 diff0 = _mm256_sub_ps(_mm256_loadu_ps(column), q);
+            __m256 diff1 = _mm256_sub_ps(_mm256_loadu_ps(column + 8), q);
+            acc0 = _mm256_fmadd_ps(diff0, diff0, acc0);
+            acc1 = _mm256_fmadd_ps(diff1, diff1, acc1);
+        }
+        _mm256_storeu_ps(out + i, acc0);
+        _mm256_storeu_ps(out + i + 8, acc1);
+    }
+}
+
+__attribute__((target("avx512f")))
+static void distances_avx512(const float* data, int stride, int dim, int start, int rows, const float* query, float* out)
+{
+    for (int i = 0; i < rows; i += 16)
+    {
+        __m512 acc = _mm512_setzero_ps();
+        const float* column = data + start + i;
+        for (int d = 0; d < dim; d++, column += stride)
+        {
+            __m512 diff = _mm512_sub_ps(_mm512_loadu_ps(column), _mm512_set1_ps(query[d]));
+            acc = _mm512_fmadd_ps(diff, diff, acc);
+        }
+        _mm512_storeu_ps(out + i, acc);
+    }
+}
+#endif
+
+// Picks the widest kernel the CPU supports. The choice is made in locals and the kernel published last, so a
+// search never sees a half-made choice.
+void knn_simd_init(void)
+{
+    if (kernel != NULL)
+        return;
+    DistanceKernel chosen = distances_scalar;
+    int width = 1;
+    const char* name = "scalar";
+#ifdef KNN_X86_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+    {
+        chosen = distances_avx512;
+        width = 16;
+        name = "avx512";
+    }
+    else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    {
+        chosen = distances_avx2;
+        width = 16;
+        name = "avx2";
+    }
+#endif
+    kernel_width = width;
+    kernel_name = name;
+    kernel = chosen;
+}
+
+const char* knn_simd_name(void)
+{
+    knn_simd_init();
+    return (kernel_name);
+}
+
+// The spare block keeps a block starting anywhere before `count` inside the column
+int knn_padded_stride(int count)
+{
+    return ((count + KNN_BLOCK - 1) / KNN_BLOCK * KNN_BLOCK + KNN_BLOCK);
+}
+
+void knn_features_from_rows(KnnFeatures* features, const float* rows, int count, int dim)
+{
+    knn_simd_init();
+    features->count = count;
+    features->dim = dim;
+    features->stride = knn_padded_stride(count);
+    size_t size = (size_t)features->stride * (dim > 0 ? dim : 1) * sizeof(float);
+    features->data = (float*)knn_aligned_alloc(size);
+    memset(features->data, 0, size);
+    for (int i = 0; i < count; i++)
+    {
+        for (int d = 0; d < dim; d++)
+        {
+            features->data[(size_t)d * features->stride + i] = rows[(size_t)i * dim + d];
+        }
+    }
+}
+
+void knn_features_free(KnnFeatures* features)
+{
+    knn_aligned_free(features->data);
+    features->data = NULL;
+    features->count = 0;
+}
+
+void knn_distances(const KnnFeatures* features, int start, int end, const float* query, float* out)
+{
+    DistanceKernel fn = kernel ? kernel : distances_scalar;
+    int rows = end - start;
+    int whole = rows / kernel_width * kernel_width;
+    if (whole > 0)
+        fn(features->data, features->stride, features->dim, start, whole, query, out);
+    if (whole < rows)
+    {
+        // The last partial block is computed whole (the padding keeps it in bounds) and only its valid rows kept
+        float tail[KNN_BLOCK];
+        fn(features->data, features->stride, features->dim, start + whole, kernel_width, query, tail);
+        memcpy(out + whole, tail, (rows - whole) * sizeof(float));
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef KNN_SIMD_H
+#define KNN_SIMD_H
+
+#include <stddef.h>
+
+// Column-major (structure-of-arrays) feature storage and the distance kernels that scan it.
+// One query is compared against a block of 8 (AVX2) or 16 (AVX-512) consecutive rows per instruction;
+// the kernel is picked at runtime from what the CPU supports, with a portable scalar fallback.
+
+#define KNN_BLOCK 16  // rows the widest kernel handles at once; strides are padded to a multiple of it
+
+typedef struct {
+    int count;
+    int dim;
+    int stride;   // floats from one column to the next, padded so a kernel may read a whole block past any row
+    float* data;  // 64-byte aligned, feature d of row i at data[d * stride + i]
+} KnnFeatures;
+
+// Squared Euclidean distance between two row-major feature vectors, for the few places that are not a scan
+static inline float knn_distance2(const float* a, const float* b, int dim)
+{
+    float sum = 0;
+    for (int i = 0; i < dim; i++)
+    {
+        float diff = a[i] - b[i];
+        sum += diff * diff;
+    }
+    return (sum);
+}
+
+void* knn_aligned_alloc(size_t size);
+void knn_aligned_free(void* ptr);
+
+// Stride of the columns of `count` rows: rounded up to a whole block, plus one spare block past the last row
+int knn_padded_stride(int count);
+
+// Transposes `count` row-major rows of `dim` features into column-major storage
+void knn_features_from_rows(KnnFeatures* features, const float* rows, int count, int dim);
+void knn_features_free(KnnFeatures* features);
+
+// Writes the squared distances from the query (`dim` floats) to rows [start, end) into out[0 .. end - start)
+void knn_distances(const KnnFeatures* features, int start, int end, const float* query, float* out);
+
+// Picks the kernel knn_distances dispatches to on this CPU. Called by knn_features_from_rows; code that
+// searches features it did not build (a mapped model) calls it before the first search, outside parallel regions.
+void knn_simd_init(void);
+
+// Name of the kernel knn_distances dispatches to on this CPU
+const char* knn_simd_name(void);
+
+#endif
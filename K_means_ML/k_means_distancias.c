@@ -0,0 +1,294 @@
+#include <float.h>
+#include <math.h>
+
+#include "k_means_distancias.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KMEANS_X86_DISPATCH 1
+#endif
+
+#define ANCHO_PANEL 16             // centroides por panel: sus valores de una característica van seguidos
+#define FILAS_MAX 8                // puntos que un núcleo multiplica a la vez por un panel, como mucho
+#define BYTES_BLOQUE (256 << 10)   // bytes de puntos, y de centroides, de un bloque; los dos caben juntos en L2
+#define PUNTOS_BLOQUE_MAX 1024
+
+// Un bloque de puntos contra un rango de paneles de centroides. Los mínimos de cada punto se guardan entre
+// rangos: cada llamada al núcleo los actualiza con sus paneles.
+typedef struct {
+    const Matriz *datos;
+    int inicio, fin;               // puntos del bloque
+    const real *paneles;           // los centroides empaquetados por paneles: característica p del centroide
+                                   // panel·ANCHO_PANEL + j en paneles[(panel·d + p)·ANCHO_PANEL + j]
+    const real *normas_c;          // ||c||² de cada centroide, infinito en el relleno del último panel
+    int panel_inicio, panel_fin;
+    const real *normas_x;          // ||x||² de los puntos del bloque
+    real *mejor;                   // menor y segunda menor distancia al cuadrado aproximada de cada punto
+    real *segunda;
+    int *indice;                   // centroide de la menor
+} Tile;
+
+typedef void (*NucleoTile)(const Tile *tile);
+
+static NucleoTile nucleo = NULL;
+static const char *nombre = "portable";
+
+// Función para actualizar la menor y la segunda menor distancia de un punto con las de un panel
+static inline void actualizar_minimos(const real *dist, int primero, real *mejor, real *segunda, int *indice) {
+    for (int j = 0; j < ANCHO_PANEL; j++) {
+        if (dist[j] < *segunda) {
+            if (dist[j] < *mejor) {
+                *segunda = *mejor;
+                *mejor = dist[j];
+                *indice = primero + j;
+            } else {
+                *segunda = dist[j];
+            }
+        }
+    }
+}
+
+// Núcleo en C sin vectores explícitos, para cualquier compilador y CPU
+static void tile_portable(const Tile *t) {
+    int d = t->datos->columnas;
+    for (int i = t->inicio; i < t->fin; i++) {
+        const real *x = fila_matriz(t->datos, i);
+        int local = i - t->inicio;
+        for (int panel = t->panel_inicio; panel < t->panel_fin; panel++) {
+            const real *c = t->paneles + (size_t)panel * d * ANCHO_PANEL;
+            real acc[ANCHO_PANEL] = {0};
+            for (int p = 0; p < d; p++) {
+                for (int j = 0; j < ANCHO_PANEL; j++) {
+                    acc[j] += x[p] * c[(size_t)p * ANCHO_PANEL + j];
+                }
+            }
+            real dist[ANCHO_PANEL];
+            for (int j = 0; j < ANCHO_PANEL; j++) {
+                dist[j] = t->normas_c[panel * ANCHO_PANEL + j] + (t->normas_x[local] - 2 * acc[j]);
+            }
+            actualizar_minimos(dist, panel * ANCHO_PANEL, &t->mejor[local], &t->segunda[local], &t->indice[local]);
+        }
+    }
+}
+
+#ifdef KMEANS_X86_DISPATCH
+// Un panel entero como un vector de GCC, que el compilador parte en los registros que tenga la CPU
+typedef real VectorPanel __attribute__((vector_size(ANCHO_PANEL * sizeof(real)), aligned(LINEA_CACHE)));
+
+// Núcleo vectorial: filas_nucleo puntos a la vez contra cada panel, con filas_nucleo·ANCHO_PANEL acumuladores
+// en registros. Si quedan menos puntos, los que faltan repiten el último y su resultado se descarta.
+static inline __attribute__((always_inline)) void tile_vectorial(const Tile *t, const int filas_nucleo) {
+    int d = t->datos->columnas;
+    VectorPanel cero = {0};
+    for (int i = t->inicio; i < t->fin; i += filas_nucleo) {
+        const real *x[FILAS_MAX];
+#pragma GCC unroll 8
+        for (int r = 0; r < filas_nucleo; r++) {
+            x[r] = fila_matriz(t->datos, i + r < t->fin ? i + r : t->fin - 1);
+        }
+        for (int panel = t->panel_inicio; panel < t->panel_fin; panel++) {
+            const VectorPanel *c = (const VectorPanel *)(t->paneles + (size_t)panel * d * ANCHO_PANEL);
+            VectorPanel acc[FILAS_MAX];
+#pragma GCC unroll 8
+            for (int r = 0; r < filas_nucleo; r++) {
+                acc[r] = cero;
+            }
+            for (int p = 0; p < d; p++) {
+                VectorPanel columna = c[p];
+#pragma GCC unroll 8
+                for (int r = 0; r < filas_nucleo; r++) {
+                    acc[r] += x[r][p] * columna;
+                }
+            }
+            // Epílogo: las distancias del panel solo se usan para actualizar los mínimos de cada punto
+            VectorPanel normas = *(const VectorPanel *)(t->normas_c + (size_t)panel * ANCHO_PANEL);
+            for (int r = 0; r < filas_nucleo && i + r < t->fin; r++) {
+                int local = i + r - t->inicio;
+                VectorPanel dist = normas + (t->normas_x[local] - (real)2 * acc[r]);
+                actualizar_minimos((const real *)&dist, panel * ANCHO_PANEL, &t->mejor[local], &t->segunda[local], &t->indice[local]);
+            }
+        }
+    }
+}
+
+// Los acumuladores de cada núcleo ocupan 8 registros vectoriales
+__attribute__((target("avx2,fma")))
+static void tile_avx2(const Tile *t) {
+    tile_vectorial(t, sizeof(real) == sizeof(double) ? 2 : 4);
+}
+
+__attribute__((target("avx512f")))
+static void tile_avx512(const Tile *t) {
+    tile_vectorial(t, sizeof(real) == sizeof(double) ? 4 : 8);
+}
+#endif
+
+// La elección se hace en variables locales y el núcleo se publica al final, así que una llamada posterior solo lo lee
+void elegir_nucleo(void) {
+    if (nucleo != NULL) {
+        return;
+    }
+    NucleoTile elegido = tile_portable;
+    const char *nombre_elegido = "portable";
+#ifdef KMEANS_X86_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        elegido = tile_avx512;
+        nombre_elegido = "avx512";
+    } else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        elegido = tile_avx2;
+        nombre_elegido = "avx2";
+    }
+#endif
+    nombre = nombre_elegido;
+    nucleo = elegido;
+}
+
+const char *nombre_nucleo(void) {
+    elegir_nucleo();
+    return nombre;
+}
+
+int centroide_mas_cercano(const real *punto, const Matriz *centroides) {
+    double min_dist = DBL_MAX;
+    int mejor = 0;
+    for (int j = 0; j < centroides->filas; j++) {
+        double dist = calcular_distancia(punto, fila_matriz(centroides, j), centroides->columnas);
+        if (dist < min_dist) {
+            min_dist = dist;
+            mejor = j;
+        }
+    }
+    return mejor;
+}
+
+int asignar_escalar(const Matriz *datos, const Matriz *centroides, int *grupos) {
+    int cambios = 0;
+#pragma omp parallel for schedule(static) reduction(+:cambios)
+    for (int i = 0; i < datos->filas; i++) {
+        int mejor = centroide_mas_cercano(fila_matriz(datos, i), centroides);
+        if (grupos[i] != mejor) {
+            grupos[i] = mejor;
+            cambios++;
+        }
+    }
+    return cambios;
+}
+
+static real norma_cuadrada(const real *punto, int num_caracteristicas) {
+    real suma = 0;
+    for (int p = 0; p < num_caracteristicas; p++) {
+        suma += punto[p] * punto[p];
+    }
+    return suma;
+}
+
+int asignar_por_bloques(const Matriz *datos, const Matriz *centroides, int *grupos, long long *revisados) {
+    elegir_nucleo();
+    int num_datos = datos->filas;
+    int d = datos->columnas;
+    int k = centroides->filas;
+    int paneles = (k + ANCHO_PANEL - 1) / ANCHO_PANEL;
+    Arena arena;
+    iniciar_arena(&arena);
+    real *empaquetados = (real *)arena_reservar(&arena, (size_t)paneles * d * ANCHO_PANEL * sizeof(real));
+    real *normas_c = (real *)arena_reservar(&arena, (size_t)paneles * ANCHO_PANEL * sizeof(real));
+
+    // Empaqueta los centroides: cada panel guarda sus ANCHO_PANEL centroides característica a característica
+    real maxima_norma = 0;
+#pragma omp parallel for schedule(static) reduction(max:maxima_norma)
+    for (int panel = 0; panel < paneles; panel++) {
+        real *destino = empaquetados + (size_t)panel * d * ANCHO_PANEL;
+        for (int j = 0; j < ANCHO_PANEL; j++) {
+            int c = panel * ANCHO_PANEL + j;
+            const real *centroide = c < k ? fila_matriz(centroides, c) : NULL;
+            for (int p = 0; p < d; p++) {
+                destino[(size_t)p * ANCHO_PANEL + j] = centroide != NULL ? centroide[p] : 0;
+            }
+            normas_c[c] = centroide != NULL ? norma_cuadrada(centroide, d) : (real)INFINITY;
+            if (centroide != NULL && normas_c[c] > maxima_norma) {
+                maxima_norma = normas_c[c];
+            }
+        }
+    }
+
+    // Bloques de puntos y de paneles que caben en L2, cada uno de BYTES_BLOQUE como mucho
+    int paneles_bloque = (int)(BYTES_BLOQUE / ((size_t)d * ANCHO_PANEL * sizeof(real)));
+    if (paneles_bloque < 1) {
+        paneles_bloque = 1;
+    }
+    int puntos_bloque = (int)(BYTES_BLOQUE / ((size_t)d * sizeof(real))) / FILAS_MAX * FILAS_MAX;
+    if (puntos_bloque < FILAS_MAX) {
+        puntos_bloque = FILAS_MAX;
+    } else if (puntos_bloque > PUNTOS_BLOQUE_MAX) {
+        puntos_bloque = PUNTOS_BLOQUE_MAX;
+    }
+    int bloques = (num_datos + puntos_bloque - 1) / puntos_bloque;
+
+    // Cota del error de redondeo de ||x||² − 2·x·c + ||c||² respecto de ||x||² + ||c||², sumando el de las dos
+    // distancias que se comparan y el de la distancia exacta
+    double redondeo = (sizeof(real) == sizeof(float) ? FLT_EPSILON : DBL_EPSILON) / 2;
+    double factor = (8.0 * d + 32) * redondeo;
+
+    int cambios = 0;
+    long long repetidos = 0;
+#pragma omp parallel for schedule(dynamic, 1) reduction(+:cambios, repetidos)
+    for (int b = 0; b < bloques; b++) {
+        real normas_x[PUNTOS_BLOQUE_MAX], mejor[PUNTOS_BLOQUE_MAX], segunda[PUNTOS_BLOQUE_MAX];
+        int indice[PUNTOS_BLOQUE_MAX];
+        Tile tile;
+        tile.datos = datos;
+        tile.inicio = b * puntos_bloque;
+        tile.fin = tile.inicio + puntos_bloque < num_datos ? tile.inicio + puntos_bloque : num_datos;
+        tile.paneles = empaquetados;
+        tile.normas_c = normas_c;
+        tile.normas_x = normas_x;
+        tile.mejor = mejor;
+        tile.segunda = segunda;
+        tile.indice = indice;
+        for (int i = tile.inicio; i < tile.fin; i++) {
+            int local = i - tile.inicio;
+            normas_x[local] = norma_cuadrada(fila_matriz(datos, i), d);
+            mejor[local] = (real)INFINITY;
+            segunda[local] = (real)INFINITY;
+            indice[local] = 0;
+        }
+        for (int panel = 0; panel < paneles; panel += paneles_bloque) {
+            tile.panel_inicio = panel;
+            tile.panel_fin = panel + paneles_bloque < paneles ? panel + paneles_bloque : paneles;
+            nucleo(&tile);
+        }
+
+        for (int i = tile.inicio; i < tile.fin; i++) {
+            int local = i - tile.inicio;
+            int elegido = indice[local];
+            // Con la diferencia dentro del error posible, el orden de los dos centroides no es fiable
+            if (!((double)segunda[local] - mejor[local] > factor * ((double)normas_x[local] + maxima_norma))) {
+                elegido = centroide_mas_cercano(fila_matriz(datos, i), centroides);
+                repetidos++;
+            }
+            if (grupos[i] != elegido) {
+                grupos[i] = elegido;
+                cambios++;
+            }
+        }
+    }
+
+    liberar_arena(&arena);
+    if (revisados != NULL) {
+        *revisados += repetidos;
+    }
+    return cambios;
+}
+
+// Con pocos centroides o pocas características el empaquetado y las normas cuestan más de lo que ahorra el
+// núcleo; medido con --bench-distances, los bloques empiezan a ganar hacia d·k = 512
+int usar_bloques(int num_caracteristicas, int k) {
+    return k >= 16 && (long long)num_caracteristicas * k >= 512;
+}
+
+int asignar_puntos_a_centroides(const Matriz *datos, const Matriz *centroides, int *grupos, ModoAsignacion modo) {
+    if (modo == ASIGNACION_BLOQUES || (modo == ASIGNACION_AUTO && usar_bloques(datos->columnas, centroides->filas))) {
+        return asignar_por_bloques(datos, centroides, grupos, NULL);
+    }
+    return asignar_escalar(datos, centroides, grupos);
+}
@@ -0,0 +1,38 @@
+#ifndef K_MEANS_DISTANCIAS_H
+#define K_MEANS_DISTANCIAS_H
+
+#include "k_means_matriz.h"
+
+// Asignación de cada punto a su centroide más cercano. La versión escalar mide cada distancia por separado y
+// es la referencia. La versión por bloques usa ||x||² − 2·x·c + ||c||²: los productos x·c de un grupo de
+// puntos con un panel de centroides se calculan como un producto de matrices por bloques, con vectores SIMD
+// (AVX2 o AVX-512, según la CPU), y el mínimo de cada punto se actualiza al terminar cada bloque, sin guardar
+// la matriz n×k de distancias.
+
+typedef enum {
+    ASIGNACION_AUTO,     // por bloques cuando compensa (ver usar_bloques), escalar si no
+    ASIGNACION_ESCALAR,
+    ASIGNACION_BLOQUES
+} ModoAsignacion;
+
+// Devuelve 1 si la asignación por bloques es más rápida que la escalar con esta dimensión y este k
+int usar_bloques(int num_caracteristicas, int k);
+
+// Centroide más cercano a un punto, midiendo todas las distancias
+int centroide_mas_cercano(const real *punto, const Matriz *centroides);
+
+// Asignan cada punto al centroide más cercano; devuelven cuántos puntos cambiaron de grupo
+int asignar_puntos_a_centroides(const Matriz *datos, const Matriz *centroides, int *grupos, ModoAsignacion modo);
+int asignar_escalar(const Matriz *datos, const Matriz *centroides, int *grupos);
+// La expansión pierde precisión cuando dos centroides están casi a la misma distancia de un punto: si la
+// diferencia no supera la cota del error de redondeo, el punto se vuelve a medir con las distancias exactas,
+// así que el resultado es idéntico al escalar. Si revisados no es NULL, suma cuántos puntos se volvieron a medir.
+int asignar_por_bloques(const Matriz *datos, const Matriz *centroides, int *grupos, long long *revisados);
+
+// Elige el núcleo de asignar_por_bloques para esta CPU. asignar_por_bloques lo elige en su primera llamada, pero
+// esa llamada puede estar dentro de una región paralela (reinicios, barrido), así que main lo llama antes.
+void elegir_nucleo(void);
+// Núcleo que usa asignar_por_bloques en esta CPU
+const char *nombre_nucleo(void);
+
+#endif
@@ -2,183 +2,1213 @@
 #include <stdlib.h>
 #include <math.h>
 #include <float.h>
+#include <string.h>
+#include <time.h>
+#include <stdint.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "../common/dataset.h"
+#include "../common/random.h"
+#include "k_means_matriz.h"
+#include "k_means_distancias.h"
+#include "k_means_servicio.h"
 
 #define MAX_ITER 100
+#define MAX_PASADAS 10   // pasadas sobre el archivo del K-Means mini-batch, si no converge antes
+#define BENCH_ITER 5     // iteraciones de Lloyd medidas por ejecución del benchmark
+#define TOLERANCIA 1e-6  // desplazamiento máximo de un centroide por debajo del cual se da por convergido
+#define ELKAN_K_MIN 20   // con KMEANS_AUTO se usa Elkan a partir de este k y de ELKAN_D_MIN características;
+#define ELKAN_D_MIN 32   // por debajo, corregir sus n·k cotas cuesta más que las distancias que ahorra
+
+// Variantes del algoritmo. Todas llegan a las mismas asignaciones; Hamerly y Elkan usan la desigualdad
+// triangular para saltarse las distancias que no pueden cambiar la asignación de un punto.
+typedef enum {
+    KMEANS_AUTO,     // Hamerly, o Elkan con k y dimensión grandes
+    KMEANS_LLOYD,    // calcula las n·k distancias en cada iteración
+    KMEANS_HAMERLY,  // una cota superior y una inferior por punto
+    KMEANS_ELKAN     // una cota superior y k inferiores por punto; memoria n·k
+} AlgoritmoKMeans;
+
+// Cómo se eligen los centroides iniciales
+typedef enum {
+    INICIO_PRIMEROS,   // los k primeros puntos: malo con datos ordenados, como iris.data
+    INICIO_KMEANS_PP,  // k-means++: cada centroide se elige con probabilidad proporcional a D², la distancia al
+                       // cuadrado al centroide ya elegido más cercano; k pasadas sobre los datos
+    INICIO_PARALELO    // k-means||: unas pocas pasadas que eligen muchos candidatos a la vez, reagrupados en k
+} InicializacionKMeans;
+
+typedef struct {
+    AlgoritmoKMeans algoritmo;
+    InicializacionKMeans inicializacion;
+    double tolerancia;
+    uint64_t semilla;           // la misma semilla da el mismo resultado con cualquier número de hilos
+    int reinicios;              // ejecuciones con semillas distintas, en paralelo; se queda la de menor inercia
+    ModoAsignacion asignacion;  // cómo Lloyd y el mini-batch miden las distancias; no cambia el resultado
+} OpcionesKMeans;
+
+// Estadísticas de una ejecución de k_means
+typedef struct {
+    AlgoritmoKMeans algoritmo;
+    int reinicio;                // el reinicio elegido; las demás estadísticas son suyas
+    double inercia;              // suma de las distancias al cuadrado de cada punto a su centroide
+    double segundos_inicio;      // elegir los centroides iniciales
+    int iteraciones;             // pasadas de asignación, contando la inicial
+    int convergio;               // 0 si se agotaron las MAX_ITER iteraciones
+    long long distancias;        // distancias punto-centroide calculadas
+    long long distancias_lloyd;  // las que Lloyd habría calculado en las mismas iteraciones
+    double segundos;             // todo k_means, incluidos todos los reinicios
+} ResultadoKMeans;
+
+#define PUNTOS_POR_BLOQUE 16384           // puntos mínimos por bloque de sumas parciales
+#define BLOQUES_SUMA 256                  // como mucho; de sobra para repartir entre los hilos
+#define MEMORIA_ACUMULADORES (64 << 20)   // bytes máximos para las sumas parciales
+#define PUNTOS_POR_TAREA 1024             // puntos que toma un hilo de una vez en Hamerly y Elkan, cuyo trabajo por punto varía
+#define PUNTOS_POR_SORTEO 4096            // bloque fijo de puntos de la inicialización, con su propia suma de D² y su propio generador
+#define PUNTOS_SINTETICOS 65536           // bloque fijo de puntos de los datos sintéticos, con su propio generador
+#define SOBREMUESTREO 2                   // k-means|| elige unos SOBREMUESTREO·k candidatos por ronda
+#define RONDAS_PARALELO 5
+#define BLOQUE_SILUETA 256                // puntos por lado de los bloques de pares del silhouette exacto
+#define MUESTRA_POR_TAREA 16              // puntos de la muestra que comparten un recorrido de los datos
+#define SILUETA_EXACTA_MAX 50000          // en modo auto, el silhouette es exacto hasta este número de puntos
+#define MUESTRA_SILUETA 2000              // puntos muestreados por defecto en el silhouette aproximado
+#define ITER_REAGRUPAR 10                 // iteraciones de Lloyd ponderado sobre los candidatos de k-means||
+#define PUNTOS_POR_LECTURA 4096           // puntos que el mini-batch lee del archivo de una vez para copiarlos al lote
+#define MACS_BENCH_DISTANCIAS 500000000LL // productos punto-centroide·característica de cada caso del benchmark de distancias
+#define PUNTOS_BENCH_MIN 256
+#define REBALANCEO 10000                  // puntos aprendidos entre dos rebalanceos del modo servicio
+#define VENTANA_SERVICIO 50000            // puntos recientes sobre los que rebalancea
+
+// Estadísticas del K-Means mini-batch
+typedef struct {
+    int pasadas;        // pasadas completas sobre el archivo
+    int convergio;      // 0 si se agotaron las pasadas
+    long long puntos;   // puntos procesados en todas las pasadas
+    double segundos;    // sin contar la asignación final
+    int asignado;       // se hizo la pasada final de asignación
+    double inercia;     // suma de distancias al cuadrado de esa asignación
+    size_t memoria;     // bytes reservados, que solo dependen del lote, de k y de d
+} ResultadoMiniBatch;
+
+// Resultado de un k del barrido de barrido_k
+typedef struct {
+    int k;
+    Matriz centroides;             // k filas
+    int *grupos;                   // grupo de cada punto
+    ResultadoKMeans estadisticas;  // iteraciones, inercia y tiempos
+    int desde_anterior;            // partió de la solución de k-1 en lugar de inicializarse
+} SolucionKMeans;
+
+// Cómo se calcula el silhouette score en main
+typedef enum {
+    SILUETA_AUTO,       // exacto hasta SILUETA_EXACTA_MAX puntos, muestreado a partir de ahí
+    SILUETA_EXACTA,
+    SILUETA_MUESTREADA
+} ModoSilueta;
+
+// Estimación del silhouette score a partir de una muestra de puntos
+typedef struct {
+    double valor;
+    double error;           // semiamplitud del intervalo de confianza del 95%, por el teorema central del límite
+    double cota_hoeffding;  // semiamplitud que se cumple con probabilidad 0.95 sin suponer nada de la distribución
+    int muestra;            // puntos muestreados
+} EstimacionSilueta;
+
+// Sumas parciales de los centroides por bloque de puntos, cada bloque en sus propias líneas de caché
+typedef struct {
+    int bloques;
+    size_t paso;    // doubles por bloque: k·d sumas y k cuentas, redondeado a una línea de caché
+    double *sumas;
+} Acumuladores;
 
-// Función para calcular la distancia euclidiana entre dos puntos
-double calcular_distancia(double *punto1, double *punto2, int num_caracteristicas) {
-    double sum = 0;
-    for (int i = 0; i < num_caracteristicas; i++) {
-        double diff = punto1[i] - punto2[i];
-        sum += diff * diff;
+static const char *nombre_algoritmo(AlgoritmoKMeans algoritmo) {
+    switch (algoritmo) {
+        case KMEANS_LLOYD: return "lloyd";
+        case KMEANS_HAMERLY: return "hamerly";
+        case KMEANS_ELKAN: return "elkan";
+        default: return "auto";
     }
-    return sqrt(sum);
+}
+
+static const char *nombre_inicializacion(InicializacionKMeans inicializacion) {
+    switch (inicializacion) {
+        case INICIO_KMEANS_PP: return "kmeans++";
+        case INICIO_PARALELO: return "parallel";
+        default: return "first";
+    }
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Función para saber cuántos hilos usarán los bucles paralelos
+static int numero_hilos(void) {
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
 }
 
 // Función para inicializar los centroides iniciales
-void inicializar_centroides(double **datos, int num_datos, int num_caracteristicas, int k, double **centroides) {
-    for (int i = 0; i < k; i++) {
-        for (int j = 0; j < num_caracteristicas; j++) {
-            centroides[i][j] = datos[i][j];
+void inicializar_centroides(const Matriz *datos, Matriz *centroides) {
+    for (int i = 0; i < centroides->filas; i++) {
+        memcpy(fila_matriz(centroides, i), fila_matriz(datos, i), datos->columnas * sizeof(real));
+    }
+}
+
+// Función para acercar D² de cada punto a los centroides nuevos y sumar D² por bloques fijos de puntos.
+// Si cercano no es NULL, guarda el índice del centroide más cercano a cada punto: primero más su fila en nuevos.
+static void actualizar_d2(const Matriz *datos, const Matriz *nuevos, int primero, double *d2, int *cercano, double *suma_bloque) {
+    int num_datos = datos->filas;
+    int bloques = (num_datos + PUNTOS_POR_SORTEO - 1) / PUNTOS_POR_SORTEO;
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int b = 0; b < bloques; b++) {
+        int fin = (b + 1) * PUNTOS_POR_SORTEO < num_datos ? (b + 1) * PUNTOS_POR_SORTEO : num_datos;
+        double suma = 0;
+        for (int i = b * PUNTOS_POR_SORTEO; i < fin; i++) {
+            const real *punto = fila_matriz(datos, i);
+            for (int c = 0; c < nuevos->filas; c++) {
+                double dist = distancia_cuadrada(punto, fila_matriz(nuevos, c), datos->columnas);
+                if (dist < d2[i]) {
+                    d2[i] = dist;
+                    if (cercano != NULL) {
+                        cercano[i] = primero + c;
+                    }
+                }
+            }
+            suma += d2[i];
+        }
+        suma_bloque[b] = suma;
+    }
+}
+
+// Función para sumar las sumas de los bloques, siempre en el mismo orden
+static double total_d2(const double *suma_bloque, int num_datos) {
+    int bloques = (num_datos + PUNTOS_POR_SORTEO - 1) / PUNTOS_POR_SORTEO;
+    double total = 0;
+    for (int b = 0; b < bloques; b++) {
+        total += suma_bloque[b];
+    }
+    return total;
+}
+
+// Función para elegir un punto con probabilidad proporcional a su D²
+static int sortear_por_d2(const double *d2, const double *suma_bloque, int num_datos, double total, Rng *aleatorio) {
+    if (total <= 0) {
+        return (int)rng_below(aleatorio, num_datos);
+    }
+    double objetivo = rng_uniform(aleatorio) * total;
+    int bloques = (num_datos + PUNTOS_POR_SORTEO - 1) / PUNTOS_POR_SORTEO;
+    int b = 0;
+    while (b < bloques - 1 && objetivo >= suma_bloque[b]) {
+        objetivo -= suma_bloque[b];
+        b++;
+    }
+    int fin = (b + 1) * PUNTOS_POR_SORTEO < num_datos ? (b + 1) * PUNTOS_POR_SORTEO : num_datos;
+    int elegido = fin - 1;
+    for (int i = b * PUNTOS_POR_SORTEO; i < fin; i++) {
+        if (objetivo < d2[i]) {
+            elegido = i;
+            break;
         }
+        objetivo -= d2[i];
+    }
+    // El redondeo puede dejar el objetivo más allá del último punto con D² positiva
+    while (elegido > b * PUNTOS_POR_SORTEO && d2[elegido] == 0) {
+        elegido--;
     }
+    return elegido;
 }
 
-// Función para asignar cada punto al centroide más cercano
-void asignar_puntos_a_centroides(double **datos, int num_datos, int num_caracteristicas, double **centroides, int *grupos, int k) {
+// Función para inicializar los centroides con k-means++
+void inicializar_kmeans_pp(const Matriz *datos, uint64_t semilla, Matriz *centroides) {
+    int num_datos = datos->filas;
+    int k = centroides->filas;
+    Rng aleatorio;
+    rng_seed(&aleatorio, semilla, 0);
+    Arena arena;
+    iniciar_arena(&arena);
+    double *d2 = (double *)arena_reservar(&arena, num_datos * sizeof(double));
+    double *suma_bloque = (double *)arena_reservar(&arena, ((num_datos + PUNTOS_POR_SORTEO - 1) / PUNTOS_POR_SORTEO) * sizeof(double));
     for (int i = 0; i < num_datos; i++) {
-        double min_dist = DBL_MAX;
-        for (int j = 0; j < k; j++) {
-            double dist = calcular_distancia(datos[i], centroides[j], num_caracteristicas);
-            if (dist < min_dist) {
-                min_dist = dist;
-                grupos[i] = j;
-            }
+        d2[i] = DBL_MAX;
+    }
+
+    int elegido = (int)rng_below(&aleatorio, num_datos);
+    for (int c = 0; c < k; c++) {
+        memcpy(fila_matriz(centroides, c), fila_matriz(datos, elegido), datos->columnas * sizeof(real));
+        if (c == k - 1) {
+            break;
         }
+        Matriz nuevo = submatriz(centroides, c, 1);
+        actualizar_d2(datos, &nuevo, c, d2, NULL, suma_bloque);
+        elegido = sortear_por_d2(d2, suma_bloque, num_datos, total_d2(suma_bloque, num_datos), &aleatorio);
     }
+
+    liberar_arena(&arena);
 }
 
-// Función para recalcular los centroides
-void recalcular_centroides(double **datos, int num_datos, int num_caracteristicas, int *grupos, int k, double **centroides) {
-    int *counts = (int *)calloc(k, sizeof(int));
-    for (int i = 0; i < k; i++) {
-        for (int j = 0; j < num_caracteristicas; j++) {
-            centroides[i][j] = 0;
+// Función para reagrupar los candidatos de k-means|| en k centroides: k-means++ y Lloyd, ponderando cada
+// candidato por los puntos que tiene más cerca
+static void reagrupar_candidatos(const Matriz *candidatos, const double *pesos, Rng *aleatorio, Matriz *centroides) {
+    int num_candidatos = candidatos->filas;
+    int num_caracteristicas = candidatos->columnas;
+    int k = centroides->filas;
+    Arena arena;
+    iniciar_arena(&arena);
+    double *d2 = (double *)arena_reservar(&arena, num_candidatos * sizeof(double));
+    int *grupos = (int *)arena_reservar(&arena, num_candidatos * sizeof(int));
+    double *sumas = (double *)arena_reservar(&arena, (size_t)k * num_caracteristicas * sizeof(double));
+    double *counts = (double *)arena_reservar(&arena, k * sizeof(double));
+    for (int i = 0; i < num_candidatos; i++) {
+        d2[i] = DBL_MAX;
+    }
+
+    // k-means++ ponderado
+    double total = 0;
+    for (int i = 0; i < num_candidatos; i++) {
+        total += pesos[i];
+    }
+    double objetivo = rng_uniform(aleatorio) * total;
+    int elegido = num_candidatos - 1;
+    for (int i = 0; i < num_candidatos; i++) {
+        if (objetivo < pesos[i]) {
+            elegido = i;
+            break;
+        }
+        objetivo -= pesos[i];
+    }
+    for (int c = 0; c < k; c++) {
+        memcpy(fila_matriz(centroides, c), fila_matriz(candidatos, elegido), num_caracteristicas * sizeof(real));
+        total = 0;
+        for (int i = 0; i < num_candidatos; i++) {
+            double dist = distancia_cuadrada(fila_matriz(candidatos, i), fila_matriz(centroides, c), num_caracteristicas);
+            if (dist < d2[i]) {
+                d2[i] = dist;
+            }
+            total += pesos[i] * d2[i];
+        }
+        objetivo = rng_uniform(aleatorio) * total;
+        elegido = num_candidatos - 1;
+        for (int i = 0; i < num_candidatos; i++) {
+            if (objetivo < pesos[i] * d2[i]) {
+                elegido = i;
+                break;
+            }
+            objetivo -= pesos[i] * d2[i];
         }
     }
 
+    // Lloyd ponderado
+    for (int iter = 0; iter < ITER_REAGRUPAR; iter++) {
+        memset(sumas, 0, (size_t)k * num_caracteristicas * sizeof(double));
+        memset(counts, 0, k * sizeof(double));
+        for (int i = 0; i < num_candidatos; i++) {
+            const real *candidato = fila_matriz(candidatos, i);
+            double min_dist = DBL_MAX;
+            for (int c = 0; c < k; c++) {
+                double dist = distancia_cuadrada(candidato, fila_matriz(centroides, c), num_caracteristicas);
+                if (dist < min_dist) {
+                    min_dist = dist;
+                    grupos[i] = c;
+                }
+            }
+            counts[grupos[i]] += pesos[i];
+            for (int j = 0; j < num_caracteristicas; j++) {
+                sumas[(size_t)grupos[i] * num_caracteristicas + j] += pesos[i] * candidato[j];
+            }
+        }
+        for (int c = 0; c < k; c++) {
+            if (counts[c] > 0) {
+                real *centroide = fila_matriz(centroides, c);
+                for (int j = 0; j < num_caracteristicas; j++) {
+                    centroide[j] = (real)(sumas[(size_t)c * num_caracteristicas + j] / counts[c]);
+                }
+            }
+        }
+    }
+
+    liberar_arena(&arena);
+}
+
+// Función para copiar las filas `indices` de los datos en una matriz nueva de la arena
+static Matriz copiar_filas(const Matriz *datos, const int *indices, int cuantos, Arena *arena) {
+    Matriz copia = crear_matriz(arena, cuantos, datos->columnas);
+    for (int i = 0; i < cuantos; i++) {
+        memcpy(fila_matriz(&copia, i), fila_matriz(datos, indices[i]), datos->columnas * sizeof(real));
+    }
+    return copia;
+}
+
+// Función para inicializar los centroides con k-means|| (Bahmani et al.). En cada ronda, cada punto se
+// convierte en candidato con probabilidad SOBREMUESTREO·k·D²/ΣD², así que unas pocas pasadas sobre los
+// datos dan del orden de RONDAS_PARALELO·SOBREMUESTREO·k candidatos en lugar de las k pasadas de k-means++.
+// Los candidatos, con el número de puntos que tienen más cerca como peso, se reagrupan en k centroides.
+// Cada bloque de puntos sortea con su propio generador, así que el resultado no depende de los hilos.
+void inicializar_paralelo(const Matriz *datos, uint64_t semilla, Matriz *centroides) {
+    int num_datos = datos->filas;
+    int k = centroides->filas;
+    int bloques = (num_datos + PUNTOS_POR_SORTEO - 1) / PUNTOS_POR_SORTEO;
+    Arena arena;
+    iniciar_arena(&arena);
+    double *d2 = (double *)arena_reservar(&arena, num_datos * sizeof(double));
+    int *cercano = (int *)arena_reservar(&arena, num_datos * sizeof(int));
+    double *suma_bloque = (double *)arena_reservar(&arena, bloques * sizeof(double));
+    int *elegidos_bloque = (int *)arena_reservar(&arena, (size_t)bloques * sizeof(int));
+    int **lista_bloque = (int **)arena_reservar(&arena, bloques * sizeof(int *));
     for (int i = 0; i < num_datos; i++) {
-        int group = grupos[i];
-        counts[group]++;
-        for (int j = 0; j < num_caracteristicas; j++) {
-            centroides[group][j] += datos[i][j];
+        d2[i] = DBL_MAX;
+    }
+    memset(lista_bloque, 0, bloques * sizeof(int *));
+
+    // Los candidatos se guardan como índices de fila; los de cada ronda se copian juntos para medirlos
+    int capacidad = 1 + RONDAS_PARALELO * SOBREMUESTREO * k * 2;
+    int num_candidatos = 0;
+    int *candidatos = (int *)malloc(capacidad * sizeof(int));
+
+    Rng aleatorio;
+    rng_seed(&aleatorio, semilla, 0);
+    candidatos[num_candidatos++] = (int)rng_below(&aleatorio, num_datos);
+    Matriz nuevos = copiar_filas(datos, candidatos, 1, &arena);
+    actualizar_d2(datos, &nuevos, 0, d2, cercano, suma_bloque);
+
+    double esperados = (double)SOBREMUESTREO * k;
+    for (int ronda = 1; ronda <= RONDAS_PARALELO; ronda++) {
+        double total = total_d2(suma_bloque, num_datos);
+        if (total <= 0) {
+            break;
+        }
+#pragma omp parallel for schedule(dynamic, 1)
+        for (int b = 0; b < bloques; b++) {
+            Rng propio;
+            rng_seed(&propio, semilla, (uint64_t)ronda * bloques + b + 1);
+            int fin = (b + 1) * PUNTOS_POR_SORTEO < num_datos ? (b + 1) * PUNTOS_POR_SORTEO : num_datos;
+            int cuenta = 0, cap = 0;
+            int *lista = NULL;
+            for (int i = b * PUNTOS_POR_SORTEO; i < fin; i++) {
+                if (rng_uniform(&propio) < esperados * d2[i] / total) {
+                    if (cuenta == cap) {
+                        cap = cap ? 2 * cap : 8;
+                        lista = (int *)realloc(lista, cap * sizeof(int));
+                    }
+                    lista[cuenta++] = i;
+                }
+            }
+            elegidos_bloque[b] = cuenta;
+            lista_bloque[b] = lista;
+        }
+
+        // Los nuevos candidatos se juntan en orden de bloque
+        int primero = num_candidatos;
+        for (int b = 0; b < bloques; b++) {
+            for (int e = 0; e < elegidos_bloque[b]; e++) {
+                if (num_candidatos == capacidad) {
+                    capacidad *= 2;
+                    candidatos = (int *)realloc(candidatos, capacidad * sizeof(int));
+                }
+                candidatos[num_candidatos++] = lista_bloque[b][e];
+            }
+            free(lista_bloque[b]);
+            lista_bloque[b] = NULL;
         }
+        nuevos = copiar_filas(datos, candidatos + primero, num_candidatos - primero, &arena);
+        actualizar_d2(datos, &nuevos, primero, d2, cercano, suma_bloque);
     }
 
+    if (num_candidatos <= k) {
+        // Muy pocos puntos distintos para sobremuestrear: basta con k-means++
+        inicializar_kmeans_pp(datos, semilla, centroides);
+    } else {
+        double *pesos = (double *)arena_reservar(&arena, num_candidatos * sizeof(double));
+        memset(pesos, 0, num_candidatos * sizeof(double));
+        for (int i = 0; i < num_datos; i++) {
+            pesos[cercano[i]]++;
+        }
+        Matriz todos = copiar_filas(datos, candidatos, num_candidatos, &arena);
+        reagrupar_candidatos(&todos, pesos, &aleatorio, centroides);
+    }
+
+    free(candidatos);
+    liberar_arena(&arena);
+}
+
+// Función para elegir los centroides iniciales según la inicialización pedida
+void elegir_centroides_iniciales(const Matriz *datos, InicializacionKMeans inicializacion, uint64_t semilla, Matriz *centroides) {
+    if (inicializacion == INICIO_KMEANS_PP) {
+        inicializar_kmeans_pp(datos, semilla, centroides);
+    } else if (inicializacion == INICIO_PARALELO) {
+        inicializar_paralelo(datos, semilla, centroides);
+    } else {
+        inicializar_centroides(datos, centroides);
+    }
+}
+
+// Función para calcular la inercia: la suma de las distancias al cuadrado de cada punto a su centroide
+double calcular_inercia(const Matriz *datos, const Matriz *centroides, const int *grupos) {
+    int num_datos = datos->filas;
+    int bloques = (num_datos + PUNTOS_POR_SORTEO - 1) / PUNTOS_POR_SORTEO;
+    double *suma_bloque = (double *)malloc(bloques * sizeof(double));
+#pragma omp parallel for schedule(static)
+    for (int b = 0; b < bloques; b++) {
+        int fin = (b + 1) * PUNTOS_POR_SORTEO < num_datos ? (b + 1) * PUNTOS_POR_SORTEO : num_datos;
+        double suma = 0;
+        for (int i = b * PUNTOS_POR_SORTEO; i < fin; i++) {
+            suma += distancia_cuadrada(fila_matriz(datos, i), fila_matriz(centroides, grupos[i]), datos->columnas);
+        }
+        suma_bloque[b] = suma;
+    }
+    double inercia = total_d2(suma_bloque, num_datos);
+    free(suma_bloque);
+    return inercia;
+}
+
+// Función para crear las sumas parciales de los centroides. Los puntos se reparten en bloques fijos que solo
+// dependen de n, k y d; cada hilo suma sus bloques sin locks y los bloques se reducen siempre en el mismo
+// orden, así que los centroides salen idénticos bit a bit con cualquier número de hilos.
+Acumuladores crear_acumuladores(int num_datos, int num_caracteristicas, int k, Arena *arena) {
+    Acumuladores acumuladores;
+    size_t paso = (size_t)k * num_caracteristicas + k;
+    paso = (paso + LINEA_CACHE / sizeof(double) - 1) / (LINEA_CACHE / sizeof(double)) * (LINEA_CACHE / sizeof(double));
+    int bloques = (num_datos + PUNTOS_POR_BLOQUE - 1) / PUNTOS_POR_BLOQUE;
+    if (bloques > BLOQUES_SUMA) {
+        bloques = BLOQUES_SUMA;
+    }
+    while (bloques > 1 && bloques * paso * sizeof(double) > MEMORIA_ACUMULADORES) {
+        bloques /= 2;
+    }
+    if (bloques < 1) {
+        bloques = 1;
+    }
+    acumuladores.bloques = bloques;
+    acumuladores.paso = paso;
+    acumuladores.sumas = (double *)arena_reservar(arena, bloques * paso * sizeof(double));
+    return acumuladores;
+}
+
+// Función para sumar los puntos de cada grupo. Al terminar, el primer bloque de los acumuladores tiene las
+// k·d sumas seguidas de las k cuentas; los demás bloques se suman a él siempre en el mismo orden.
+void acumular_grupos(const Matriz *datos, const int *grupos, int k, Acumuladores *acumuladores) {
+    int num_datos = datos->filas;
+    int num_caracteristicas = datos->columnas;
+    int bloques = acumuladores->bloques;
+    size_t paso = acumuladores->paso;
+    size_t total = (size_t)k * num_caracteristicas + k;
+
+    // Cada bloque suma sus puntos en su propia zona
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int b = 0; b < bloques; b++) {
+        double *sumas = acumuladores->sumas + b * paso;
+        double *counts = sumas + (size_t)k * num_caracteristicas;
+        memset(sumas, 0, paso * sizeof(double));
+        int fin = (int)((long long)num_datos * (b + 1) / bloques);
+        for (int i = (int)((long long)num_datos * b / bloques); i < fin; i++) {
+            const real *punto = fila_matriz(datos, i);
+            double *suma = sumas + (size_t)grupos[i] * num_caracteristicas;
+            counts[grupos[i]]++;
+            for (int j = 0; j < num_caracteristicas; j++) {
+                suma[j] += punto[j];
+            }
+        }
+    }
+
+#pragma omp parallel for schedule(static)
+    for (long long e = 0; e < (long long)total; e++) {
+        double suma = acumuladores->sumas[e];
+        for (int b = 1; b < bloques; b++) {
+            suma += acumuladores->sumas[b * paso + e];
+        }
+        acumuladores->sumas[e] = suma;
+    }
+}
+
+// Función para recalcular los centroides. Un grupo vacío conserva su centroide.
+// Deja en desplazamiento[j] la distancia que se movió el centroide j y devuelve la mayor.
+double recalcular_centroides(const Matriz *datos, const int *grupos, Matriz *centroides, double *desplazamiento, Acumuladores *acumuladores) {
+    int k = centroides->filas;
+    int num_caracteristicas = datos->columnas;
+    acumular_grupos(datos, grupos, k, acumuladores);
+    double *counts = acumuladores->sumas + (size_t)k * num_caracteristicas;
+
+    double max_desplazamiento = 0;
+#pragma omp parallel for schedule(static) reduction(max:max_desplazamiento)
     for (int i = 0; i < k; i++) {
+        double *suma = acumuladores->sumas + (size_t)i * num_caracteristicas;
+        real *centroide = fila_matriz(centroides, i);
+        desplazamiento[i] = 0;
+        if (counts[i] == 0) {
+            continue;
+        }
+        // El desplazamiento se mide con el valor ya guardado, para que las cotas de Hamerly y Elkan sigan
+        // siendo válidas también con floats
+        double movimiento = 0;
         for (int j = 0; j < num_caracteristicas; j++) {
-            centroides[i][j] /= counts[i];
+            real nuevo = (real)(suma[j] / counts[i]);
+            double diff = (double)nuevo - centroide[j];
+            movimiento += diff * diff;
+            centroide[j] = nuevo;
+        }
+        desplazamiento[i] = sqrt(movimiento);
+        if (desplazamiento[i] > max_desplazamiento) {
+            max_desplazamiento = desplazamiento[i];
         }
     }
+    return max_desplazamiento;
+}
 
-    free(counts);
+// Función para encontrar el centroide más cercano a un punto y las dos menores distancias
+static void dos_mas_cercanos(const real *punto, const Matriz *centroides, int *mejor, double *primera, double *segunda) {
+    *mejor = 0;
+    *primera = DBL_MAX;
+    *segunda = DBL_MAX;
+    for (int j = 0; j < centroides->filas; j++) {
+        double dist = calcular_distancia(punto, fila_matriz(centroides, j), centroides->columnas);
+        if (dist < *primera) {
+            *segunda = *primera;
+            *primera = dist;
+            *mejor = j;
+        } else if (dist < *segunda) {
+            *segunda = dist;
+        }
+    }
 }
 
-// Función para calcular la distancia promedio a todos los puntos en el mismo grupo
-double average_distance(double **datos, int *grupos, int num_datos, int num_caracteristicas, int index, int cluster) {
-    double sum = 0;
-    int count = 0;
+// Función para calcular la mitad de la distancia de cada centroide a su vecino más cercano: un punto que
+// está más cerca de su centroide que esa mitad no puede estar más cerca de ningún otro.
+// Si entre_centroides no es NULL guarda también la matriz k×k de medias distancias.
+static void separacion_centroides(const Matriz *centroides, double *mitad_vecino, double *entre_centroides) {
+    int k = centroides->filas;
+    for (int j = 0; j < k; j++) {
+        mitad_vecino[j] = DBL_MAX;
+    }
+    for (int j = 0; j < k; j++) {
+        if (entre_centroides != NULL) {
+            entre_centroides[(size_t)j * k + j] = 0;
+        }
+        for (int l = j + 1; l < k; l++) {
+            double mitad = 0.5 * calcular_distancia(fila_matriz(centroides, j), fila_matriz(centroides, l), centroides->columnas);
+            if (entre_centroides != NULL) {
+                entre_centroides[(size_t)j * k + l] = mitad;
+                entre_centroides[(size_t)l * k + j] = mitad;
+            }
+            if (mitad < mitad_vecino[j]) {
+                mitad_vecino[j] = mitad;
+            }
+            if (mitad < mitad_vecino[l]) {
+                mitad_vecino[l] = mitad;
+            }
+        }
+    }
+}
+
+// K-Means de Lloyd: referencia, calcula todas las distancias en cada iteración
+static void lloyd(const Matriz *datos, double tolerancia, ModoAsignacion asignacion, Matriz *centroides, int *grupos, ResultadoKMeans *resultado) {
+    int num_datos = datos->filas;
+    int k = centroides->filas;
+    Arena arena;
+    iniciar_arena(&arena);
+    double *desplazamiento = (double *)arena_reservar(&arena, k * sizeof(double));
+    Acumuladores acumuladores = crear_acumuladores(num_datos, datos->columnas, k, &arena);
     for (int i = 0; i < num_datos; i++) {
-        if (grupos[i] == cluster) {
-            sum += calcular_distancia(datos[index], datos[i], num_caracteristicas);
-            count++;
+        grupos[i] = -1;
+    }
+    asignar_puntos_a_centroides(datos, centroides, grupos, asignacion);
+    resultado->iteraciones = 1;
+    resultado->distancias = (long long)num_datos * k;
+
+    while (resultado->iteraciones < MAX_ITER) {
+        if (recalcular_centroides(datos, grupos, centroides, desplazamiento, &acumuladores) <= tolerancia) {
+            resultado->convergio = 1;
+            break;
+        }
+        int cambios = asignar_puntos_a_centroides(datos, centroides, grupos, asignacion);
+        resultado->iteraciones++;
+        resultado->distancias += (long long)num_datos * k;
+        if (cambios == 0) {
+            resultado->convergio = 1;
+            break;
         }
     }
-    return sum / count;
+    liberar_arena(&arena);
 }
 
-// Función para calcular el silhouette score
-double silhouette_score(double **datos, int *grupos, int num_datos, int num_caracteristicas, int k) {
-    double* a = malloc(num_datos * sizeof(double));
-    double* b = malloc(num_datos * sizeof(double));
+// K-Means de Hamerly. Cada punto guarda una cota superior de la distancia a su centroide y una inferior
+// de la distancia a cualquier otro; tras mover los centroides, las cotas se corrigen con su desplazamiento
+// y el punto solo se revisa si la superior deja de ser menor que la inferior.
+static void hamerly(const Matriz *datos, double tolerancia, Matriz *centroides, int *grupos, ResultadoKMeans *resultado) {
+    int num_datos = datos->filas;
+    int num_caracteristicas = datos->columnas;
+    int k = centroides->filas;
+    Arena arena;
+    iniciar_arena(&arena);
+    double *superior = (double *)arena_reservar(&arena, num_datos * sizeof(double));
+    double *inferior = (double *)arena_reservar(&arena, num_datos * sizeof(double));
+    double *desplazamiento = (double *)arena_reservar(&arena, k * sizeof(double));
+    double *mitad_vecino = (double *)arena_reservar(&arena, k * sizeof(double));
+    Acumuladores acumuladores = crear_acumuladores(num_datos, num_caracteristicas, k, &arena);
+
+#pragma omp parallel for schedule(static)
     for (int i = 0; i < num_datos; i++) {
-        a[i] = average_distance(datos, grupos, num_datos, num_caracteristicas, i, grupos[i]);
-        double min_average_distance = DBL_MAX;
+        dos_mas_cercanos(fila_matriz(datos, i), centroides, &grupos[i], &superior[i], &inferior[i]);
+    }
+    resultado->iteraciones = 1;
+    resultado->distancias = (long long)num_datos * k;
+
+    while (resultado->iteraciones < MAX_ITER) {
+        if (recalcular_centroides(datos, grupos, centroides, desplazamiento, &acumuladores) <= tolerancia) {
+            resultado->convergio = 1;
+            break;
+        }
+
+        // La cota inferior baja lo que se movió el centroide ajeno que más se movió
+        int mas_movido = 0;
+        double mayor = 0, segundo = 0;
         for (int j = 0; j < k; j++) {
-            if (j != grupos[i]) {
-                double average_distance_to_cluster = average_distance(datos, grupos, num_datos, num_caracteristicas, i, j);
-                if (average_distance_to_cluster < min_average_distance) {
-                    min_average_distance = average_distance_to_cluster;
+            if (desplazamiento[j] > mayor) {
+                segundo = mayor;
+                mayor = desplazamiento[j];
+                mas_movido = j;
+            } else if (desplazamiento[j] > segundo) {
+                segundo = desplazamiento[j];
+            }
+        }
+        separacion_centroides(centroides, mitad_vecino, NULL);
+
+        // Cada punto solo toca sus propias cotas: el reparto entre hilos no cambia el resultado
+        int cambios = 0;
+        long long distancias = 0;
+#pragma omp parallel for schedule(dynamic, PUNTOS_POR_TAREA) reduction(+:cambios, distancias)
+        for (int i = 0; i < num_datos; i++) {
+            int grupo = grupos[i];
+            superior[i] += desplazamiento[grupo];
+            inferior[i] -= grupo == mas_movido ? segundo : mayor;
+
+            double limite = inferior[i] > mitad_vecino[grupo] ? inferior[i] : mitad_vecino[grupo];
+            if (superior[i] <= limite) {
+                continue;
+            }
+            // Ajusta la cota superior con la distancia real antes de revisar todos los centroides
+            const real *punto = fila_matriz(datos, i);
+            superior[i] = calcular_distancia(punto, fila_matriz(centroides, grupo), num_caracteristicas);
+            distancias++;
+            if (superior[i] <= limite) {
+                continue;
+            }
+            dos_mas_cercanos(punto, centroides, &grupos[i], &superior[i], &inferior[i]);
+            distancias += k;
+            if (grupos[i] != grupo) {
+                cambios++;
+            }
+        }
+        resultado->distancias += distancias;
+        resultado->iteraciones++;
+        if (cambios == 0) {
+            resultado->convergio = 1;
+            break;
+        }
+    }
+
+    liberar_arena(&arena);
+}
+
+// K-Means de Elkan. Cada punto guarda una cota inferior por centroide, y las distancias entre centroides
+// descartan además los que están demasiado lejos del centroide actual; compensa con k grande.
+static void elkan(const Matriz *datos, double tolerancia, Matriz *centroides, int *grupos, ResultadoKMeans *resultado) {
+    int num_datos = datos->filas;
+    int num_caracteristicas = datos->columnas;
+    int k = centroides->filas;
+    Arena arena;
+    iniciar_arena(&arena);
+    double *superior = (double *)arena_reservar(&arena, num_datos * sizeof(double));
+    double *inferior = (double *)arena_reservar(&arena, (size_t)num_datos * k * sizeof(double));
+    double *desplazamiento = (double *)arena_reservar(&arena, k * sizeof(double));
+    double *mitad_vecino = (double *)arena_reservar(&arena, k * sizeof(double));
+    double *entre_centroides = (double *)arena_reservar(&arena, (size_t)k * k * sizeof(double));
+    Acumuladores acumuladores = crear_acumuladores(num_datos, num_caracteristicas, k, &arena);
+
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < num_datos; i++) {
+        const real *punto = fila_matriz(datos, i);
+        double *cotas = inferior + (size_t)i * k;
+        grupos[i] = 0;
+        superior[i] = DBL_MAX;
+        for (int j = 0; j < k; j++) {
+            cotas[j] = calcular_distancia(punto, fila_matriz(centroides, j), num_caracteristicas);
+            if (cotas[j] < superior[i]) {
+                superior[i] = cotas[j];
+                grupos[i] = j;
+            }
+        }
+    }
+    resultado->iteraciones = 1;
+    resultado->distancias = (long long)num_datos * k;
+
+    while (resultado->iteraciones < MAX_ITER) {
+        if (recalcular_centroides(datos, grupos, centroides, desplazamiento, &acumuladores) <= tolerancia) {
+            resultado->convergio = 1;
+            break;
+        }
+        separacion_centroides(centroides, mitad_vecino, entre_centroides);
+
+        int cambios = 0;
+        long long distancias = 0;
+#pragma omp parallel for schedule(dynamic, PUNTOS_POR_TAREA) reduction(+:cambios, distancias)
+        for (int i = 0; i < num_datos; i++) {
+            const real *punto = fila_matriz(datos, i);
+            double *cotas = inferior + (size_t)i * k;
+            int grupo = grupos[i];
+            for (int j = 0; j < k; j++) {
+                cotas[j] = cotas[j] > desplazamiento[j] ? cotas[j] - desplazamiento[j] : 0;
+            }
+            superior[i] += desplazamiento[grupo];
+            if (superior[i] <= mitad_vecino[grupo]) {
+                continue;
+            }
+
+            int exacta = 0;  // superior[i] es la distancia real al centroide actual
+            int actual = grupo;
+            for (int j = 0; j < k; j++) {
+                if (j == actual || superior[i] <= cotas[j] || superior[i] <= entre_centroides[(size_t)actual * k + j]) {
+                    continue;
+                }
+                if (!exacta) {
+                    superior[i] = calcular_distancia(punto, fila_matriz(centroides, actual), num_caracteristicas);
+                    cotas[actual] = superior[i];
+                    distancias++;
+                    exacta = 1;
+                    if (superior[i] <= cotas[j] || superior[i] <= entre_centroides[(size_t)actual * k + j]) {
+                        continue;
+                    }
+                }
+                cotas[j] = calcular_distancia(punto, fila_matriz(centroides, j), num_caracteristicas);
+                distancias++;
+                if (cotas[j] < superior[i]) {
+                    superior[i] = cotas[j];
+                    actual = j;
+                }
+            }
+            if (actual != grupo) {
+                grupos[i] = actual;
+                cambios++;
+            }
+        }
+        resultado->distancias += distancias;
+        resultado->iteraciones++;
+        if (cambios == 0) {
+            resultado->convergio = 1;
+            break;
+        }
+    }
+
+    liberar_arena(&arena);
+}
+
+// Función para calcular la silueta de un punto a partir de la suma de sus distancias a los puntos de cada
+// grupo: a es la distancia media a los demás puntos de su grupo y b la menor distancia media a otro grupo.
+// Un punto solo en su grupo, o sin otro grupo con puntos, tiene silueta 0.
+static double silueta_punto(const double *sumas, const int *counts, int grupo, int k) {
+    if (counts[grupo] <= 1) {
+        return 0;
+    }
+    double a = sumas[grupo] / (counts[grupo] - 1);
+    double b = DBL_MAX;
+    for (int c = 0; c < k; c++) {
+        if (c != grupo && counts[c] > 0 && sumas[c] / counts[c] < b) {
+            b = sumas[c] / counts[c];
+        }
+    }
+    if (b == DBL_MAX) {
+        return 0;
+    }
+    double mayor = a > b ? a : b;
+    return mayor > 0 ? (b - a) / mayor : 0;
+}
+
+// Función para contar los puntos de cada grupo; devuelve cuántos tienen un grupo válido (de 0 a k-1)
+static int contar_grupos(const int *grupos, int num_datos, int k, int *counts) {
+    int validos = 0;
+    memset(counts, 0, k * sizeof(int));
+    for (int i = 0; i < num_datos; i++) {
+        if (grupos[i] >= 0 && grupos[i] < k) {
+            counts[grupos[i]]++;
+            validos++;
+        }
+    }
+    return validos;
+}
+
+// Función para calcular el silhouette score exacto: la media de la silueta de todos los puntos.
+// Los puntos sin un grupo válido no cuentan. Los demás se copian seguidos y ordenados por grupo, y cada par
+// se mide una sola vez, por bloques de BLOQUE_SILUETA x BLOQUE_SILUETA puntos: la distancia se suma a la
+// tabla n×k del primero con el grupo del segundo, y a la del segundo con el grupo del primero. Como los
+// puntos de un grupo van seguidos, la fila de un punto suma en un registro cada tramo de un mismo grupo.
+// Los bloques se recorren por diagonales: en la diagonal o, el bloque de filas I se cruza con el de columnas
+// I+o, así que dentro de una diagonal cada bloque escribe una sola vez como fila (en `filas`) y una como
+// columna (en `columnas`), sin carreras entre hilos y siempre en el mismo orden.
+double silhouette_score(const Matriz *datos, const int *grupos, int k) {
+    int num_datos = datos->filas;
+    int d = datos->columnas;
+    Arena arena;
+    iniciar_arena(&arena);
+    int *counts = (int *)arena_reservar(&arena, k * sizeof(int));
+    int *inicio_grupo = (int *)arena_reservar(&arena, (k + 1) * sizeof(int));
+    int validos = contar_grupos(grupos, num_datos, k, counts);
+    int bloques = (validos + BLOQUE_SILUETA - 1) / BLOQUE_SILUETA;
+
+    // Ordenación por cuentas: los puntos de cada grupo, en su orden original
+    Matriz puntos = crear_matriz(&arena, validos, d);
+    int *grupo_de = (int *)arena_reservar(&arena, validos * sizeof(int));
+    inicio_grupo[0] = 0;
+    for (int c = 0; c < k; c++) {
+        inicio_grupo[c + 1] = inicio_grupo[c] + counts[c];
+    }
+    int *siguiente = (int *)arena_reservar(&arena, k * sizeof(int));
+    memcpy(siguiente, inicio_grupo, k * sizeof(int));
+    for (int i = 0; i < num_datos; i++) {
+        if (grupos[i] >= 0 && grupos[i] < k) {
+            int p = siguiente[grupos[i]]++;
+            memcpy(fila_matriz(&puntos, p), fila_matriz(datos, i), d * sizeof(real));
+            grupo_de[p] = grupos[i];
+        }
+    }
+
+    double *filas = (double *)arena_reservar(&arena, (size_t)validos * k * sizeof(double));
+    double *columnas = (double *)arena_reservar(&arena, (size_t)validos * k * sizeof(double));
+    double *suma_bloque = (double *)arena_reservar(&arena, bloques * sizeof(double));
+    memset(filas, 0, (size_t)validos * k * sizeof(double));
+    memset(columnas, 0, (size_t)validos * k * sizeof(double));
+
+#pragma omp parallel
+    for (int o = 0; o < bloques; o++) {
+#pragma omp for schedule(dynamic, 1)
+        for (int bloque = 0; bloque < bloques - o; bloque++) {
+            int fin_i = (bloque + 1) * BLOQUE_SILUETA < validos ? (bloque + 1) * BLOQUE_SILUETA : validos;
+            int inicio_j = (bloque + o) * BLOQUE_SILUETA;
+            int fin_j = inicio_j + BLOQUE_SILUETA < validos ? inicio_j + BLOQUE_SILUETA : validos;
+            for (int i = bloque * BLOQUE_SILUETA; i < fin_i; i++) {
+                const real *punto = fila_matriz(&puntos, i);
+                int gi = grupo_de[i];
+                int j = o == 0 ? i + 1 : inicio_j;
+                while (j < fin_j) {
+                    int c = grupo_de[j];
+                    int fin_tramo = inicio_grupo[c + 1] < fin_j ? inicio_grupo[c + 1] : fin_j;
+                    double tramo = 0;
+                    for (; j < fin_tramo; j++) {
+                        double dist = calcular_distancia(punto, fila_matriz(&puntos, j), d);
+                        tramo += dist;
+                        columnas[(size_t)j * k + gi] += dist;
+                    }
+                    filas[(size_t)i * k + c] += tramo;
                 }
             }
         }
-        b[i] = min_average_distance;
+    }
+
+#pragma omp parallel for schedule(static)
+    for (int bloque = 0; bloque < bloques; bloque++) {
+        int fin = (bloque + 1) * BLOQUE_SILUETA < validos ? (bloque + 1) * BLOQUE_SILUETA : validos;
+        double suma = 0;
+        for (int i = bloque * BLOQUE_SILUETA; i < fin; i++) {
+            double *fila = filas + (size_t)i * k;
+            for (int c = 0; c < k; c++) {
+                fila[c] += columnas[(size_t)i * k + c];
+            }
+            suma += silueta_punto(fila, counts, grupo_de[i], k);
+        }
+        suma_bloque[bloque] = suma;
     }
     double silhouette_sum = 0;
+    for (int bloque = 0; bloque < bloques; bloque++) {
+        silhouette_sum += suma_bloque[bloque];
+    }
+
+    liberar_arena(&arena);
+    return validos > 0 ? silhouette_sum / validos : 0;
+}
+
+// Función para estimar el silhouette score con la silueta exacta de una muestra de puntos elegidos al azar,
+// sin repetición: cuesta muestra·n distancias en lugar de n²/2. La silueta de cada punto está entre -1 y 1,
+// así que, además del intervalo del 95% por el teorema central del límite, la desigualdad de Hoeffding da
+// una cota que se cumple con probabilidad 0.95 sea cual sea la distribución de las siluetas.
+EstimacionSilueta silhouette_sampled(const Matriz *datos, const int *grupos, int k, int muestra, uint64_t semilla) {
+    EstimacionSilueta estimacion = {0};
+    int num_datos = datos->filas;
+    Arena arena;
+    iniciar_arena(&arena);
+    int *counts = (int *)arena_reservar(&arena, k * sizeof(int));
+    contar_grupos(grupos, num_datos, k, counts);
+
+    // Muestreo por selección (Knuth, algoritmo S) entre los puntos con grupo: los índices salen ordenados
+    int *elegidos = (int *)arena_reservar(&arena, (muestra > 0 ? muestra : 1) * sizeof(int));
+    int validos = 0, vistos = 0, tomados = 0;
     for (int i = 0; i < num_datos; i++) {
-        silhouette_sum += (b[i] - a[i]) / (a[i] > b[i] ? a[i] : b[i]);
+        validos += grupos[i] >= 0 && grupos[i] < k;
+    }
+    Rng aleatorio;
+    rng_seed(&aleatorio, semilla, 0);
+    for (int i = 0; i < num_datos && tomados < muestra; i++) {
+        if (grupos[i] < 0 || grupos[i] >= k) {
+            continue;
+        }
+        if ((validos - vistos) * rng_uniform(&aleatorio) < muestra - tomados) {
+            elegidos[tomados++] = i;
+        }
+        vistos++;
     }
-    free(a);
-    free(b);
-    return silhouette_sum / num_datos;
+
+    // Cada tarea toma MUESTRA_POR_TAREA puntos de la muestra y recorre los datos una vez para todos ellos
+    double *sumas = (double *)arena_reservar(&arena, (size_t)tomados * k * sizeof(double));
+    double *siluetas = (double *)arena_reservar(&arena, tomados * sizeof(double));
+    memset(sumas, 0, (size_t)tomados * k * sizeof(double));
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int inicio = 0; inicio < tomados; inicio += MUESTRA_POR_TAREA) {
+        int fin = inicio + MUESTRA_POR_TAREA < tomados ? inicio + MUESTRA_POR_TAREA : tomados;
+        for (int j = 0; j < num_datos; j++) {
+            int gj = grupos[j];
+            if (gj < 0 || gj >= k) {
+                continue;
+            }
+            for (int m = inicio; m < fin; m++) {
+                sumas[(size_t)m * k + gj] += calcular_distancia(fila_matriz(datos, elegidos[m]), fila_matriz(datos, j), datos->columnas);
+            }
+        }
+        for (int m = inicio; m < fin; m++) {
+            siluetas[m] = silueta_punto(sumas + (size_t)m * k, counts, grupos[elegidos[m]], k);
+        }
+    }
+
+    double suma = 0, suma_cuadrados = 0;
+    for (int m = 0; m < tomados; m++) {
+        suma += siluetas[m];
+    }
+    estimacion.muestra = tomados;
+    if (tomados > 0) {
+        estimacion.valor = suma / tomados;
+        for (int m = 0; m < tomados; m++) {
+            suma_cuadrados += (siluetas[m] - estimacion.valor) * (siluetas[m] - estimacion.valor);
+        }
+        // Con toda la población muestreada el valor es exacto
+        double correccion = validos > 1 ? (double)(validos - tomados) / (validos - 1) : 0;
+        double varianza = tomados > 1 ? suma_cuadrados / (tomados - 1) : 0;
+        estimacion.error = 1.96 * sqrt(varianza / tomados * correccion);
+        estimacion.cota_hoeffding = tomados < validos ? sqrt(2.0 * log(2.0 / 0.05) / tomados) : 0;
+    }
+
+    liberar_arena(&arena);
+    return estimacion;
 }
 
-// Función principal del algoritmo K-Means
-void k_means(double **datos, int num_datos, int num_caracteristicas, int k) {
-    // Inicializa los centroides iniciales
-    double **centroides = (double **)malloc(k * sizeof(double *));
-    for (int i = 0; i < k; ++i) {
-        centroides[i] = (double *)malloc(num_caracteristicas * sizeof(double));
+// Función para iterar desde los centroides que ya hay en centroides hasta converger
+static void refinar_k_means(const Matriz *datos, const OpcionesKMeans *opciones, Matriz *centroides, int *grupos, ResultadoKMeans *resultado) {
+    int k = centroides->filas;
+    AlgoritmoKMeans algoritmo = opciones->algoritmo;
+    if (algoritmo == KMEANS_AUTO) {
+        algoritmo = k >= ELKAN_K_MIN && datos->columnas >= ELKAN_D_MIN ? KMEANS_ELKAN : KMEANS_HAMERLY;
     }
-    inicializar_centroides(datos, num_datos, num_caracteristicas, k, centroides);
+    resultado->algoritmo = algoritmo;
 
-    // Inicializa el arreglo de grupos
-    int *grupos = (int *)malloc(num_datos * sizeof(int));
+    if (algoritmo == KMEANS_ELKAN) {
+        elkan(datos, opciones->tolerancia, centroides, grupos, resultado);
+    } else if (algoritmo == KMEANS_HAMERLY) {
+        hamerly(datos, opciones->tolerancia, centroides, grupos, resultado);
+    } else {
+        lloyd(datos, opciones->tolerancia, opciones->asignacion, centroides, grupos, resultado);
+    }
+    resultado->distancias_lloyd = (long long)datos->filas * k * resultado->iteraciones;
+    resultado->inercia = calcular_inercia(datos, centroides, grupos);
+}
 
-    // Repite hasta convergencia
-    for (int iter = 0; iter < MAX_ITER; iter++) {
-        // Asigna puntos a centroides
-        asignar_puntos_a_centroides(datos, num_datos, num_caracteristicas, centroides, grupos, k);
+// Función para hacer una ejecución completa desde los centroides iniciales de una semilla
+static ResultadoKMeans ejecutar_k_means(const Matriz *datos, const OpcionesKMeans *opciones, uint64_t semilla, Matriz *centroides, int *grupos) {
+    ResultadoKMeans resultado = {0};
+    double start = now_seconds();
+    elegir_centroides_iniciales(datos, opciones->inicializacion, semilla, centroides);
+    resultado.segundos_inicio = now_seconds() - start;
+    refinar_k_means(datos, opciones, centroides, grupos, &resultado);
+    return resultado;
+}
 
-        // Recalcula centroides
-        recalcular_centroides(datos, num_datos, num_caracteristicas, grupos, k, centroides);
+// Función principal del algoritmo K-Means. Itera hasta que ningún punto cambia de grupo, ningún centroide
+// se mueve más que la tolerancia o se llega a MAX_ITER. Agrupa en tantos grupos como filas tiene centroides:
+// deja en ellas los centroides y en grupos el grupo de cada punto, y devuelve las estadísticas de la ejecución.
+// Con varios reinicios, cada uno parte de otra semilla y se ejecutan a la vez, uno por hilo (sus bucles
+// internos pasan entonces a ser secuenciales); se queda el de menor inercia, y ante un empate el primero.
+ResultadoKMeans k_means(const Matriz *datos, const OpcionesKMeans *opciones, Matriz *centroides, int *grupos) {
+    int reinicios = opciones->reinicios > 1 ? opciones->reinicios : 1;
+    ResultadoKMeans mejor = {0};
+    mejor.reinicio = -1;
+    double start = now_seconds();
+    if (reinicios == 1) {
+        mejor = ejecutar_k_means(datos, opciones, opciones->semilla, centroides, grupos);
+        mejor.segundos = now_seconds() - start;
+        return mejor;
     }
 
-    // Liberar memoria
-    for (int i = 0; i < k; ++i) {
-        free(centroides[i]);
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int r = 0; r < reinicios; r++) {
+        // Cada reinicio trabaja en su propia arena
+        Arena arena;
+        iniciar_arena(&arena);
+        Matriz propios = crear_matriz(&arena, centroides->filas, centroides->columnas);
+        int *grupos_propios = (int *)arena_reservar(&arena, datos->filas * sizeof(int));
+        uint64_t semilla = opciones->semilla + (uint64_t)r * 0x9E3779B97F4A7C15ull;
+
+        ResultadoKMeans resultado = ejecutar_k_means(datos, opciones, semilla, &propios, grupos_propios);
+        resultado.reinicio = r;
+#pragma omp critical(mejor_reinicio)
+        {
+            if (mejor.reinicio < 0 || resultado.inercia < mejor.inercia || (resultado.inercia == mejor.inercia && r < mejor.reinicio)) {
+                mejor = resultado;
+                copiar_matriz(centroides, &propios);
+                memcpy(grupos, grupos_propios, datos->filas * sizeof(int));
+            }
+        }
+        liberar_arena(&arena);
     }
-    free(centroides);
-    free(grupos);
+    mejor.segundos = now_seconds() - start;
+    return mejor;
 }
 
-// Función para leer los datos del archivo iris.data
-double **leer_datos(char *filename, int *num_datos, int *num_caracteristicas) {
-    FILE *file = fopen(filename, "r");
-    if (!file) {
-        printf("No se pudo abrir el archivo %s\n", filename);
-        exit(1);
+// Función para sacar k+1 centroides de una solución con k: el grupo con mayor suma de distancias al
+// cuadrado se parte en dos, desplazando su centroide una desviación típica a cada lado a lo largo de la
+// característica en la que más varían sus puntos. Los demás centroides se conservan.
+static void dividir_grupo(const Matriz *datos, const Matriz *centroides, const int *grupos, Matriz *nuevos) {
+    int k = centroides->filas;
+    int num_caracteristicas = datos->columnas;
+    Arena arena;
+    iniciar_arena(&arena);
+    double *error = (double *)arena_reservar(&arena, k * sizeof(double));
+    double *varianza = (double *)arena_reservar(&arena, num_caracteristicas * sizeof(double));
+    memset(error, 0, k * sizeof(double));
+    memset(varianza, 0, num_caracteristicas * sizeof(double));
+    for (int i = 0; i < datos->filas; i++) {
+        error[grupos[i]] += distancia_cuadrada(fila_matriz(datos, i), fila_matriz(centroides, grupos[i]), num_caracteristicas);
+    }
+    int peor = 0;
+    for (int c = 1; c < k; c++) {
+        if (error[c] > error[peor]) {
+            peor = c;
+        }
     }
 
-    // Contar el número de líneas en el archivo para determinar el número de datos
-    char ch;
-    *num_datos = 0;
-    while(!feof(file)) {
-        ch = fgetc(file);
-        if(ch == '\n') {
-            (*num_datos)++;
+    const real *centro = fila_matriz(centroides, peor);
+    int count = 0;
+    for (int i = 0; i < datos->filas; i++) {
+        if (grupos[i] == peor) {
+            const real *punto = fila_matriz(datos, i);
+            count++;
+            for (int j = 0; j < num_caracteristicas; j++) {
+                double diff = (double)punto[j] - centro[j];
+                varianza[j] += diff * diff;
+            }
+        }
+    }
+    int eje = 0;
+    for (int j = 1; j < num_caracteristicas; j++) {
+        if (varianza[j] > varianza[eje]) {
+            eje = j;
         }
     }
+    double desviacion = count > 0 ? sqrt(varianza[eje] / count) : 0;
 
-    // Establecer el número de características (4 para el conjunto de datos Iris)
-    *num_caracteristicas = 4;
+    for (int c = 0; c < k; c++) {
+        memcpy(fila_matriz(nuevos, c), fila_matriz(centroides, c), num_caracteristicas * sizeof(real));
+    }
+    memcpy(fila_matriz(nuevos, k), centro, num_caracteristicas * sizeof(real));
+    fila_matriz(nuevos, peor)[eje] -= (real)desviacion;
+    fila_matriz(nuevos, k)[eje] += (real)desviacion;
+
+    liberar_arena(&arena);
+}
 
-    // Asignar memoria para los datos
-    double **datos = (double **)malloc(*num_datos * sizeof(double *));
-    for (int i = 0; i < *num_datos; i++) {
-        datos[i] = (double *)malloc(*num_caracteristicas * sizeof(double));
+// Función para agrupar con todos los k de k_min a k_max. Devuelve un SolucionKMeans por k, con sus
+// centroides, grupos y estadísticas, todo sacado de la arena.
+// Los k se reparten en cadenas de `eslabones` valores consecutivos que se ejecutan a la vez, una por hilo
+// (0 reparte el rango entre los hilos disponibles). El primer k de cada cadena parte de la inicialización
+// y los reinicios pedidos; cada siguiente parte de la solución anterior con un grupo dividido en dos, así que
+// suele converger en unas pocas iteraciones. El resultado solo depende de la semilla y de las cadenas.
+SolucionKMeans *barrido_k(const Matriz *datos, int k_min, int k_max, const OpcionesKMeans *opciones, int eslabones, Arena *arena) {
+    int total = k_max - k_min + 1;
+    SolucionKMeans *soluciones = (SolucionKMeans *)arena_reservar(arena, total * sizeof(SolucionKMeans));
+    memset(soluciones, 0, total * sizeof(SolucionKMeans));
+    if (eslabones <= 0) {
+        int hilos = numero_hilos();
+        eslabones = (total + hilos - 1) / hilos;
     }
+    int cadenas = (total + eslabones - 1) / eslabones;
 
-    // Reiniciar el indicador de posición del archivo al principio del archivo
-    rewind(file);
+    for (int s = 0; s < total; s++) {
+        soluciones[s].k = k_min + s;
+        soluciones[s].centroides = crear_matriz(arena, k_min + s, datos->columnas);
+        soluciones[s].grupos = (int *)arena_reservar(arena, datos->filas * sizeof(int));
+    }
 
-    // Leer los datos del archivo
-    for (int i = 0; i < *num_datos; i++) {
-        for (int j = 0; j < *num_caracteristicas; j++) {
-            if (!fscanf(file, "%lf,", &datos[i][j])) {
-                break;
+#pragma omp parallel for schedule(dynamic, 1) if (cadenas > 1)
+    for (int cadena = 0; cadena < cadenas; cadena++) {
+        int primero = cadena * eslabones;
+        int ultimo = primero + eslabones < total ? primero + eslabones : total;
+        for (int s = primero; s < ultimo; s++) {
+            SolucionKMeans *solucion = &soluciones[s];
+            if (s == primero) {
+                solucion->estadisticas = k_means(datos, opciones, &solucion->centroides, solucion->grupos);
+                continue;
             }
+            SolucionKMeans *anterior = &soluciones[s - 1];
+            ResultadoKMeans resultado = {0};
+            double start = now_seconds();
+            dividir_grupo(datos, &anterior->centroides, anterior->grupos, &solucion->centroides);
+            resultado.segundos_inicio = now_seconds() - start;
+            refinar_k_means(datos, opciones, &solucion->centroides, solucion->grupos, &resultado);
+            resultado.segundos = now_seconds() - start;
+            solucion->estadisticas = resultado;
+            solucion->desde_anterior = 1;
         }
-        // Saltar la especie de la flor
-        fscanf(file, "%*s\n");
     }
+    return soluciones;
+}
 
-    fclose(file);
-
+// Función para leer los datos del archivo iris.data
+// Usa el cargador compartido y copia los valores en una matriz de la arena. La columna de la especie se ignora.
+Matriz leer_datos(const char *filename, Arena *arena) {
+    Dataset dataset;
+    if (dataset_load(filename, &dataset) != 0) {
+        printf("No se pudo abrir el archivo %s\n", filename);
+        exit(1);
+    }
+    Matriz datos = crear_matriz(arena, (int)dataset.rows, dataset.cols);
+    if (datos.valores == NULL) {
+        printf("Not enough memory for %zu points\n", dataset.rows);
+        exit(1);
+    }
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < datos.filas; i++) {
+        const double *origen = dataset.values + (size_t)i * dataset.cols;
+        real *destino = fila_matriz(&datos, i);
+        for (int j = 0; j < datos.columnas; j++) {
+            destino[j] = (real)origen[j];
+        }
+    }
+    dataset_free(&dataset);
     return datos;
 }
 
-void write_to_csv(double **datos, int *grupos, int num_datos, int num_caracteristicas, const char *filename) {
+// Write data and cluster assignments to an open file, one row per point
+void write_rows(FILE *file, const Matriz *datos, const int *grupos) {
+    for (int i = 0; i < datos->filas; i++) {
+        const real *punto = fila_matriz(datos, i);
+        for (int j = 0; j < datos->columnas; j++) {
+            fprintf(file, "%f,", punto[j]);
+        }
+        fprintf(file, "%d\n", grupos[i]);
+    }
+}
+
+void write_to_csv(const Matriz *datos, const int *grupos, const char *filename) {
     FILE *file = fopen(filename, "w");
     if (file == NULL) {
         printf("Error opening file!\n");
@@ -186,50 +1216,622 @@ void write_to_csv(double **datos, int *grupos, int num_datos, int num_caracteris
     }
 
     // Write data and cluster assignments to file
-    for (int i = 0; i < num_datos; i++) {
-        for (int j = 0; j < num_caracteristicas; j++) {
-            fprintf(file, "%f,", datos[i][j]);
+    write_rows(file, datos, grupos);
+
+    fclose(file);
+}
+
+// Función para leer el siguiente lote del archivo en las filas de lote, de PUNTOS_POR_LECTURA en
+// PUNTOS_POR_LECTURA puntos a través de valores; devuelve cuántos puntos leyó, 0 al final del archivo
+static int leer_lote(CsvReader *reader, double *valores, Matriz *lote) {
+    int n = 0;
+    while (n < lote->filas) {
+        int pedidos = lote->filas - n < PUNTOS_POR_LECTURA ? lote->filas - n : PUNTOS_POR_LECTURA;
+        int leidos = (int)csv_reader_read(reader, valores, NULL, pedidos);
+        for (int i = 0; i < leidos; i++, n++) {
+            const double *origen = valores + (size_t)i * lote->columnas;
+            real *destino = fila_matriz(lote, n);
+            for (int j = 0; j < lote->columnas; j++) {
+                destino[j] = (real)origen[j];
+            }
+        }
+        if (leidos < pedidos) {
+            break;
         }
-        fprintf(file, "%d\n", grupos[i]);
     }
+    return n;
+}
 
-    fclose(file);
+// Función del K-Means mini-batch: lee el archivo por lotes de tam_lote puntos sin cargarlo entero, así que
+// la memoria depende del lote y no del tamaño de los datos. Cada lote se asigna a los centroides actuales y
+// cada centroide se acerca a la media de sus puntos del lote con tasa de aprendizaje m/v, donde m son sus
+// puntos en el lote y v todos los que lleva vistos: su posición es siempre la media ponderada de lo visto.
+// Se repiten pasadas sobre el archivo hasta que en una pasada ningún centroide se mueva más que la tolerancia.
+// Si salida no es NULL, una pasada final asigna cada punto a su centroide y la escribe como write_to_csv.
+ResultadoMiniBatch k_means_mini_batch(const char *filename, int k, int tam_lote, int max_pasadas, const OpcionesKMeans *opciones, const char *salida) {
+    ResultadoMiniBatch resultado = {0};
+    CsvReader reader;
+    if (csv_reader_open(&reader, filename) != 0) {
+        printf("No se pudo abrir el archivo %s\n", filename);
+        exit(1);
+    }
+    int num_caracteristicas = reader.cols;
+    if (tam_lote < k) {
+        tam_lote = k;
+    }
+
+    // Toda la memoria de trabajo sale de una arena: el lote con sus filas alineadas y unos pocos valores tal
+    // como se leen del archivo
+    Arena arena;
+    iniciar_arena(&arena);
+    double *valores = (double *)arena_reservar(&arena, (size_t)PUNTOS_POR_LECTURA * num_caracteristicas * sizeof(double));
+    Matriz lote = crear_matriz(&arena, tam_lote, num_caracteristicas);
+    int *grupos = (int *)arena_reservar(&arena, tam_lote * sizeof(int));
+    Matriz centroides = crear_matriz(&arena, k, num_caracteristicas);
+    Matriz inicio_pasada = crear_matriz(&arena, k, num_caracteristicas);
+    double *vistos = (double *)arena_reservar(&arena, k * sizeof(double));
+    memset(vistos, 0, k * sizeof(double));
+    Acumuladores acumuladores = crear_acumuladores(tam_lote, num_caracteristicas, k, &arena);
+
+    // Los centroides iniciales salen del primer lote, con la inicialización pedida
+    int n = leer_lote(&reader, valores, &lote);
+    if (n < k) {
+        printf("%s has %d points, fewer than k=%d\n", filename, n, k);
+        exit(1);
+    }
+    Matriz actual = submatriz(&lote, 0, n);
+    elegir_centroides_iniciales(&actual, opciones->inicializacion, opciones->semilla, &centroides);
+
+    double start = now_seconds();
+    while (resultado.pasadas < max_pasadas) {
+        copiar_matriz(&inicio_pasada, &centroides);
+        csv_reader_rewind(&reader);
+        double start_pasada = now_seconds();
+        long long puntos_pasada = 0;
+        while ((n = leer_lote(&reader, valores, &lote)) > 0) {
+            actual = submatriz(&lote, 0, n);
+            asignar_puntos_a_centroides(&actual, &centroides, grupos, opciones->asignacion);
+            acumular_grupos(&actual, grupos, k, &acumuladores);
+            double *counts = acumuladores.sumas + (size_t)k * num_caracteristicas;
+            for (int i = 0; i < k; i++) {
+                if (counts[i] == 0) {
+                    continue;
+                }
+                double *suma = acumuladores.sumas + (size_t)i * num_caracteristicas;
+                real *centroide = fila_matriz(&centroides, i);
+                vistos[i] += counts[i];
+                for (int j = 0; j < num_caracteristicas; j++) {
+                    centroide[j] = (real)(centroide[j] + (suma[j] - counts[i] * centroide[j]) / vistos[i]);
+                }
+            }
+            puntos_pasada += n;
+        }
+        resultado.pasadas++;
+        resultado.puntos += puntos_pasada;
+
+        double movimiento = 0;
+        for (int i = 0; i < k; i++) {
+            double dist = calcular_distancia(fila_matriz(&inicio_pasada, i), fila_matriz(&centroides, i), num_caracteristicas);
+            if (dist > movimiento) {
+                movimiento = dist;
+            }
+        }
+        printf("Pass %d: %lld points, %.0f points/s, largest centroid movement %g\n", resultado.pasadas, puntos_pasada,
+               puntos_pasada / (now_seconds() - start_pasada), movimiento);
+        if (movimiento <= opciones->tolerancia) {
+            resultado.convergio = 1;
+            break;
+        }
+    }
+    resultado.segundos = now_seconds() - start;
+
+    if (salida != NULL) {
+        FILE *file = fopen(salida, "w");
+        if (file == NULL) {
+            printf("Error opening file!\n");
+        } else {
+            csv_reader_rewind(&reader);
+            while ((n = leer_lote(&reader, valores, &lote)) > 0) {
+                actual = submatriz(&lote, 0, n);
+                asignar_puntos_a_centroides(&actual, &centroides, grupos, opciones->asignacion);
+                resultado.inercia += calcular_inercia(&actual, &centroides, grupos);
+                write_rows(file, &actual, grupos);
+            }
+            fclose(file);
+            resultado.asignado = 1;
+        }
+    }
+    resultado.memoria = arena.reservado;
+
+    liberar_arena(&arena);
+    csv_reader_close(&reader);
+    return resultado;
 }
 
-// Función principal
-int main() {
-    // Read data from the Iris dataset
-    int num_datos, num_caracteristicas;
-    double **datos = leer_datos("iris.data", &num_datos, &num_caracteristicas);
+// Función para generar grupos gaussianos alrededor de k centros al azar. Con ordenados, los puntos de cada
+// grupo van seguidos, como las especies de iris.data. Los centros salen del flujo 0 de la semilla y cada bloque
+// de PUNTOS_SINTETICOS puntos de su propio flujo, así que los bloques se generan en paralelo y los datos solo
+// dependen de la semilla. El ruido de cada característica es la suma de tres uniformes, sacadas en bloque.
+static void generar_datos_sinteticos(Matriz *datos, int k, int ordenados, uint64_t semilla) {
+    int num_datos = datos->filas;
+    int num_caracteristicas = datos->columnas;
+    double *centros = (double *)malloc((size_t)k * num_caracteristicas * sizeof(double));
+    Rng aleatorio;
+    rng_seed(&aleatorio, semilla, 0);
+    for (int i = 0; i < k * num_caracteristicas; i++) {
+        centros[i] = 10.0 * rng_uniform(&aleatorio);
+    }
+    int bloques = (num_datos + PUNTOS_SINTETICOS - 1) / PUNTOS_SINTETICOS;
+    rng_init();  // el núcleo de rng_fill_uniform se elige aquí y no dentro del bucle paralelo
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int b = 0; b < bloques; b++) {
+        Rng propio;
+        rng_seed(&propio, semilla, (uint64_t)b + 1);
+        RngLanes carriles;
+        rng_lanes_init(&carriles, &propio);
+        double *ruido = (double *)malloc(3 * (size_t)num_caracteristicas * sizeof(double));
+        int fin = (b + 1) * PUNTOS_SINTETICOS < num_datos ? (b + 1) * PUNTOS_SINTETICOS : num_datos;
+        for (int i = b * PUNTOS_SINTETICOS; i < fin; i++) {
+            real *punto = fila_matriz(datos, i);
+            int grupo = ordenados ? (int)((long long)i * k / num_datos) : (int)rng_below(&propio, k);
+            const double *centro = centros + (size_t)grupo * num_caracteristicas;
+            rng_fill_uniform(&carriles, ruido, 3 * (size_t)num_caracteristicas);
+            for (int j = 0; j < num_caracteristicas; j++) {
+                punto[j] = (real)(centro[j] + (ruido[3 * j] + ruido[3 * j + 1] + ruido[3 * j + 2] - 1.5));
+            }
+        }
+        free(ruido);
+    }
+    free(centros);
+}
 
-    // Define the range of k values to test
+// Función para medir cómo escalan la asignación y el recálculo de centroides con el número de hilos, sobre
+// datos sintéticos de 1M, 10M, 100M... puntos hasta max_puntos. Cada tamaño usa los primeros puntos del mismo
+// conjunto y los mismos centroides iniciales, y se comprueba que todos los hilos den exactamente el resultado de uno.
+void ejecutar_benchmark(int max_puntos, int num_caracteristicas, int k, uint64_t semilla) {
+    printf("Benchmark: up to %d points, %d dimensions, k=%d, %s values, %d iterations per run, up to %d threads\n",
+           max_puntos, num_caracteristicas, k, NOMBRE_REAL, BENCH_ITER, numero_hilos());
+    Arena arena;
+    iniciar_arena(&arena);
+    Matriz datos = crear_matriz(&arena, max_puntos, num_caracteristicas);
+    int *grupos = (int *)arena_reservar(&arena, max_puntos * sizeof(int));
+    if (datos.valores == NULL || grupos == NULL) {
+        printf("Not enough memory for %d points\n", max_puntos);
+        exit(1);
+    }
+
+    generar_datos_sinteticos(&datos, k, 0, semilla);
+
+    Matriz centroides = crear_matriz(&arena, k, num_caracteristicas);
+    Matriz referencia = crear_matriz(&arena, k, num_caracteristicas);
+    double *desplazamiento = (double *)arena_reservar(&arena, k * sizeof(double));
+
+    int max_hilos = numero_hilos();
+    for (long long n = 1000000; n <= max_puntos; n *= 10) {
+        Matriz vista = submatriz(&datos, 0, (int)n);
+        Arena arena_sumas;
+        iniciar_arena(&arena_sumas);
+        Acumuladores acumuladores = crear_acumuladores(vista.filas, num_caracteristicas, k, &arena_sumas);
+        double segundos_un_hilo = 0;
+        for (int hilos = 1; hilos <= max_hilos; hilos = (hilos < max_hilos && 2 * hilos > max_hilos) ? max_hilos : 2 * hilos) {
+#ifdef _OPENMP
+            omp_set_num_threads(hilos);
+#endif
+            inicializar_centroides(&vista, &centroides);
+            for (int i = 0; i < vista.filas; i++) {
+                grupos[i] = -1;
+            }
+            double start = now_seconds();
+            for (int iter = 0; iter < BENCH_ITER; iter++) {
+                asignar_puntos_a_centroides(&vista, &centroides, grupos, ASIGNACION_AUTO);
+                recalcular_centroides(&vista, grupos, &centroides, desplazamiento, &acumuladores);
+            }
+            double segundos = (now_seconds() - start) / BENCH_ITER;
+
+            int identico = 1;
+            if (hilos == 1) {
+                copiar_matriz(&referencia, &centroides);
+                segundos_un_hilo = segundos;
+            } else if (memcmp(referencia.valores, centroides.valores, (size_t)k * centroides.paso * sizeof(real)) != 0) {
+                identico = 0;
+            }
+            printf("%10d points %3d threads  %8.3f s/iteration  %8.1f M points/s  scaling %5.2fx  %s\n", vista.filas, hilos, segundos,
+                   vista.filas / segundos / 1e6, segundos_un_hilo / segundos, identico ? "identical" : "DIFFERENT from 1 thread");
+        }
+        liberar_arena(&arena_sumas);
+    }
+#ifdef _OPENMP
+    omp_set_num_threads(max_hilos);
+#endif
+
+    liberar_arena(&arena);
+}
+
+// Función para comparar la asignación escalar con la asignación por bloques con dimensiones de 4 a 1024 y k
+// de 16 a 4096, sobre datos sintéticos. Cada caso usa unos MACS_BENCH_DISTANCIAS productos, con como mucho
+// max_puntos puntos, y comprueba que las dos den las mismas asignaciones.
+void ejecutar_benchmark_distancias(int max_puntos, uint64_t semilla) {
+    const int dimensiones[] = {4, 16, 64, 256, 1024};
+    const int ks[] = {16, 256, 4096};
+    printf("Distance benchmark: %s values, %s kernel, %d threads\n", NOMBRE_REAL, nombre_nucleo(), numero_hilos());
+    for (int a = 0; a < 5; a++) {
+        for (int b = 0; b < 3; b++) {
+            int d = dimensiones[a], k = ks[b];
+            long long puntos = MACS_BENCH_DISTANCIAS / ((long long)k * d);
+            int num_datos = (int)(puntos < PUNTOS_BENCH_MIN ? PUNTOS_BENCH_MIN : puntos > max_puntos ? max_puntos : puntos);
+            Arena arena;
+            iniciar_arena(&arena);
+            Matriz datos = crear_matriz(&arena, num_datos, d);
+            Matriz centroides = crear_matriz(&arena, k, d);
+            int *escalar = (int *)arena_reservar(&arena, num_datos * sizeof(int));
+            int *bloques = (int *)arena_reservar(&arena, num_datos * sizeof(int));
+            if (datos.valores == NULL || centroides.valores == NULL || escalar == NULL || bloques == NULL) {
+                printf("Not enough memory for %d points\n", num_datos);
+                exit(1);
+            }
+            // Los centroides son puntos de los mismos k grupos que los datos
+            generar_datos_sinteticos(&datos, k, 0, semilla);
+            generar_datos_sinteticos(&centroides, k, 0, semilla);
+            memset(escalar, -1, num_datos * sizeof(int));
+            memset(bloques, -1, num_datos * sizeof(int));
+
+            double start = now_seconds();
+            asignar_escalar(&datos, &centroides, escalar);
+            double segundos_escalar = now_seconds() - start;
+            long long revisados = 0;
+            start = now_seconds();
+            asignar_por_bloques(&datos, &centroides, bloques, &revisados);
+            double segundos_bloques = now_seconds() - start;
+
+            double flops = 2.0 * num_datos * k * d;
+            printf("d=%4d k=%4d %7d points  scalar %8.3f s %6.2f GFLOP/s  blocked %8.3f s %6.2f GFLOP/s  %6.2fx  %5.2f%% rechecked  %s\n", d, k,
+                   num_datos, segundos_escalar, flops / segundos_escalar / 1e9, segundos_bloques, flops / segundos_bloques / 1e9,
+                   segundos_escalar / segundos_bloques, 100.0 * revisados / num_datos,
+                   memcmp(escalar, bloques, num_datos * sizeof(int)) == 0 ? "identical" : "DIFFERENT");
+            liberar_arena(&arena);
+        }
+    }
+}
+
+// Función para comparar las inicializaciones: para datos sintéticos en orden aleatorio y ordenados por grupo,
+// el tiempo de elegir los centroides iniciales, las iteraciones y el tiempo total hasta converger, y la inercia.
+void ejecutar_benchmark_inicializacion(int num_datos, int num_caracteristicas, int k, const OpcionesKMeans *opciones) {
+    const InicializacionKMeans inicializaciones[] = {INICIO_PRIMEROS, INICIO_KMEANS_PP, INICIO_PARALELO};
+    Arena arena;
+    iniciar_arena(&arena);
+    Matriz datos = crear_matriz(&arena, num_datos, num_caracteristicas);
+    Matriz centroides = crear_matriz(&arena, k, num_caracteristicas);
+    int *grupos = (int *)arena_reservar(&arena, num_datos * sizeof(int));
+    printf("Seeding benchmark: %d points, %d dimensions, k=%d, %s values, %d threads\n", num_datos, num_caracteristicas, k, NOMBRE_REAL, numero_hilos());
+
+    for (int ordenados = 0; ordenados <= 1; ordenados++) {
+        generar_datos_sinteticos(&datos, k, ordenados, opciones->semilla);
+        for (int m = 0; m < 3; m++) {
+            OpcionesKMeans prueba = *opciones;
+            prueba.inicializacion = inicializaciones[m];
+            ResultadoKMeans resultado = k_means(&datos, &prueba, &centroides, grupos);
+            printf("%-9s data  %-8s  seeding %8.3f s  %3d iterations%s  total %8.3f s  inertia %.6g\n", ordenados ? "sorted" : "shuffled",
+                   nombre_inicializacion(inicializaciones[m]), resultado.segundos_inicio, resultado.iteraciones,
+                   resultado.convergio ? "" : " (not converged)", resultado.segundos, resultado.inercia);
+        }
+    }
+    liberar_arena(&arena);
+}
+
+// Función para comparar el barrido de k = 2..k_max de barrido_k con ejecuciones independientes de k_means
+// para cada k, sobre datos sintéticos con k_max grupos: tiempo, iteraciones e inercia de cada k.
+void ejecutar_benchmark_barrido(int num_datos, int num_caracteristicas, int k_max, const OpcionesKMeans *opciones, int eslabones) {
     int k_min = 2;
-    int k_max = 10;
+    Arena arena;
+    iniciar_arena(&arena);
+    Matriz datos = crear_matriz(&arena, num_datos, num_caracteristicas);
+    generar_datos_sinteticos(&datos, k_max, 0, opciones->semilla);
+    printf("Sweep benchmark: %d points, %d dimensions, k=%d..%d, %s values, %d threads\n", num_datos, num_caracteristicas, k_min, k_max,
+           NOMBRE_REAL, numero_hilos());
 
-    // Allocate memory for cluster assignments
-    int *grupos = malloc(num_datos * sizeof(int));
+    SolucionKMeans *independientes = (SolucionKMeans *)arena_reservar(&arena, (k_max - k_min + 1) * sizeof(SolucionKMeans));
+    double start = now_seconds();
+    for (int k = k_min; k <= k_max; k++) {
+        SolucionKMeans *solucion = &independientes[k - k_min];
+        solucion->k = k;
+        solucion->centroides = crear_matriz(&arena, k, num_caracteristicas);
+        solucion->grupos = (int *)arena_reservar(&arena, num_datos * sizeof(int));
+        solucion->estadisticas = k_means(&datos, opciones, &solucion->centroides, solucion->grupos);
+    }
+    double segundos_independientes = now_seconds() - start;
 
-    // Run K-Means for each k and compute the silhouette score
+    start = now_seconds();
+    SolucionKMeans *barrido = barrido_k(&datos, k_min, k_max, opciones, eslabones, &arena);
+    double segundos_barrido = now_seconds() - start;
+
+    int iteraciones_independientes = 0, iteraciones_barrido = 0;
     for (int k = k_min; k <= k_max; k++) {
-        // Apply the K-Means algorithm
-        k_means(datos, num_datos, num_caracteristicas, k);
+        ResultadoKMeans *frio = &independientes[k - k_min].estadisticas;
+        ResultadoKMeans *barrido_k_actual = &barrido[k - k_min].estadisticas;
+        iteraciones_independientes += frio->iteraciones;
+        iteraciones_barrido += barrido_k_actual->iteraciones;
+        printf("k=%3d  independent %3d iterations %8.3f s inertia %-12.6g  sweep %-5s %3d iterations %8.3f s inertia %-12.6g\n", k,
+               frio->iteraciones, frio->segundos, frio->inercia, barrido[k - k_min].desde_anterior ? "split" : "cold",
+               barrido_k_actual->iteraciones, barrido_k_actual->segundos, barrido_k_actual->inercia);
+    }
+    printf("Independent runs: %d iterations, %.3f s\n", iteraciones_independientes, segundos_independientes);
+    printf("Sweep:            %d iterations, %.3f s (%.2fx faster)\n", iteraciones_barrido, segundos_barrido, segundos_independientes / segundos_barrido);
 
-        // Compute the silhouette score
-        double score = silhouette_score(datos, grupos, num_datos, num_caracteristicas, k);
+    liberar_arena(&arena);
+}
 
-        // Print the silhouette score for this k
-        printf("Silhouette score for k=%d: %f\n", k, score);
+// Función principal
+// Usage: kmeans [--data file.csv] [--k-min n] [--k-max n] [--chain n] [--algorithm auto|lloyd|hamerly|elkan] [--tolerance t] [--init first|kmeans++|parallel] [--seed n] [--restarts n] [--silhouette auto|exact|sampled] [--silhouette-sample n] [--distances auto|scalar|blocked] [--threads n] [--minibatch batch_size [--k n] [--passes n] [--assign]] [--serve [socket_path] [--k n] [--rebalance n] [--window n]] [--bench [max_points [dimensions [k]]]] [--bench-init [points [dimensions [k]]]] [--bench-sweep [points [dimensions [k_max]]]] [--bench-distances [max_points]]
+int main(int argc, char **argv) {
+    // The distance kernel is chosen here, before a parallel region can be the first to use it
+    elegir_nucleo();
+    const char *data_path = "iris.data";
+    OpcionesKMeans opciones = {KMEANS_AUTO, INICIO_KMEANS_PP, TOLERANCIA, 1, 1, ASIGNACION_AUTO};
+    int tam_lote = 0, k_lote = 3, max_pasadas = MAX_PASADAS, asignar = 0;
+    int servir = 0, datos_dados = 0, cada_rebalanceo = REBALANCEO, ventana = VENTANA_SERVICIO;
+    const char *ruta_socket = NULL;
+    int bench_inicio[3] = {0, 0, 0};
+    int bench_barrido[3] = {0, 0, 0};
+    // Range of k values to test, and how many consecutive k each chain of the sweep warm-starts
+    int k_min = 2, k_max = 10, eslabones = 0;
+    ModoSilueta modo_silueta = SILUETA_AUTO;
+    int muestra_silueta = MUESTRA_SILUETA;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--data") == 0 && i + 1 < argc) {
+            data_path = argv[++i];
+            datos_dados = 1;
+        } else if (strcmp(argv[i], "--algorithm") == 0 && i + 1 < argc) {
+            const char *nombre = argv[++i];
+            if (strcmp(nombre, "lloyd") == 0) {
+                opciones.algoritmo = KMEANS_LLOYD;
+            } else if (strcmp(nombre, "hamerly") == 0) {
+                opciones.algoritmo = KMEANS_HAMERLY;
+            } else if (strcmp(nombre, "elkan") == 0) {
+                opciones.algoritmo = KMEANS_ELKAN;
+            } else if (strcmp(nombre, "auto") == 0) {
+                opciones.algoritmo = KMEANS_AUTO;
+            } else {
+                printf("Unknown algorithm '%s' (expected auto, lloyd, hamerly or elkan)\n", nombre);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc) {
+            opciones.tolerancia = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--init") == 0 && i + 1 < argc) {
+            const char *nombre = argv[++i];
+            if (strcmp(nombre, "first") == 0) {
+                opciones.inicializacion = INICIO_PRIMEROS;
+            } else if (strcmp(nombre, "kmeans++") == 0) {
+                opciones.inicializacion = INICIO_KMEANS_PP;
+            } else if (strcmp(nombre, "parallel") == 0 || strcmp(nombre, "kmeans||") == 0) {
+                opciones.inicializacion = INICIO_PARALELO;
+            } else {
+                printf("Unknown initialization '%s' (expected first, kmeans++ or parallel)\n", nombre);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--silhouette") == 0 && i + 1 < argc) {
+            const char *nombre = argv[++i];
+            if (strcmp(nombre, "exact") == 0) {
+                modo_silueta = SILUETA_EXACTA;
+            } else if (strcmp(nombre, "sampled") == 0) {
+                modo_silueta = SILUETA_MUESTREADA;
+            } else if (strcmp(nombre, "auto") == 0) {
+                modo_silueta = SILUETA_AUTO;
+            } else {
+                printf("Unknown silhouette mode '%s' (expected auto, exact or sampled)\n", nombre);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--distances") == 0 && i + 1 < argc) {
+            const char *nombre = argv[++i];
+            if (strcmp(nombre, "scalar") == 0) {
+                opciones.asignacion = ASIGNACION_ESCALAR;
+            } else if (strcmp(nombre, "blocked") == 0) {
+                opciones.asignacion = ASIGNACION_BLOQUES;
+            } else if (strcmp(nombre, "auto") == 0) {
+                opciones.asignacion = ASIGNACION_AUTO;
+            } else {
+                printf("Unknown distance computation '%s' (expected auto, scalar or blocked)\n", nombre);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--silhouette-sample") == 0 && i + 1 < argc) {
+            muestra_silueta = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            opciones.semilla = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--restarts") == 0 && i + 1 < argc) {
+            opciones.reinicios = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            int hilos = atoi(argv[++i]);
+#ifdef _OPENMP
+            if (hilos > 0) {
+                omp_set_num_threads(hilos);
+            }
+#else
+            (void)hilos;
+#endif
+        } else if (strcmp(argv[i], "--k-min") == 0 && i + 1 < argc) {
+            k_min = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--k-max") == 0 && i + 1 < argc) {
+            k_max = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--chain") == 0 && i + 1 < argc) {
+            eslabones = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--minibatch") == 0 && i + 1 < argc) {
+            tam_lote = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--k") == 0 && i + 1 < argc) {
+            k_lote = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--passes") == 0 && i + 1 < argc) {
+            max_pasadas = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--serve") == 0) {
+            servir = 1;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                ruta_socket = argv[++i];
+            }
+        } else if (strcmp(argv[i], "--rebalance") == 0 && i + 1 < argc) {
+            cada_rebalanceo = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--window") == 0 && i + 1 < argc) {
+            ventana = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--assign") == 0) {
+            asignar = 1;
+        } else if (strcmp(argv[i], "--bench") == 0) {
+            int params[3] = {100000000, 2, 8};
+            for (int p = 0; p < 3 && i + 1 < argc && argv[i + 1][0] != '-'; p++) {
+                params[p] = atoi(argv[++i]);
+            }
+            ejecutar_benchmark(params[0], params[1], params[2], opciones.semilla);
+            return 0;
+        } else if (strcmp(argv[i], "--bench-distances") == 0) {
+            int max_puntos = 100000;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                max_puntos = atoi(argv[++i]);
+            }
+            ejecutar_benchmark_distancias(max_puntos, opciones.semilla);
+            return 0;
+        } else if (strcmp(argv[i], "--bench-sweep") == 0) {
+            bench_barrido[0] = 1000000;
+            bench_barrido[1] = 8;
+            bench_barrido[2] = 32;
+            for (int p = 0; p < 3 && i + 1 < argc && argv[i + 1][0] != '-'; p++) {
+                bench_barrido[p] = atoi(argv[++i]);
+            }
+        } else if (strcmp(argv[i], "--bench-init") == 0) {
+            // Se ejecuta después de leer las demás opciones, que usa
+            bench_inicio[0] = 1000000;
+            bench_inicio[1] = 8;
+            bench_inicio[2] = 32;
+            for (int p = 0; p < 3 && i + 1 < argc && argv[i + 1][0] != '-'; p++) {
+                bench_inicio[p] = atoi(argv[++i]);
+            }
+        } else {
+            printf("Usage: %s [--data file.csv] [--k-min n] [--k-max n] [--chain n] [--algorithm auto|lloyd|hamerly|elkan] [--tolerance t] [--init first|kmeans++|parallel] [--seed n] [--restarts n] [--silhouette auto|exact|sampled] [--silhouette-sample n] [--distances auto|scalar|blocked] [--threads n] [--minibatch batch_size [--k n] [--passes n] [--assign]] [--serve [socket_path] [--k n] [--rebalance n] [--window n]] [--bench [max_points [dimensions [k]]]] [--bench-init [points [dimensions [k]]]] [--bench-sweep [points [dimensions [k_max]]]] [--bench-distances [max_points]]\n", argv[0]);
+            return 1;
+        }
     }
 
-    // Write data and cluster assignments to CSV file
-    write_to_csv(datos, grupos, num_datos, num_caracteristicas, "value_of_assignments_and_clusters.csv");
+    if (bench_barrido[0] > 0) {
+        ejecutar_benchmark_barrido(bench_barrido[0], bench_barrido[1], bench_barrido[2], &opciones, eslabones);
+        return 0;
+    }
+    if (bench_inicio[0] > 0) {
+        ejecutar_benchmark_inicializacion(bench_inicio[0], bench_inicio[1], bench_inicio[2], &opciones);
+        return 0;
+    }
 
-    // Free memory
-    free(grupos);
-    for (int i = 0; i < num_datos; ++i) {
-        free(datos[i]);
+    // Service mode: clusters points as they arrive, on stdin or a Unix socket. Responses go to stdout, so
+    // everything else is reported on stderr.
+    if (servir) {
+        if (k_lote < 1 || ventana < 1 || cada_rebalanceo < 0) {
+            fprintf(stderr, "The service needs k >= 1, a window of at least 1 point and a rebalance interval >= 0\n");
+            return 1;
+        }
+        // Seeding picks the k centroids from the window, so a smaller window would repeat some of them
+        if (ventana < k_lote) {
+            fprintf(stderr, "The service needs a window of at least k=%d points, not %d\n", k_lote, ventana);
+            return 1;
+        }
+        OpcionesServicio opciones_servicio = {k_lote, cada_rebalanceo, ventana, opciones.asignacion, opciones.semilla};
+        Arena arena;
+        iniciar_arena(&arena);
+        Matriz iniciales = {0};
+        double *pesos = NULL;
+        // With --data, the service starts from a model trained on that file instead of the first k points
+        if (datos_dados) {
+            Matriz datos = leer_datos(data_path, &arena);
+            if (k_lote > datos.filas) {
+                fprintf(stderr, "%s has %d points, fewer than k=%d\n", data_path, datos.filas, k_lote);
+                return 1;
+            }
+            iniciales = crear_matriz(&arena, k_lote, datos.columnas);
+            int *grupos = (int *)arena_reservar(&arena, datos.filas * sizeof(int));
+            pesos = (double *)arena_reservar(&arena, k_lote * sizeof(double));
+            ResultadoKMeans resultado = k_means(&datos, &opciones, &iniciales, grupos);
+            memset(pesos, 0, k_lote * sizeof(double));
+            for (int i = 0; i < datos.filas; i++) {
+                pesos[grupos[i]] += 1;
+            }
+            fprintf(stderr, "Trained k=%d on the %d points of %s, inertia %f\n", k_lote, datos.filas, data_path, resultado.inercia);
+        }
+        ResultadoServicio resultado;
+        if (servir_k_means(ruta_socket, datos_dados ? &iniciales : NULL, pesos, &opciones_servicio, &resultado) != 0) {
+            return 1;
+        }
+        fprintf(stderr, "Served %lld points: %lld learned, %lld dropped, %lld bad lines, %d rebalances, %lld model versions",
+                resultado.puntos, resultado.aprendidos, resultado.descartados, resultado.errores, resultado.rebalanceos, resultado.versiones);
+        if (ruta_socket != NULL) {
+            fprintf(stderr, ", %d clients", resultado.conexiones);
+        }
+        fprintf(stderr, "\nLatency %.1f us mean, %.1f us max; %.1f KB of working memory\n", resultado.latencia_media * 1e6,
+                resultado.latencia_maxima * 1e6, resultado.memoria / 1024.0);
+        liberar_arena(&arena);
+        return 0;
+    }
+
+    // Mini-batch mode: streams the file instead of loading it
+    if (tam_lote > 0) {
+        ResultadoMiniBatch resultado = k_means_mini_batch(data_path, k_lote, tam_lote, max_pasadas, &opciones,
+                                                          asignar ? "value_of_assignments_and_clusters.csv" : NULL);
+        printf("Mini-batch k=%d: %d passes%s, %lld points in %.3f s, %.0f points/s, %.1f KB of working memory\n", k_lote,
+               resultado.pasadas, resultado.convergio ? "" : " (not converged)", resultado.puntos, resultado.segundos,
+               resultado.puntos / resultado.segundos, resultado.memoria / 1024.0);
+        if (resultado.asignado) {
+            printf("Final assignment written to value_of_assignments_and_clusters.csv, inertia %f\n", resultado.inercia);
+        }
+        return 0;
+    }
+
+    // Read data from the Iris dataset
+    Arena arena;
+    iniciar_arena(&arena);
+    Matriz datos = leer_datos(data_path, &arena);
+    int num_datos = datos.filas;
+    if (k_min < 1 || k_max < k_min || k_max > num_datos) {
+        printf("Invalid k range %d..%d for %d points\n", k_min, k_max, num_datos);
+        return 1;
+    }
+
+    // Run K-Means for every k in the range, several k at a time, each warm-started from the one before
+    double start = now_seconds();
+    SolucionKMeans *soluciones = barrido_k(&datos, k_min, k_max, &opciones, eslabones, &arena);
+    printf("Clustered k=%d..%d in %.3f ms\n", k_min, k_max, (now_seconds() - start) * 1e3);
+
+    // Compute the silhouette score for each k and keep the best one
+    int mejor_k = k_min;
+    double mejor_score = -DBL_MAX;
+    for (int k = k_min; k <= k_max; k++) {
+        SolucionKMeans *solucion = &soluciones[k - k_min];
+        ResultadoKMeans resultado = solucion->estadisticas;
+        printf("k=%d: %s, %s, %d iterations%s, %.1f%% of distances pruned, inertia %f, %.3f ms", k,
+               solucion->desde_anterior ? "split from k-1" : nombre_inicializacion(opciones.inicializacion), nombre_algoritmo(resultado.algoritmo),
+               resultado.iteraciones, resultado.convergio ? "" : " (not converged)",
+               100.0 * (1.0 - (double)resultado.distancias / resultado.distancias_lloyd), resultado.inercia, resultado.segundos * 1e3);
+        if (!solucion->desde_anterior && opciones.reinicios > 1) {
+            printf(" (best of %d restarts: #%d)", opciones.reinicios, resultado.reinicio + 1);
+        }
+        printf("\n");
+
+        // Compute the silhouette score, exactly or from a sample of points
+        double score;
+        start = now_seconds();
+        if (modo_silueta == SILUETA_EXACTA || (modo_silueta == SILUETA_AUTO && num_datos <= SILUETA_EXACTA_MAX)) {
+            score = silhouette_score(&datos, solucion->grupos, k);
+
+            // Print the silhouette score for this k
+            printf("Silhouette score for k=%d: %f (%.3f ms)\n", k, score, (now_seconds() - start) * 1e3);
+        } else {
+            EstimacionSilueta estimacion = silhouette_sampled(&datos, solucion->grupos, k, muestra_silueta, opciones.semilla);
+            score = estimacion.valor;
+            printf("Silhouette score for k=%d: %f +- %f (95%% confidence, at most +- %f), %d sampled points (%.3f ms)\n", k,
+                   estimacion.valor, estimacion.error, estimacion.cota_hoeffding, estimacion.muestra, (now_seconds() - start) * 1e3);
+        }
+        if (score > mejor_score) {
+            mejor_score = score;
+            mejor_k = k;
+        }
     }
-    free(datos);
+
+    // Write data and the cluster assignments of the best k to CSV file
+    write_to_csv(&datos, soluciones[mejor_k - k_min].grupos, "value_of_assignments_and_clusters.csv");
+    printf("Best silhouette score: k=%d (%f); its assignments are in value_of_assignments_and_clusters.csv\n", mejor_k, mejor_score);
+
+    // Free memory
+    liberar_arena(&arena);
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,103 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "k_means_matriz.h"
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+// Cabecera de un bloque de arena; los datos empiezan en la siguiente línea de caché
+struct BloqueArena {
+    BloqueArena *anterior;
+    size_t capacidad;
+    size_t usado;
+};
+
+#define CABECERA_BLOQUE ((sizeof(BloqueArena) + LINEA_CACHE - 1) / LINEA_CACHE * LINEA_CACHE)
+
+static size_t redondear_linea(size_t bytes) {
+    return (bytes + LINEA_CACHE - 1) / LINEA_CACHE * LINEA_CACHE;
+}
+
+void *memoria_alineada(size_t size) {
+    size = redondear_linea(size > 0 ? size : 1);
+#ifdef _WIN32
+    return _aligned_malloc(size, LINEA_CACHE);
+#else
+    return aligned_alloc(LINEA_CACHE, size);
+#endif
+}
+
+void liberar_alineada(void *memoria) {
+#ifdef _WIN32
+    _aligned_free(memoria);
+#else
+    free(memoria);
+#endif
+}
+
+void iniciar_arena(Arena *arena) {
+    arena->bloques = NULL;
+    arena->reservado = 0;
+}
+
+void *arena_reservar(Arena *arena, size_t bytes) {
+    bytes = redondear_linea(bytes > 0 ? bytes : 1);
+    BloqueArena *bloque = arena->bloques;
+    if (bloque == NULL || bloque->capacidad - bloque->usado < bytes) {
+        // Las reservas grandes, como los datos, van a un bloque a su medida
+        size_t capacidad = bytes > ARENA_BLOQUE ? bytes : ARENA_BLOQUE;
+        bloque = (BloqueArena *)memoria_alineada(CABECERA_BLOQUE + capacidad);
+        if (bloque == NULL) {
+            return NULL;
+        }
+        bloque->anterior = arena->bloques;
+        bloque->capacidad = capacidad;
+        bloque->usado = 0;
+        arena->bloques = bloque;
+    }
+    void *memoria = (char *)bloque + CABECERA_BLOQUE + bloque->usado;
+    bloque->usado += bytes;
+    arena->reservado += bytes;
+    return memoria;
+}
+
+void liberar_arena(Arena *arena) {
+    while (arena->bloques != NULL) {
+        BloqueArena *anterior = arena->bloques->anterior;
+        liberar_alineada(arena->bloques);
+        arena->bloques = anterior;
+    }
+    arena->reservado = 0;
+}
+
+// Función para calcular el paso de las filas de una matriz con `columnas` valores
+int paso_matriz(int columnas) {
+    int por_linea = LINEA_CACHE / sizeof(real);
+    if (columnas >= por_linea) {
+        return (columnas + por_linea - 1) / por_linea * por_linea;
+    }
+    int paso = 1;
+    while (paso < columnas) {
+        paso *= 2;
+    }
+    return paso;
+}
+
+Matriz crear_matriz(Arena *arena, int filas, int columnas) {
+    Matriz matriz;
+    matriz.filas = filas;
+    matriz.columnas = columnas;
+    matriz.paso = paso_matriz(columnas);
+    size_t bytes = (size_t)filas * matriz.paso * sizeof(real);
+    matriz.valores = (real *)arena_reservar(arena, bytes);
+    if (matriz.valores != NULL) {
+        memset(matriz.valores, 0, bytes);
+    }
+    return matriz;
+}
+
+void copiar_matriz(Matriz *destino, const Matriz *origen) {
+    memcpy(destino->valores, origen->valores, (size_t)origen->filas * origen->paso * sizeof(real));
+}
@@ -0,0 +1,86 @@
+#ifndef K_MEANS_MATRIZ_H
+#define K_MEANS_MATRIZ_H
+
+#include <stddef.h>
+#include <math.h>
+
+// Matrices de puntos y de centroides del K-Means: todas las filas en un solo bloque alineado, una tras otra
+// con un paso fijo, en lugar de reservar cada fila por separado. Los datos se recorren así de forma
+// secuencial, el prefetcher de la CPU puede seguirlos y el compilador vectoriza las distancias.
+
+#define LINEA_CACHE 64
+#define ARENA_BLOQUE (1 << 20)  // bytes mínimos de cada bloque de una arena
+
+// Tipo de los valores de las matrices. Compilando con -DKMEANS_FLOAT son floats de 32 bits, que leen la
+// mitad de bytes por punto; las sumas, distancias y cotas se siguen acumulando en double.
+#ifdef KMEANS_FLOAT
+typedef float real;
+#define NOMBRE_REAL "float32"
+#else
+typedef double real;
+#define NOMBRE_REAL "float64"
+#endif
+
+typedef struct {
+    int filas;
+    int columnas;
+    int paso;       // valores de una fila a la siguiente: la menor potencia de dos en la que cabe la fila si es más
+                    // corta que una línea de caché, si no un múltiplo de la línea, así que ninguna fila toca más
+                    // líneas de las necesarias. El relleno vale 0.
+    real *valores;  // alineado a LINEA_CACHE; el valor j de la fila i está en valores[i * paso + j]
+} Matriz;
+
+// Memoria de la que salen las matrices y los vectores auxiliares de una ejecución: bloques grandes y alineados
+// que se reparten en orden y se liberan todos juntos con liberar_arena. No es segura entre hilos: cada hilo
+// que necesita memoria propia usa su propia arena.
+typedef struct BloqueArena BloqueArena;
+
+typedef struct {
+    BloqueArena *bloques;  // el último bloque, enlazado con los anteriores
+    size_t reservado;      // bytes repartidos, contando el redondeo a LINEA_CACHE
+} Arena;
+
+// Memoria alineada a una línea de caché; size se redondea a un múltiplo de LINEA_CACHE
+void *memoria_alineada(size_t size);
+void liberar_alineada(void *memoria);
+
+void iniciar_arena(Arena *arena);
+// Devuelve bytes sin inicializar, alineados a LINEA_CACHE, o NULL si no queda memoria
+void *arena_reservar(Arena *arena, size_t bytes);
+void liberar_arena(Arena *arena);
+
+int paso_matriz(int columnas);
+// Matriz de filas × columnas a ceros, sacada de la arena; valores es NULL si no queda memoria
+Matriz crear_matriz(Arena *arena, int filas, int columnas);
+// Copia una matriz en otra de la misma forma
+void copiar_matriz(Matriz *destino, const Matriz *origen);
+
+static inline real *fila_matriz(const Matriz *matriz, int i) {
+    return matriz->valores + (size_t)i * matriz->paso;
+}
+
+// Vista de las filas [inicio, inicio + filas) que comparte la memoria de la matriz
+static inline Matriz submatriz(const Matriz *matriz, int inicio, int filas) {
+    Matriz vista = *matriz;
+    vista.filas = filas;
+    vista.valores = fila_matriz(matriz, inicio);
+    return vista;
+}
+
+// Distancia euclidiana al cuadrado entre dos filas
+static inline double distancia_cuadrada(const real *punto1, const real *punto2, int num_caracteristicas) {
+    double sum = 0;
+#pragma omp simd reduction(+:sum)
+    for (int i = 0; i < num_caracteristicas; i++) {
+        double diff = (double)punto1[i] - punto2[i];
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+// Función para calcular la distancia euclidiana entre dos puntos
+static inline double calcular_distancia(const real *punto1, const real *punto2, int num_caracteristicas) {
+    return sqrt(distancia_cuadrada(punto1, punto2, num_caracteristicas));
+}
+
+#endif
@@ -0,0 +1,696 @@
+#include <float.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#include "../common/dataset.h"
+#include "../common/random.h"
+#include "k_means_servicio.h"
+
+#define BYTES_COLA (8 << 20)     // bytes de puntos de la cola del actualizador, como mucho
+#define PUNTOS_COLA_MAX 16384    // y puntos; la capacidad es la potencia de dos que cabe en los dos límites
+#define PUNTOS_COLA_MIN 64
+#define ITER_REBALANCEO 10       // iteraciones de Lloyd de un rebalanceo, como mucho
+#define ESPERA_MAXIMA 1000       // microsegundos que duerme el actualizador sin trabajo entre dos miradas a la cola
+#define NUEVO 4                  // marca del modelo intermedio que el que atiende aún no ha tomado
+
+// Una copia publicada del modelo; no cambia mientras el que atiende la usa
+typedef struct {
+    Matriz centroides;
+    long long version;
+    long long aprendidos;   // puntos aprendidos cuando se publicó
+} Modelo;
+
+typedef struct {
+    OpcionesServicio opciones;
+    ResultadoServicio *resultado;
+    int d;                       // características; 0 hasta el primer punto si no hay centroides iniciales
+    Arena arena;
+
+    // Triple búfer: el modelo frente es del que atiende, atras del actualizador, e intermedio, con la marca
+    // NUEVO si es más reciente que frente, solo se lee y se cambia con intercambios atómicos
+    Modelo modelos[3];
+    int frente, atras;
+    long long intermedio;
+
+    // Cola de un productor (el que atiende) y un consumidor (el actualizador); los dos contadores solo crecen
+    Matriz cola;
+    long long mascara;           // filas de la cola − 1
+    long long escritos, leidos;
+    long long terminado;
+
+    // Estado del actualizador
+    Matriz trabajo;              // centroides que se actualizan; menos de k filas mientras se recogen los provisionales
+    int sembrado;                // 0 mientras se llena la primera ventana, con centroides provisionales
+    double *cuentas;             // puntos que lleva cada centroide
+    double *sumas;               // sumas por grupo del rebalanceo
+    Matriz ventana;              // últimos puntos aprendidos, en círculo
+    int *grupos_ventana;
+    long long en_ventana;        // puntos que han pasado por la ventana
+    long long desde_rebalanceo;
+
+    Matriz punto;                // el punto que se está atendiendo
+} Servicio;
+
+// Entrada y salida del cliente actual
+typedef struct {
+    FILE *entrada;
+    FILE *salida;
+    int servidor;                // socket que acepta clientes, −1 con stdin
+    const char *ruta;
+} Conexion;
+
+static double segundos_ahora(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void dormir(int microsegundos) {
+#ifdef _WIN32
+    Sleep(microsegundos >= 1000 ? microsegundos / 1000 : 1);
+#else
+    struct timespec espera = {0, microsegundos * 1000L};
+    nanosleep(&espera, NULL);
+#endif
+}
+
+// Lecturas, escrituras e intercambios atómicos entre los dos hilos; sin OpenMP solo hay un hilo
+static long long leer_atomico(long long *variable) {
+    long long valor;
+#pragma omp atomic read seq_cst
+    valor = *variable;
+    return valor;
+}
+
+static long long intercambiar_atomico(long long *variable, long long valor) {
+    long long anterior;
+#pragma omp atomic capture seq_cst
+    {
+        anterior = *variable;
+        *variable = valor;
+    }
+    return anterior;
+}
+
+// Una escritura seq_cst es un intercambio en x86 de todos modos, y así GCC no avisa de que valor no se usa
+static void escribir_atomico(long long *variable, long long valor) {
+    intercambiar_atomico(variable, valor);
+}
+
+// Función para reservar los modelos, la cola y la ventana cuando se conoce el número de características
+static void preparar(Servicio *s, int d) {
+    int k = s->opciones.k;
+    s->d = d;
+    for (int m = 0; m < 3; m++) {
+        s->modelos[m].centroides = crear_matriz(&s->arena, k, d);
+        s->modelos[m].centroides.filas = 0;
+    }
+    s->trabajo = crear_matriz(&s->arena, k, d);
+    s->trabajo.filas = 0;
+    s->cuentas = (double *)arena_reservar(&s->arena, k * sizeof(double));
+    s->sumas = (double *)arena_reservar(&s->arena, (size_t)k * d * sizeof(double));
+    long long por_fila = (long long)paso_matriz(d) * sizeof(real);
+    long long puntos_cola = PUNTOS_COLA_MIN;
+    while (puntos_cola * 2 <= PUNTOS_COLA_MAX && puntos_cola * 2 * por_fila <= BYTES_COLA) {
+        puntos_cola *= 2;
+    }
+    s->cola = crear_matriz(&s->arena, (int)puntos_cola, d);
+    s->mascara = puntos_cola - 1;
+    s->ventana = crear_matriz(&s->arena, s->opciones.ventana, d);
+    s->grupos_ventana = (int *)arena_reservar(&s->arena, s->opciones.ventana * sizeof(int));
+    s->punto = crear_matriz(&s->arena, 1, d);
+    if (s->punto.valores == NULL || s->modelos[2].centroides.valores == NULL || s->trabajo.valores == NULL || s->cuentas == NULL || s->sumas == NULL ||
+        s->cola.valores == NULL || s->ventana.valores == NULL || s->grupos_ventana == NULL) {
+        fprintf(stderr, "Not enough memory for the service with k=%d, %d features and a window of %d points\n", k, d,
+                s->opciones.ventana);
+        exit(1);
+    }
+}
+
+// Función para publicar una copia de los centroides de trabajo. Solo la llama el dueño de atras: el actualizador,
+// o el que atiende mientras llena la primera ventana, antes de que haya nada en la cola.
+static void publicar(Servicio *s) {
+    Modelo *modelo = &s->modelos[s->atras];
+    modelo->centroides.filas = s->trabajo.filas;
+    copiar_matriz(&modelo->centroides, &s->trabajo);
+    modelo->version = ++s->resultado->versiones;
+    modelo->aprendidos = s->resultado->aprendidos;
+    s->atras = (int)(intercambiar_atomico(&s->intermedio, s->atras | NUEVO) & ~NUEVO);
+}
+
+// Función para tomar el modelo publicado más reciente, sin esperar nunca al actualizador
+static const Modelo *modelo_actual(Servicio *s) {
+    if (leer_atomico(&s->intermedio) & NUEVO) {
+        s->frente = (int)(intercambiar_atomico(&s->intermedio, s->frente) & ~NUEVO);
+    }
+    return &s->modelos[s->frente];
+}
+
+// Función para mover el centroide más cercano hacia el punto y guardar el punto en la ventana
+static void aprender(Servicio *s, const real *punto) {
+    int j = centroide_mas_cercano(punto, &s->trabajo);
+    real *centroide = fila_matriz(&s->trabajo, j);
+    s->cuentas[j] += 1;
+    for (int p = 0; p < s->d; p++) {
+        centroide[p] = (real)(centroide[p] + (punto[p] - centroide[p]) / s->cuentas[j]);
+    }
+    memcpy(fila_matriz(&s->ventana, (int)(s->en_ventana % s->ventana.filas)), punto, s->d * sizeof(real));
+    s->en_ventana++;
+    s->desde_rebalanceo++;
+    s->resultado->aprendidos++;
+}
+
+// Función para dar a un grupo vacío el punto de la ventana más lejano a su centroide, sacándolo de un grupo que
+// tiene más puntos; así un centroide que se quedó sin puntos pasa a donde los datos están peor representados
+static void resembrar_grupo(Servicio *s, const Matriz *puntos, int vacio) {
+    int d = s->d;
+    int *grupos = s->grupos_ventana;
+    int lejano = -1;
+    double mayor = 0;
+    for (int i = 0; i < puntos->filas; i++) {
+        if (s->cuentas[grupos[i]] > 1) {
+            double dist = distancia_cuadrada(fila_matriz(puntos, i), fila_matriz(&s->trabajo, grupos[i]), d);
+            if (dist > mayor) {
+                mayor = dist;
+                lejano = i;
+            }
+        }
+    }
+    if (lejano < 0) {
+        return;  // todos los puntos están sobre su centroide: no hay nada mejor que hacer con este
+    }
+    const real *punto = fila_matriz(puntos, lejano);
+    int antiguo = grupos[lejano];
+    for (int p = 0; p < d; p++) {
+        s->sumas[(size_t)antiguo * d + p] -= punto[p];
+        s->sumas[(size_t)vacio * d + p] = punto[p];
+    }
+    s->cuentas[antiguo] -= 1;
+    s->cuentas[vacio] = 1;
+    grupos[lejano] = vacio;
+}
+
+// Función para rehacer los centroides con unas iteraciones de Lloyd sobre la ventana. Las cuentas pasan a ser
+// los puntos de cada grupo en la ventana, así que lo que llegue después pesa frente a los datos recientes y no
+// frente a toda la historia. Un grupo que se queda vacío se lleva el punto peor representado.
+static void rebalancear(Servicio *s) {
+    int k = s->trabajo.filas;
+    int d = s->d;
+    int n = s->en_ventana < s->ventana.filas ? (int)s->en_ventana : s->ventana.filas;
+    Matriz puntos = submatriz(&s->ventana, 0, n);
+    int *grupos = s->grupos_ventana;
+    for (int i = 0; i < n; i++) {
+        grupos[i] = -1;
+    }
+    for (int iter = 0; iter < ITER_REBALANCEO; iter++) {
+        if (asignar_puntos_a_centroides(&puntos, &s->trabajo, grupos, s->opciones.asignacion) == 0) {
+            break;
+        }
+        memset(s->sumas, 0, (size_t)k * d * sizeof(double));
+        memset(s->cuentas, 0, k * sizeof(double));
+        for (int i = 0; i < n; i++) {
+            const real *punto = fila_matriz(&puntos, i);
+            double *suma = s->sumas + (size_t)grupos[i] * d;
+            for (int p = 0; p < d; p++) {
+                suma[p] += punto[p];
+            }
+            s->cuentas[grupos[i]] += 1;
+        }
+        for (int j = 0; j < k; j++) {
+            if (s->cuentas[j] == 0) {
+                resembrar_grupo(s, &puntos, j);
+            }
+        }
+        for (int j = 0; j < k; j++) {
+            if (s->cuentas[j] > 0) {
+                real *centroide = fila_matriz(&s->trabajo, j);
+                for (int p = 0; p < d; p++) {
+                    centroide[p] = (real)(s->sumas[(size_t)j * d + p] / s->cuentas[j]);
+                }
+            }
+        }
+    }
+    s->desde_rebalanceo = 0;
+    s->resultado->rebalanceos++;
+}
+
+// Función para acercar D² de cada punto de la ventana a un centroide más: nuevas (puede ser d2) recibe el mínimo
+// de d2 y la distancia al cuadrado a ese centroide. Devuelve la suma de nuevas.
+static double acercar_d2(const Matriz *ventana, const real *centroide, const double *d2, double *nuevas) {
+    double total = 0;
+    for (int i = 0; i < ventana->filas; i++) {
+        double dist = distancia_cuadrada(fila_matriz(ventana, i), centroide, ventana->columnas);
+        nuevas[i] = dist < d2[i] ? dist : d2[i];
+        total += nuevas[i];
+    }
+    return total;
+}
+
+// Función para elegir un punto con probabilidad proporcional a su D²
+static int sortear_por_d2(const double *d2, int n, double total, Rng *aleatorio) {
+    if (total <= 0) {
+        return (int)rng_below(aleatorio, n);  // menos de k puntos distintos
+    }
+    double objetivo = rng_uniform(aleatorio) * total;
+    int elegido = n - 1;
+    for (int i = 0; i < n; i++) {
+        if (objetivo < d2[i]) {
+            elegido = i;
+            break;
+        }
+        objetivo -= d2[i];
+    }
+    // El redondeo puede dejar el objetivo más allá del último punto con D² positiva
+    while (elegido > 0 && d2[elegido] == 0) {
+        elegido--;
+    }
+    return elegido;
+}
+
+// Función para elegir los k centroides entre los puntos de la ventana con k-means++ voraz: el primero al azar y,
+// para cada uno de los siguientes, 2 + ln k candidatos sorteados con probabilidad proporcional a su D², de los
+// que se queda el que deja la menor suma de D². Con un solo sorteo, a veces quedan dos centroides en un mismo
+// grupo, y las pocas iteraciones de un rebalanceo no siempre los separan.
+static void sembrar(Servicio *s) {
+    int k = s->opciones.k;
+    int n = s->ventana.filas;
+    int intentos = 2 + (int)log(k);
+    Rng aleatorio;
+    rng_seed(&aleatorio, s->opciones.semilla, 0);
+    Arena arena;
+    iniciar_arena(&arena);
+    double *d2 = (double *)arena_reservar(&arena, n * sizeof(double));
+    double *prueba = (double *)arena_reservar(&arena, n * sizeof(double));
+    double *mejor = (double *)arena_reservar(&arena, n * sizeof(double));
+    for (int i = 0; i < n; i++) {
+        d2[i] = DBL_MAX;
+    }
+    int elegido = (int)rng_below(&aleatorio, n);
+    memcpy(fila_matriz(&s->trabajo, 0), fila_matriz(&s->ventana, elegido), s->d * sizeof(real));
+    double total = acercar_d2(&s->ventana, fila_matriz(&s->trabajo, 0), d2, d2);
+    for (int c = 1; c < k; c++) {
+        double mejor_total = DBL_MAX;
+        for (int t = 0; t < intentos; t++) {
+            int candidato = sortear_por_d2(d2, n, total, &aleatorio);
+            double suma = acercar_d2(&s->ventana, fila_matriz(&s->ventana, candidato), d2, prueba);
+            if (suma < mejor_total) {
+                mejor_total = suma;
+                elegido = candidato;
+                double *cambio = mejor;
+                mejor = prueba;
+                prueba = cambio;
+            }
+        }
+        memcpy(fila_matriz(&s->trabajo, c), fila_matriz(&s->ventana, elegido), s->d * sizeof(real));
+        double *cambio = d2;
+        d2 = mejor;
+        mejor = cambio;
+        total = mejor_total;
+    }
+    s->trabajo.filas = k;
+    liberar_arena(&arena);
+}
+
+// Función para guardar en la primera ventana un punto que llega antes de tener centroides y devolver su grupo
+// provisional. Los k primeros puntos distintos hacen de centroides hasta que la ventana se llena; entonces se
+// eligen con k-means++ sobre ella y se afinan con un rebalanceo, así que un comienzo que solo trae puntos de
+// unos pocos grupos no deja dos centroides en el mismo grupo y ninguno en otro.
+static int recoger(Servicio *s, const real *x) {
+    memcpy(fila_matriz(&s->ventana, (int)s->en_ventana), x, s->d * sizeof(real));
+    s->en_ventana++;
+    s->resultado->aprendidos++;
+    int grupo = 0;
+    if (s->trabajo.filas > 0) {
+        grupo = centroide_mas_cercano(x, &s->trabajo);
+    }
+    if (s->trabajo.filas < s->opciones.k && (s->trabajo.filas == 0 || distancia_cuadrada(x, fila_matriz(&s->trabajo, grupo), s->d) > 0)) {
+        grupo = s->trabajo.filas++;
+        memcpy(fila_matriz(&s->trabajo, grupo), x, s->d * sizeof(real));
+        publicar(s);
+    }
+    if (s->en_ventana == s->ventana.filas) {
+        sembrar(s);
+        rebalancear(s);
+        publicar(s);
+        s->sembrado = 1;
+    }
+    return grupo;
+}
+
+// Función para aprender de todos los puntos que hay en la cola y publicar el modelo; devuelve cuántos eran
+static long long procesar_cola(Servicio *s) {
+    long long escritos = leer_atomico(&s->escritos);
+    long long pendientes = escritos - s->leidos;
+    if (pendientes == 0) {
+        return 0;
+    }
+    for (long long i = s->leidos; i < escritos; i++) {
+        aprender(s, fila_matriz(&s->cola, (int)(i & s->mascara)));
+    }
+    // El que atiende puede volver a llenar la cola mientras se rebalancea
+    escribir_atomico(&s->leidos, escritos);
+    if (s->opciones.cada_rebalanceo > 0 && s->desde_rebalanceo >= s->opciones.cada_rebalanceo) {
+        rebalancear(s);
+    }
+    publicar(s);
+    return pendientes;
+}
+
+// Bucle del actualizador: sin puntos en la cola duerme cada vez más, hasta ESPERA_MAXIMA
+static void actualizar(Servicio *s) {
+    int espera = 1;
+    for (;;) {
+        long long terminado = leer_atomico(&s->terminado);
+        if (procesar_cola(s) > 0) {
+            espera = 1;
+        } else if (terminado) {
+            break;
+        } else {
+            dormir(espera);
+            espera = espera * 2 < ESPERA_MAXIMA ? espera * 2 : ESPERA_MAXIMA;
+        }
+    }
+}
+
+// Función para leer la siguiente línea en *linea, que crece lo que haga falta; devuelve 0 al final de la entrada
+static int leer_linea(FILE *entrada, char **linea, size_t *capacidad) {
+    size_t largo = 0;
+    while (fgets(*linea + largo, (int)(*capacidad - largo), entrada) != NULL) {
+        largo += strlen(*linea + largo);
+        if ((*linea)[largo - 1] == '\n' || largo + 1 < *capacidad) {
+            return 1;
+        }
+        *capacidad *= 2;
+        char *mayor = (char *)realloc(*linea, *capacidad);
+        if (mayor == NULL) {
+            fprintf(stderr, "Not enough memory for a line of %zu bytes\n", *capacidad);
+            exit(1);
+        }
+        *linea = mayor;
+    }
+    return largo > 0;
+}
+
+// Función para leer los números separados por comas de una línea, con una columna de clase opcional al final;
+// devuelve cuántos hay, 0 si la línea no empieza por un número o −1 si alguno no es finito
+static int leer_valores(const char *linea, double *valores) {
+    const char *p = linea;
+    const char *fin = linea + strlen(linea);
+    int n = 0;
+    for (;;) {
+        while (p < fin && (*p == ' ' || *p == '\t')) {
+            p++;
+        }
+        const char *despues = parse_number(p, fin, &valores[n]);
+        if (despues == NULL) {
+            break;
+        }
+        if (!isfinite(valores[n])) {
+            return -1;
+        }
+        n++;
+        p = despues;
+        while (p < fin && (*p == ' ' || *p == '\t')) {
+            p++;
+        }
+        if (p == fin || *p != ',') {
+            break;
+        }
+        p++;
+    }
+    return n;
+}
+
+static int es_orden(const char *linea, const char *orden) {
+    size_t largo = strlen(orden);
+    if (strncmp(linea, orden, largo) != 0) {
+        return 0;
+    }
+    for (linea += largo; *linea != '\0'; linea++) {
+        if (*linea != ' ' && *linea != '\t' && *linea != '\r' && *linea != '\n') {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void escribir_modelo(FILE *salida, const Modelo *modelo) {
+    fprintf(salida, "version %lld, %lld points learned, %d centroids\n", modelo->version, modelo->aprendidos,
+            modelo->centroides.filas);
+    for (int j = 0; j < modelo->centroides.filas; j++) {
+        const real *centroide = fila_matriz(&modelo->centroides, j);
+        for (int p = 0; p < modelo->centroides.columnas; p++) {
+            fprintf(salida, p == 0 ? "%g" : ",%g", centroide[p]);
+        }
+        fprintf(salida, "\n");
+    }
+}
+
+// Función para que el cliente actual sea el siguiente; devuelve 0 si no hay más
+static int siguiente_cliente(Conexion *conexion) {
+    if (conexion->servidor < 0) {
+        return 0;
+    }
+#ifndef _WIN32
+    for (;;) {
+        int cliente = accept(conexion->servidor, NULL, NULL);
+        if (cliente < 0) {
+            perror("accept");
+            return 0;
+        }
+        conexion->entrada = fdopen(cliente, "r");
+        conexion->salida = fdopen(dup(cliente), "w");
+        if (conexion->entrada != NULL && conexion->salida != NULL) {
+            setvbuf(conexion->salida, NULL, _IOLBF, 0);
+            return 1;
+        }
+        if (conexion->entrada != NULL) {
+            fclose(conexion->entrada);
+        } else {
+            close(cliente);
+        }
+        if (conexion->salida != NULL) {
+            fclose(conexion->salida);
+        }
+    }
+#else
+    return 0;
+#endif
+}
+
+static void cerrar_cliente(Conexion *conexion) {
+    if (conexion->servidor >= 0 && conexion->entrada != NULL) {
+        fclose(conexion->entrada);
+        fclose(conexion->salida);
+    }
+    conexion->entrada = NULL;
+    conexion->salida = NULL;
+}
+
+// Función para abrir stdin o el socket y esperar al primer cliente; devuelve 0, o −1 si falla
+static int abrir_conexion(Conexion *conexion, const char *ruta) {
+    conexion->ruta = ruta;
+    conexion->servidor = -1;
+    if (ruta == NULL) {
+        conexion->entrada = stdin;
+        conexion->salida = stdout;
+        setvbuf(stdout, NULL, _IOLBF, 0);
+        return 0;
+    }
+#ifdef _WIN32
+    fprintf(stderr, "Unix sockets are not supported on Windows; pipe the points through stdin instead\n");
+    return -1;
+#else
+    struct sockaddr_un direccion;
+    memset(&direccion, 0, sizeof(direccion));
+    direccion.sun_family = AF_UNIX;
+    if (strlen(ruta) >= sizeof(direccion.sun_path)) {
+        fprintf(stderr, "Socket path %s is too long\n", ruta);
+        return -1;
+    }
+    strcpy(direccion.sun_path, ruta);
+    conexion->servidor = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (conexion->servidor < 0) {
+        perror("socket");
+        return -1;
+    }
+    unlink(ruta);
+    if (bind(conexion->servidor, (struct sockaddr *)&direccion, sizeof(direccion)) != 0 || listen(conexion->servidor, 8) != 0) {
+        perror(ruta);
+        close(conexion->servidor);
+        return -1;
+    }
+    // Un cliente que se va sin leer su respuesta no debe terminar el servicio
+    signal(SIGPIPE, SIG_IGN);
+    fprintf(stderr, "Listening on %s\n", ruta);
+    return siguiente_cliente(conexion) ? 0 : -1;
+#endif
+}
+
+static void cerrar_conexion(Conexion *conexion) {
+    cerrar_cliente(conexion);
+#ifndef _WIN32
+    if (conexion->servidor >= 0) {
+        close(conexion->servidor);
+        unlink(conexion->ruta);
+    }
+#endif
+}
+
+// Bucle del hilo que atiende: lee cada línea, responde y deja el punto en la cola. Con en_linea no hay
+// actualizador y aprende de cada punto él mismo después de responder.
+static void atender(Servicio *s, Conexion *conexion, int en_linea) {
+    ResultadoServicio *resultado = s->resultado;
+    size_t capacidad = 1024;
+    char *linea = (char *)malloc(capacidad);
+    double *valores = NULL;
+    size_t capacidad_valores = 0;
+    double latencia_total = 0;
+    for (;;) {
+        if (!leer_linea(conexion->entrada, &linea, &capacidad)) {
+            cerrar_cliente(conexion);
+            if (!siguiente_cliente(conexion)) {
+                break;
+            }
+            resultado->conexiones++;
+            continue;
+        }
+        double inicio = segundos_ahora();
+        // Cada número ocupa al menos dos caracteres con su coma
+        if (capacidad_valores < capacidad / 2 + 1) {
+            capacidad_valores = capacidad / 2 + 1;
+            free(valores);
+            valores = (double *)malloc(capacidad_valores * sizeof(double));
+        }
+        int n = leer_valores(linea, valores);
+        if (n == 0) {
+            if (es_orden(linea, "shutdown")) {
+                break;
+            } else if (es_orden(linea, "centroids")) {
+                escribir_modelo(conexion->salida, modelo_actual(s));
+            } else if (!es_orden(linea, "")) {
+                fprintf(conexion->salida, "error: expected comma-separated numbers, centroids or shutdown\n");
+                resultado->errores++;
+            }
+            continue;
+        }
+        if (s->d == 0 && n > 0) {
+            // Sin centroides iniciales, el primer punto fija el número de características
+            preparar(s, n);
+        }
+        if (n != s->d) {
+            fprintf(conexion->salida, n < 0 ? "error: values must be finite\n" : "error: expected %d values\n", s->d);
+            resultado->errores++;
+            continue;
+        }
+        real *x = fila_matriz(&s->punto, 0);
+        for (int p = 0; p < s->d; p++) {
+            x[p] = (real)valores[p];
+        }
+
+        int grupo, aprendido = 0;
+        if (!s->sembrado) {
+            // Todavía se llena la primera ventana, sin actualizador: el que atiende es dueño del modelo
+            grupo = recoger(s, x);
+            aprendido = 1;
+        } else {
+            grupo = centroide_mas_cercano(x, &modelo_actual(s)->centroides);
+        }
+        fprintf(conexion->salida, "%d\n", grupo);
+        double latencia = segundos_ahora() - inicio;
+        latencia_total += latencia;
+        if (latencia > resultado->latencia_maxima) {
+            resultado->latencia_maxima = latencia;
+        }
+        resultado->puntos++;
+
+        if (aprendido) {
+            continue;
+        }
+        if (s->escritos - leer_atomico(&s->leidos) <= s->mascara) {
+            memcpy(fila_matriz(&s->cola, (int)(s->escritos & s->mascara)), x, s->d * sizeof(real));
+            escribir_atomico(&s->escritos, s->escritos + 1);
+        } else {
+            resultado->descartados++;
+        }
+        if (en_linea) {
+            procesar_cola(s);
+        }
+    }
+    if (resultado->puntos > 0) {
+        resultado->latencia_media = latencia_total / resultado->puntos;
+    }
+    free(valores);
+    free(linea);
+}
+
+int servir_k_means(const char *ruta_socket, const Matriz *iniciales, const double *pesos, const OpcionesServicio *opciones,
+                   ResultadoServicio *resultado) {
+    memset(resultado, 0, sizeof(*resultado));
+    Servicio s;
+    memset(&s, 0, sizeof(s));
+    s.opciones = *opciones;
+    s.resultado = resultado;
+    s.frente = 0;
+    s.intermedio = 1;
+    s.atras = 2;
+    iniciar_arena(&s.arena);
+    if (iniciales != NULL) {
+        s.opciones.k = iniciales->filas;
+        preparar(&s, iniciales->columnas);
+        s.trabajo.filas = iniciales->filas;
+        copiar_matriz(&s.trabajo, iniciales);
+        for (int j = 0; j < iniciales->filas; j++) {
+            s.cuentas[j] = pesos != NULL ? pesos[j] : 1;
+        }
+        s.sembrado = 1;
+        publicar(&s);
+    }
+
+    Conexion conexion;
+    if (abrir_conexion(&conexion, ruta_socket) != 0) {
+        liberar_arena(&s.arena);
+        return -1;
+    }
+    if (conexion.servidor >= 0) {
+        resultado->conexiones = 1;
+    }
+
+    // Un hilo atiende y otro actualiza; con un solo hilo disponible, el que atiende hace las dos cosas
+#ifdef _OPENMP
+    int hilos = omp_get_max_threads() > 1 ? 2 : 1;
+#pragma omp parallel num_threads(hilos)
+#endif
+    {
+        int hilo = 0, en_linea = 1;
+#ifdef _OPENMP
+        hilo = omp_get_thread_num();
+        en_linea = omp_get_num_threads() < 2;
+#endif
+        if (hilo == 0) {
+            atender(&s, &conexion, en_linea);
+            escribir_atomico(&s.terminado, 1);
+        } else {
+            actualizar(&s);
+        }
+    }
+    cerrar_conexion(&conexion);
+    resultado->memoria = s.arena.reservado;
+    liberar_arena(&s.arena);
+    return 0;
+}
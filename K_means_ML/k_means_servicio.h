@@ -0,0 +1,54 @@
+#ifndef K_MEANS_SERVICIO_H
+#define K_MEANS_SERVICIO_H
+
+#include <stdint.h>
+
+#include "k_means_matriz.h"
+#include "k_means_distancias.h"
+
+// Modo servicio: un proceso que no termina y agrupa los puntos según llegan, por stdin o por un socket Unix.
+// Cada línea es un punto en el formato de los CSV (una columna de clase al final se ignora) y se responde
+// con una línea con el índice de su centroide más cercano. Dos órdenes más: "centroids" escribe el modelo
+// actual y "shutdown" para el servicio.
+//
+// Un hilo atiende la entrada y otro actualiza el modelo. El que atiende asigna con el último modelo publicado
+// y deja el punto en una cola; el actualizador mueve con él su centroide (K-Means secuencial de MacQueen:
+// c += (x − c) / n, con n los puntos que lleva ese centroide) y guarda los puntos recientes en una ventana.
+// Cada cierto número de puntos rebalancea: unas iteraciones de Lloyd sobre la ventana, que corrigen el orden
+// de llegada y siguen los grupos que se desplazan. Después de cada tanda publica una copia del modelo.
+//
+// Los modelos se publican en un triple búfer: el actualizador escribe en su copia y la intercambia de forma
+// atómica con la intermedia, y el que atiende toma la intermedia cuando es nueva. Ninguno espera al otro,
+// así que asignar un punto nunca se bloquea por una actualización o un rebalanceo. Si la cola se llena
+// porque el actualizador va atrasado, el punto se asigna igual pero no se aprende de él.
+
+typedef struct {
+    int k;
+    int cada_rebalanceo;        // puntos aprendidos entre dos rebalanceos; 0 no rebalancea
+    int ventana;                // puntos recientes sobre los que se rebalancea
+    ModoAsignacion asignacion;  // cómo se asigna la ventana al rebalancear
+    uint64_t semilla;           // del k-means++ sobre la primera ventana, sin centroides iniciales
+} OpcionesServicio;
+
+typedef struct {
+    long long puntos;           // puntos asignados
+    long long aprendidos;       // puntos con los que se actualizó el modelo
+    long long descartados;      // puntos que no cupieron en la cola
+    long long errores;          // líneas que no eran un punto ni una orden
+    long long versiones;        // modelos publicados
+    int rebalanceos;
+    int conexiones;             // clientes atendidos por el socket
+    double latencia_media;      // segundos desde que se lee un punto hasta que se escribe su grupo
+    double latencia_maxima;
+    size_t memoria;             // bytes de trabajo: modelos, cola y ventana
+} ResultadoServicio;
+
+// Atiende stdin, o los clientes del socket ruta_socket uno tras otro si no es NULL, hasta el final de stdin
+// o la orden "shutdown". iniciales son los centroides de partida (k filas) y pesos los puntos que representa
+// cada uno (NULL: uno); sin iniciales, los centroides salen de k-means++ sobre la primera ventana de puntos,
+// y hasta que se llena los k primeros puntos distintos hacen de centroides provisionales.
+// Devuelve 0, o -1 si no se pudo abrir el socket.
+int servir_k_means(const char *ruta_socket, const Matriz *iniciales, const double *pesos, const OpcionesServicio *opciones,
+                   ResultadoServicio *resultado);
+
+#endif
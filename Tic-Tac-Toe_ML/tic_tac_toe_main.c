@@ -1,58 +1,207 @@
 #include <stdlib.h>
 #include <stdio.h>
-#include <math.h>
+#include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <float.h>
+#include <time.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TTT_X86_DISPATCH 1
+#include <immintrin.h>
+#endif
+
+#include "../common/binary_file.h"
+#include "../common/mapped_file.h"
+#include "../common/random.h"
+#include "tic_tac_toe_mnk.h"
 
 #define BOARD_SIZE 3
 #define EPISODES 10000
-#define ALPHA 0.5
-#define GAMMA 0.9
-#define EPSILON 0.2
-#define NUM_STATES 19683
+#define MNK_MEMORY_MB 256           // default bound on the hashed Q-table of larger boards
+#define MNK_EVAL_GAMES 10000        // games per side against a random player after training on a larger board
+#define SYNC_EPISODES 1000          // episodes each worker plays on its own copy of the Q-table between two merges
+#define EVAL_GAMES 100000           // games per side against each fixed opponent in the benchmark
+#define GAMES_PER_BLOCK 1000        // evaluation games that share a random number generator
+#define BATCH_GAMES 256             // games the batched backend plays in lockstep
+#define LANES 16                    // games advanced together by one pass of the batched kernel
+#define EPSILON_THRESHOLD ((unsigned)(EPSILON * 65536))   // EPSILON on the 16 random bits the batched backend tests
+#define NUM_STATES 19683            // 3^9 encodings of a board, most of them unreachable
+#define NUM_CANONICAL_STATES 765    // boards reachable in a game, up to rotation and reflection
+#define NUM_SYMMETRIES 8
 #define NUM_ACTIONS 9
-#define REWARD_WIN 1.0
-#define REWARD_LOSE (-1.0)
-#define REWARD_DRAW 0.5
 #define EMPTY 0
 #define X 1
 #define O 2
+#define FULL_BOARD 0x1FF    // one bit per cell; cell i * BOARD_SIZE + j is row i, column j
+#define Q_TABLE_MAGIC "TTTQTABL"
+#define Q_TABLE_VERSION 1
+#define Q_TABLE_BYTES (NUM_CANONICAL_STATES * NUM_ACTIONS * sizeof(float))
 
+// The cells of each player as a bitmask, and the encoding of the board seen by each player (see getState),
+// kept up to date by updateBoard; both are indexed by X and O
 typedef struct {
-	int board[BOARD_SIZE][BOARD_SIZE];
+	unsigned short cells[3];
+	int state[3];
 }Board;
 
+// Q-values of the player to move, one row per canonical board, with the actions numbered on the canonical board.
+// The 8 boards that are rotations or reflections of each other share a row, so every episode trains all of them.
 typedef struct {
-	double q[NUM_STATES][NUM_ACTIONS];
+	float (*q)[NUM_ACTIONS];    // NUM_CANONICAL_STATES rows, allocated by initAgent or read-only in a mapped file
+	long long episodes;         // episodes the table has been trained for
 	int player;
+	bool mapped;
+	MappedFile file;
 } Agent;
 
+// Sizes saved ahead of the Q-values in a binary Q-table
+typedef struct {
+	int32_t rows;
+	int32_t actions;
+	int64_t episodes;
+} QTableHeader;
+
+// Perfect hash from the encoding of every reachable board (see getState) to the row of its canonical board:
+// the one of its 8 symmetric boards with the lowest encoding
+typedef struct {
+	short row[NUM_STATES];                          // -1 for boards that cannot be reached
+	unsigned char symmetry[NUM_STATES];             // symmetry that turns the board into its canonical one
+	int canonical[NUM_CANONICAL_STATES];            // encoding of the canonical board of each row
+	unsigned short legal[NUM_CANONICAL_STATES];     // one bit per empty cell of the canonical board, 0 once the game is over
+	unsigned packed[NUM_STATES];                    // row | symmetry << 10 | legal << 13, one load for the batched backend
+	int cell[NUM_SYMMETRIES][NUM_ACTIONS];          // cell of the board that each canonical action is, for each symmetry
+	int count;
+} StateTable;
+
+// Training backends: one game at a time, or BATCH_GAMES games in lockstep
+typedef enum {
+	BACKEND_SCALAR,
+	BACKEND_BATCH
+} Backend;
+
+// A batch of games played in lockstep, one array per field, so that every step of every game is the same loop
+// over the games. Games that are over stay in the batch, masked out, until the last one ends.
+typedef struct {
+	int cells[3][BATCH_GAMES];      // indexed by X and O, like Board
+	int state[3][BATCH_GAMES];
+	int active[BATCH_GAMES];        // -1 while the game goes on, 0 once it is over
+	unsigned random[BATCH_GAMES];   // xorshift32 state of each game
+	int index[BATCH_GAMES];         // Q-value the last move updates: row * NUM_ACTIONS + canonical action
+	float target[BATCH_GAMES];      // and the value it moves towards
+} Batch;
+
+typedef void (*BatchKernel)(const Agent *agent, Batch *batch, int player);
+
+// Cell that each cell goes to under each symmetry: identity, rotations by 90, 180 and 270 degrees,
+// and reflections across the vertical axis, the horizontal axis and the two diagonals
+static const int SYMMETRY[NUM_SYMMETRIES][NUM_ACTIONS] = {
+	{0, 1, 2, 3, 4, 5, 6, 7, 8},
+	{2, 5, 8, 1, 4, 7, 0, 3, 6},
+	{8, 7, 6, 5, 4, 3, 2, 1, 0},
+	{6, 3, 0, 7, 4, 1, 8, 5, 2},
+	{2, 1, 0, 5, 4, 3, 8, 7, 6},
+	{6, 7, 8, 3, 4, 5, 0, 1, 2},
+	{0, 3, 6, 1, 4, 7, 2, 5, 8},
+	{8, 5, 2, 7, 4, 1, 6, 3, 0}
+};
+static const int INVERSE_SYMMETRY[NUM_SYMMETRIES] = {0, 3, 2, 1, 4, 5, 6, 7};
+
+// The 8 lines of three cells: rows, columns and diagonals
+static const unsigned short LINES[8] = {0x007, 0x038, 0x1C0, 0x049, 0x092, 0x124, 0x111, 0x054};
+static const int POWERS_OF_3[NUM_ACTIONS] = {1, 3, 9, 27, 81, 243, 729, 2187, 6561};
+
+// Fixed opponents the trained agent is measured against
+typedef enum {
+	OPPONENT_RANDOM,      // plays a random empty cell
+	OPPONENT_BLOCKING,    // wins if it can, otherwise blocks the agent's win, otherwise plays at random
+	OPPONENT_SOLVER       // plays perfectly: a random one of the moves the solver finds best
+} Opponent;
+
+// Bound of a value in the solver's transposition table
+typedef enum {
+	BOUND_NONE,           // not searched yet
+	BOUND_EXACT,
+	BOUND_LOWER,          // the value is at least this
+	BOUND_UPPER           // the value is at most this
+} Bound;
+
+// Game-theoretic values of the 3 × 3 game, one entry per canonical board, so the 8 symmetric boards share it
+typedef struct {
+	signed char value[NUM_CANONICAL_STATES];        // for the player to move: 1 win, 0 draw, -1 loss with perfect play
+	unsigned char bound[NUM_CANONICAL_STATES];
+	unsigned short optimal[NUM_CANONICAL_STATES];   // canonical actions that keep the value, one bit each
+	long long nodes;                                // positions searched
+} Solver;
+
+static StateTable states;
+static Solver solver;
+static bool winning[FULL_BOARD + 1];    // whether a set of cells contains a whole line
+
+static double secondsNow(void) {
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+//Function to get how many threads the parallel loops use
+int numberOfThreads(void) {
+#ifdef _OPENMP
+	return omp_get_max_threads();
+#else
+	return 1;
+#endif
+}
+
 //Function to initialize the board
 void initBoard(Board *board) {
-	for (int i = 0; i < BOARD_SIZE; i++) {
-		for (int j = 0; j < BOARD_SIZE; j++) {
-			board->board[i][j] = EMPTY;
-		}
+	for (int player = EMPTY; player <= O; player++) {
+		board->cells[player] = 0;
+		board->state[player] = 0;
 	}
 }
 
+//Function to check if a cell is empty
+bool isEmpty(Board *board, int cell) {
+	return !((board->cells[X] | board->cells[O]) >> cell & 1);
+}
+
 //Function to initialize the agent
 void initAgent(Agent *agent) {
-	for (int i = 0; i < NUM_STATES; i++) {
-		for (int j = 0; j < NUM_ACTIONS; j++) {
-			agent->q[i][j] = 0.0;
-		}
+	agent->q = calloc(NUM_CANONICAL_STATES, sizeof(*agent->q));
+	if (agent->q == NULL) {
+		printf("Not enough memory for the Q-table\n");
+		exit(1);
 	}
+	agent->episodes = 0;
 	agent->player = X;
+	agent->mapped = false;
+}
+
+//Function to free the Q-table of the agent, or unmap it
+void freeAgent(Agent *agent) {
+	if (agent->mapped) {
+		mapped_file_close(&agent->file);
+	}
+	else {
+		free(agent->q);
+	}
+	agent->q = NULL;
 }
 
 //Function to print the board
 void printBoard(Board *board) {
 	for (int i = 0; i < BOARD_SIZE; i++) {
 		for (int j = 0; j < BOARD_SIZE; j++) {
-			if (board->board[i][j] == EMPTY) {
+			int cell = i * BOARD_SIZE + j;
+			if (isEmpty(board, cell)) {
 				printf(" ");
 			}
-			else if (board->board[i][j] == X) {
+			else if (board->cells[X] >> cell & 1) {
 				printf("X");
 			}
 			else {
@@ -69,80 +218,249 @@ void printBoard(Board *board) {
 	}
 }
 
-//Function to update the q-values
-void updateQ(Agent *agent, int state, int action, double reward, int next_state) {
-	double max_next_q = agent->q[next_state][0];
-	for (int i = 1; i < NUM_ACTIONS; i++) {
-		if (agent->q[next_state][i] > max_next_q) {
-			max_next_q = agent->q[next_state][i];
-		}
+//Function to get the state: the board as a base-3 number with a digit per cell, 0 if it is empty, 1 if it is the
+//player's and 2 if it is the opponent's
+int getState(Board *board, int player) {
+	return board->state[player];
+}
+
+//Function to update the board, and the encoding seen by each player with the digit of the new piece
+void updateBoard(Board *board, int action, int player) {
+	int opponent = (player == X) ? O : X;
+	board->cells[player] |= 1 << action;
+	board->state[player] += POWERS_OF_3[action];
+	board->state[opponent] += 2 * POWERS_OF_3[action];
+}
+
+//Function to check if there is a winner
+bool checkWin (Board * board){
+	return (winning[board->cells[X]] || winning[board->cells[O]]);
+}
+
+//Function to check if there is a draw
+bool checkDraw(Board *board) {
+	return ((board->cells[X] | board->cells[O]) == FULL_BOARD);
+}
+
+//Function to check if the game is over
+bool gameOver(Board *board, int player) {
+	return (checkWin(board) || checkDraw(board));
+}
+
+//Function to get the encoding of the board after applying a symmetry to it
+static int getSymmetricState(int state, int symmetry) {
+	int symmetric = 0;
+	for (int cell = 0; cell < NUM_ACTIONS; cell++, state /= 3) {
+		symmetric += (state % 3) * POWERS_OF_3[SYMMETRY[symmetry][cell]];
 	}
-	agent->q[state][action] += ALPHA * (reward + GAMMA * max_next_q - agent->q[state][action]);
+	return symmetric;
 }
 
-//Function to get the state
-int getState(Board *board, int player) {
-	int state = 0;
-	int k = 0;
-	for (int i = 0; i < BOARD_SIZE; i++) {
-		for (int j = 0; j < BOARD_SIZE; j++) {
-			if (board->board[i][j] == EMPTY) {
-				state += 0 * pow(3, k);
-			}
-			else if (board->board[i][j] == player) {
-				state += 1 * pow(3, k);
-			}
-			else {
-				state += 2 * pow(3, k);
+//Function to add a board and everything reachable from it to the state table
+static void addReachableStates(Board *board, int player, bool *visited) {
+	int state = getState(board, player);
+	if (visited[state]) {
+		return;
+	}
+	visited[state] = true;
+	bool over = gameOver(board, player);
+
+	int canonical = state;
+	int symmetry = 0;
+	for (int s = 1; s < NUM_SYMMETRIES; s++) {
+		int symmetric = getSymmetricState(state, s);
+		if (symmetric < canonical) {
+			canonical = symmetric;
+			symmetry = s;
+		}
+	}
+	if (states.row[canonical] < 0) {
+		// First board of its class: the canonical board gets the next row
+		int row = states.count++;
+		states.row[canonical] = (short)row;
+		states.symmetry[canonical] = 0;
+		states.canonical[row] = canonical;
+		states.legal[row] = 0;
+		for (int cell = 0; cell < NUM_ACTIONS && !over; cell++) {
+			if (isEmpty(board, cell)) {
+				states.legal[row] |= 1 << SYMMETRY[symmetry][cell];
 			}
-			k++;
 		}
 	}
-	return state;
-}
+	states.row[state] = states.row[canonical];
+	states.symmetry[state] = (unsigned char)symmetry;
 
-//Function to update the board
-void updateBoard(Board *board, int action, int player) {
-	int i = action / BOARD_SIZE;
-	int j = action % BOARD_SIZE;
-	board->board[i][j] = player;
+	if (over) {
+		return;
+	}
+	int opponent = (player == X) ? O : X;
+	for (int action = 0; action < NUM_ACTIONS; action++) {
+		if (isEmpty(board, action)) {
+			Board next = *board;
+			updateBoard(&next, action, player);
+			addReachableStates(&next, opponent, visited);
+		}
+	}
 }
 
-//Function to check if there is a winner
-bool checkWin (Board * board){
-	// Check rows and columns
-	for (int i = 0; i < BOARD_SIZE; i++) {
-		if ((board->board[i][0] == board->board[i][1] && board->board[i][1] == board->board[i][2] && board->board[i][0] != 0) ||
-			(board->board[0][i] == board->board[1][i] && board->board[1][i] == board->board[2][i] && board->board[0][i] != 0)) {
-			return (true);
+//Function to build the table of winning cell sets, and the state table by playing every possible game once
+void initStates(void) {
+	for (int cells = 0; cells <= FULL_BOARD; cells++) {
+		winning[cells] = false;
+		for (int line = 0; line < 8; line++) {
+			if ((cells & LINES[line]) == LINES[line]) {
+				winning[cells] = true;
+			}
 		}
 	}
+	for (int i = 0; i < NUM_STATES; i++) {
+		states.row[i] = -1;
+	}
+	states.count = 0;
+	bool *visited = calloc(NUM_STATES, sizeof(bool));
+	Board board;
+	initBoard(&board);
+	addReachableStates(&board, X, visited);
+	free(visited);
+	for (int i = 0; i < NUM_STATES; i++) {
+		int row = states.row[i];
+		states.packed[i] = row < 0 ? 0 : (unsigned)row | (unsigned)states.symmetry[i] << 10 | (unsigned)states.legal[row] << 13;
+	}
+	for (int symmetry = 0; symmetry < NUM_SYMMETRIES; symmetry++) {
+		for (int action = 0; action < NUM_ACTIONS; action++) {
+			states.cell[symmetry][action] = SYMMETRY[INVERSE_SYMMETRY[symmetry]][action];
+		}
+	}
+}
 
-	// Check diagonals
-	if ((board->board[0][0] == board->board[1][1] && board->board[1][1] == board->board[2][2] && board->board[0][0] != 0) ||
-		(board->board[0][2] == board->board[1][1] && board->board[1][1] == board->board[2][0] && board->board[0][2] != 0)) {
-		return (true);
+//Function to search a position with negamax and alpha-beta pruning: the value for the player to move, exact if it
+//lies strictly between alpha and beta, otherwise a bound on the side it fell. Values are kept in the
+//transposition table, with their bound, for every canonical board searched.
+static int solve(Board *board, int player, int alpha, int beta) {
+	solver.nodes++;
+	int row = states.row[getState(board, player)];
+	int value = solver.value[row];
+	switch (solver.bound[row]) {
+	case BOUND_EXACT:
+		return value;
+	case BOUND_LOWER:
+		if (value >= beta) {
+			return value;
+		}
+		break;
+	case BOUND_UPPER:
+		if (value <= alpha) {
+			return value;
+		}
+		break;
 	}
+	// The opponent has just moved, so a line on the board is theirs
+	if (checkWin(board)) {
+		value = -1;
+	}
+	else if (checkDraw(board)) {
+		value = 0;
+	}
+	else {
+		// Center first, then corners, then edges: the best moves come first and the rest are cut sooner
+		static const int order[NUM_ACTIONS] = {4, 0, 2, 6, 8, 1, 3, 5, 7};
+		int opponent = (player == X) ? O : X;
+		int original_alpha = alpha;
+		value = -2;
+		for (int i = 0; i < NUM_ACTIONS && alpha < beta; i++) {
+			if (!isEmpty(board, order[i])) {
+				continue;
+			}
+			Board next = *board;
+			updateBoard(&next, order[i], player);
+			int child = -solve(&next, opponent, -beta, -alpha);
+			if (child > value) {
+				value = child;
+			}
+			if (value > alpha) {
+				alpha = value;
+			}
+		}
+		solver.value[row] = (signed char)value;
+		solver.bound[row] = value <= original_alpha ? BOUND_UPPER : value >= beta ? BOUND_LOWER : BOUND_EXACT;
+		return value;
+	}
+	solver.value[row] = (signed char)value;
+	solver.bound[row] = BOUND_EXACT;
+	return value;
+}
 
-	// No win state
-	return (false);
+//Function to get the board of an encoding seen by the player to move (1: their pieces, 2: the opponent's)
+static Board decodeBoard(int state, int *player) {
+	int own = 0, other = 0;
+	for (int cell = 0, rest = state; cell < NUM_ACTIONS; cell++, rest /= 3) {
+		own |= (rest % 3 == 1) << cell;
+		other |= (rest % 3 == 2) << cell;
+	}
+	// X moves when both have the same number of pieces
+	*player = __builtin_popcount(own) == __builtin_popcount(other) ? X : O;
+	int opponent = (*player == X) ? O : X;
+	Board board;
+	initBoard(&board);
+	for (int cell = 0; cell < NUM_ACTIONS; cell++) {
+		if (own >> cell & 1) {
+			updateBoard(&board, cell, *player);
+		}
+		else if (other >> cell & 1) {
+			updateBoard(&board, cell, opponent);
+		}
+	}
+	return board;
 }
 
-//Function to check if there is a draw
-bool checkDraw(Board *board) {
-	for (int i = 0; i < BOARD_SIZE; i++) {
-		for (int j = 0; j < BOARD_SIZE; j++) {
-			if (board->board[i][j] == EMPTY) {
-				return false;
+//Function to solve every reachable position: the exact value of each canonical board and the moves that keep
+//it. A search with the window (-1, 1) is exact, since no value lies outside it.
+void initSolver(void) {
+	memset(&solver, 0, sizeof(solver));
+	for (int row = 0; row < states.count; row++) {
+		int player;
+		Board board = decodeBoard(states.canonical[row], &player);
+		solver.value[row] = (signed char)solve(&board, player, -1, 1);
+		solver.bound[row] = BOUND_EXACT;
+	}
+	for (int row = 0; row < states.count; row++) {
+		int player;
+		Board board = decodeBoard(states.canonical[row], &player);
+		int opponent = (player == X) ? O : X;
+		solver.optimal[row] = 0;
+		for (int action = 0; action < NUM_ACTIONS; action++) {
+			if (states.legal[row] >> action & 1) {
+				Board next = board;
+				updateBoard(&next, action, player);
+				if (-solver.value[states.row[getState(&next, opponent)]] == solver.value[row]) {
+					solver.optimal[row] |= 1 << action;
+				}
 			}
 		}
 	}
-	return true;
 }
 
-//Function to check if the game is over
-bool gameOver(Board *board, int player) {
-	return (checkWin(board) || checkDraw(board));
+//Function to get the highest Q-value among the legal actions of a state
+float getMaxQ(Agent *agent, int state) {
+	int row = states.row[state];
+	float max_q = -FLT_MAX;
+	for (int i = 0; i < NUM_ACTIONS; i++) {
+		if ((states.legal[row] >> i & 1) && agent->q[row][i] > max_q) {
+			max_q = agent->q[row][i];
+		}
+	}
+	return max_q;
+}
+
+//Function to update the q-values. The value of the next state is the best one for the opponent, who moves
+//there, so it counts against the player: Q(s, a) += ALPHA * (reward - GAMMA * max Q(s', a') - Q(s, a))
+void updateQ(Agent *agent, int state, int action, double reward, int next_state, bool done) {
+	double target = reward;
+	if (!done) {
+		target -= GAMMA * getMaxQ(agent, next_state);
+	}
+	float *q = &agent->q[states.row[state]][SYMMETRY[states.symmetry[state]][action]];
+	*q += (float)(ALPHA * (target - *q));
 }
 
 //Function to get the reward
@@ -163,76 +481,941 @@ double getReward(Board *board, int player) {
 	}
 }
 
-//Function to get the best action following the epsilon-greedy policy
-int getBestAction(Agent *agent, int state) {
-	int best_action = 0;
-	if ((double)rand() / (double)RAND_MAX < EPSILON) {
-		best_action = rand() % NUM_ACTIONS;
+//Function to get the best action following the epsilon-greedy policy. Only empty cells are considered; the
+//action is found on the canonical board and turned back into a cell of this one.
+int getBestAction(Agent *agent, int state, double epsilon, Rng *random) {
+	int row = states.row[state];
+	unsigned legal = states.legal[row];
+	int best_action = -1;
+	if (epsilon > 0 && rng_uniform(random) < epsilon) {
+		int count = 0;
+		for (int i = 0; i < NUM_ACTIONS; i++) {
+			count += legal >> i & 1;
+		}
+		int choice = (int)rng_below(random, count);
+		for (int i = 0; i < NUM_ACTIONS; i++) {
+			if ((legal >> i & 1) && choice-- == 0) {
+				best_action = i;
+				break;
+			}
+		}
 	}
 	else {
-		double max_q = agent->q[state][0];
-		for (int i = 1; i < NUM_ACTIONS; i++) {
-			if (agent->q[state][i] > max_q) {
-				max_q = agent->q[state][i];
+		float max_q = -FLT_MAX;
+		for (int i = 0; i < NUM_ACTIONS; i++) {
+			if ((legal >> i & 1) && agent->q[row][i] > max_q) {
+				max_q = agent->q[row][i];
 				best_action = i;
 			}
 		}
 	}
-	return best_action;
+	return SYMMETRY[INVERSE_SYMMETRY[states.symmetry[state]]][best_action];
 }
 
-//Function to train the agent
-void train(Agent *agent) {
+//Function to play one training game of the agent against itself: each move is learned from the point of view
+//of the player who makes it, against the best reply the opponent knows
+void playEpisode(Agent *agent, Rng *random) {
 	Board board;
 	initBoard(&board);
-	for (int i = 0; i < EPISODES; i++) {
-		initBoard(&board);
-		int state = getState(&board, agent->player);
-		while (!gameOver(&board, agent->player)) {
-			updateBoard(&board, getBestAction(agent, state), agent->player);
-			int next_state = getState(&board, agent->player);
-			double reward = getReward(&board, agent->player);
-			updateQ(agent, state, getBestAction(agent, state), reward, next_state);
-			state = next_state;
-			agent->player = (agent->player == X) ? O : X;
+	int player = X;
+	int state = getState(&board, player);
+	while (true) {
+		int action = getBestAction(agent, state, EPSILON, random);
+		updateBoard(&board, action, player);
+		int opponent = (player == X) ? O : X;
+		int next_state = getState(&board, opponent);
+		if (checkWin(&board)) {
+			updateQ(agent, state, action, REWARD_WIN, next_state, true);
+			break;
+		}
+		if (checkDraw(&board)) {
+			updateQ(agent, state, action, REWARD_DRAW, next_state, true);
+			break;
 		}
+		updateQ(agent, state, action, 0.0, next_state, false);
+		state = next_state;
+		player = opponent;
 	}
 }
 
-//Function to export the q-values to a .csv file
-void exportQ(Agent *agent) {
-	FILE *file = fopen("q_table.csv", "w");
-	for (int i = 0; i < NUM_STATES; i++) {
-		for (int j = 0; j < NUM_ACTIONS; j++) {
-			fprintf(file, "%lf", agent->q[i][j]);
-			if (j < NUM_ACTIONS - 1) {
-				fprintf(file, ",");
+//Function to make one move in every game of the batch: the same epsilon-greedy choice among the empty cells as
+//getBestAction, the move, the check for the end of the game and the target of updateQ. Every step is written
+//without branches on the game, LANES games at a time, as the vector kernels below do it; all kernels give
+//exactly the same moves and targets. The Q-values themselves are updated afterwards by playBatch.
+static void batchPortable(const Agent *agent, Batch *batch, int player) {
+	int opponent = (player == X) ? O : X;
+	const float *q = &agent->q[0][0];
+	for (int first = 0; first < BATCH_GAMES; first += LANES) {
+		unsigned packed[LANES], action[LANES], chosen[LANES], skip[LANES], random[LANES], next[LANES];
+		float best[LANES];
+		for (int j = 0; j < LANES; j++) {
+			packed[j] = states.packed[batch->state[player][first + j]];
+			unsigned r = batch->random[first + j];
+			r ^= r << 13;
+			r ^= r >> 17;
+			r ^= r << 5;
+			batch->random[first + j] = r;
+			random[j] = r;
+			unsigned count = 0;
+			for (int i = 0; i < NUM_ACTIONS; i++) {
+				count += packed[j] >> (13 + i) & 1;
 			}
+			skip[j] = ((r & 0xFFFF) * count) >> 16;
+			best[j] = -FLT_MAX;
+			action[j] = 0;
+			chosen[j] = 0;
+		}
+		// Greedy action and, for the games that explore, the skip-th empty cell
+		for (int i = 0; i < NUM_ACTIONS; i++) {
+			for (int j = 0; j < LANES; j++) {
+				unsigned bit = packed[j] >> (13 + i) & 1;
+				float value = bit ? q[(packed[j] & 0x3FF) * NUM_ACTIONS + i] : -FLT_MAX;
+				action[j] = value > best[j] ? (unsigned)i : action[j];
+				best[j] = value > best[j] ? value : best[j];
+				chosen[j] = (bit && skip[j] == 0) ? (unsigned)i : chosen[j];
+				skip[j] -= bit;
+			}
+		}
+		int done[LANES];
+		float reward[LANES];
+		for (int j = 0; j < LANES; j++) {
+			int g = first + j;
+			action[j] = (random[j] >> 16) < EPSILON_THRESHOLD ? chosen[j] : action[j];
+			batch->index[g] = (int)((packed[j] & 0x3FF) * NUM_ACTIONS + action[j]);
+			int cell = states.cell[packed[j] >> 10 & 7][action[j]];
+			int active = batch->active[g];
+			int mine = batch->cells[player][g] | ((1 << cell) & active);
+			batch->cells[player][g] = mine;
+			batch->state[player][g] += POWERS_OF_3[cell] & active;
+			batch->state[opponent][g] += (2 * POWERS_OF_3[cell]) & active;
+			int win = 0;
+			for (int line = 0; line < 8; line++) {
+				win |= (mine & LINES[line]) == LINES[line];
+			}
+			int draw = (mine | batch->cells[opponent][g]) == FULL_BOARD;
+			done[j] = win | draw;
+			reward[j] = win ? (float)REWARD_WIN : (float)REWARD_DRAW;
+			next[j] = states.packed[batch->state[opponent][g]];
+			best[j] = -FLT_MAX;
+		}
+		// Best Q-value of the opponent after the move
+		for (int i = 0; i < NUM_ACTIONS; i++) {
+			for (int j = 0; j < LANES; j++) {
+				float value = (next[j] >> (13 + i) & 1) ? q[(next[j] & 0x3FF) * NUM_ACTIONS + i] : -FLT_MAX;
+				best[j] = value > best[j] ? value : best[j];
+			}
+		}
+		for (int j = 0; j < LANES; j++) {
+			batch->target[first + j] = done[j] ? reward[j] : (float)-GAMMA * best[j];
+			batch->active[first + j] &= -(!done[j]);
+		}
+	}
+}
+
+#ifdef TTT_X86_DISPATCH
+// batchPortable with one game per lane of an AVX2 register: the table lookups are gathers and the choices are
+// all-ones lanes used as blend masks
+__attribute__((target("avx2")))
+static void batchAvx2(const Agent *agent, Batch *batch, int player) {
+	int opponent = (player == X) ? O : X;
+	const float *q = &agent->q[0][0];
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i one = _mm256_set1_epi32(1);
+	const __m256i nine = _mm256_set1_epi32(NUM_ACTIONS);
+	const __m256i rows = _mm256_set1_epi32(0x3FF);
+	const __m256 lowest = _mm256_set1_ps(-FLT_MAX);
+	for (int first = 0; first < BATCH_GAMES; first += 8) {
+		__m256i packed = _mm256_i32gather_epi32((const int *)states.packed,
+			_mm256_loadu_si256((const __m256i *)&batch->state[player][first]), 4);
+		__m256i r = _mm256_loadu_si256((const __m256i *)&batch->random[first]);
+		r = _mm256_xor_si256(r, _mm256_slli_epi32(r, 13));
+		r = _mm256_xor_si256(r, _mm256_srli_epi32(r, 17));
+		r = _mm256_xor_si256(r, _mm256_slli_epi32(r, 5));
+		_mm256_storeu_si256((__m256i *)&batch->random[first], r);
+		__m256i legal = _mm256_srli_epi32(packed, 13);
+		__m256i count = zero;
+		for (int i = 0; i < NUM_ACTIONS; i++) {
+			count = _mm256_add_epi32(count, _mm256_and_si256(_mm256_srli_epi32(legal, i), one));
+		}
+		__m256i skip = _mm256_srli_epi32(_mm256_mullo_epi32(_mm256_and_si256(r, _mm256_set1_epi32(0xFFFF)), count), 16);
+		__m256i base = _mm256_mullo_epi32(_mm256_and_si256(packed, rows), nine);
+		__m256 best = lowest;
+		__m256i action = zero, chosen = zero;
+		for (int i = 0; i < NUM_ACTIONS; i++) {
+			__m256i index = _mm256_set1_epi32(i);
+			__m256i bit = _mm256_cmpeq_epi32(_mm256_and_si256(legal, _mm256_set1_epi32(1 << i)), _mm256_set1_epi32(1 << i));
+			__m256 value = _mm256_mask_i32gather_ps(lowest, q, _mm256_add_epi32(base, index), _mm256_castsi256_ps(bit), 4);
+			__m256 better = _mm256_cmp_ps(value, best, _CMP_GT_OQ);
+			action = _mm256_blendv_epi8(action, index, _mm256_castps_si256(better));
+			best = _mm256_blendv_ps(best, value, better);
+			chosen = _mm256_blendv_epi8(chosen, index, _mm256_and_si256(bit, _mm256_cmpeq_epi32(skip, zero)));
+			skip = _mm256_add_epi32(skip, bit);
+		}
+		__m256i explore = _mm256_cmpgt_epi32(_mm256_set1_epi32(EPSILON_THRESHOLD), _mm256_srli_epi32(r, 16));
+		action = _mm256_blendv_epi8(action, chosen, explore);
+		_mm256_storeu_si256((__m256i *)&batch->index[first], _mm256_add_epi32(base, action));
+		__m256i symmetry = _mm256_and_si256(_mm256_srli_epi32(packed, 10), _mm256_set1_epi32(7));
+		__m256i cell = _mm256_i32gather_epi32(&states.cell[0][0], _mm256_add_epi32(_mm256_mullo_epi32(symmetry, nine), action), 4);
+		__m256i active = _mm256_loadu_si256((const __m256i *)&batch->active[first]);
+		__m256i mine = _mm256_or_si256(_mm256_loadu_si256((const __m256i *)&batch->cells[player][first]),
+			_mm256_and_si256(_mm256_sllv_epi32(one, cell), active));
+		_mm256_storeu_si256((__m256i *)&batch->cells[player][first], mine);
+		__m256i power = _mm256_and_si256(_mm256_i32gather_epi32(POWERS_OF_3, cell, 4), active);
+		__m256i state = _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)&batch->state[opponent][first]),
+			_mm256_add_epi32(power, power));
+		_mm256_storeu_si256((__m256i *)&batch->state[player][first],
+			_mm256_add_epi32(_mm256_loadu_si256((const __m256i *)&batch->state[player][first]), power));
+		_mm256_storeu_si256((__m256i *)&batch->state[opponent][first], state);
+		__m256i win = zero;
+		for (int line = 0; line < 8; line++) {
+			__m256i mask = _mm256_set1_epi32(LINES[line]);
+			win = _mm256_or_si256(win, _mm256_cmpeq_epi32(_mm256_and_si256(mine, mask), mask));
+		}
+		__m256i draw = _mm256_cmpeq_epi32(_mm256_or_si256(mine,
+			_mm256_loadu_si256((const __m256i *)&batch->cells[opponent][first])), _mm256_set1_epi32(FULL_BOARD));
+		__m256i done = _mm256_or_si256(win, draw);
+		__m256i next = _mm256_i32gather_epi32((const int *)states.packed, state, 4);
+		legal = _mm256_srli_epi32(next, 13);
+		base = _mm256_mullo_epi32(_mm256_and_si256(next, rows), nine);
+		best = lowest;
+		for (int i = 0; i < NUM_ACTIONS; i++) {
+			__m256i bit = _mm256_cmpeq_epi32(_mm256_and_si256(legal, _mm256_set1_epi32(1 << i)), _mm256_set1_epi32(1 << i));
+			__m256 value = _mm256_mask_i32gather_ps(lowest, q, _mm256_add_epi32(base, _mm256_set1_epi32(i)),
+				_mm256_castsi256_ps(bit), 4);
+			best = _mm256_max_ps(best, value);
+		}
+		__m256 reward = _mm256_blendv_ps(_mm256_set1_ps((float)REWARD_DRAW), _mm256_set1_ps((float)REWARD_WIN),
+			_mm256_castsi256_ps(win));
+		__m256 target = _mm256_blendv_ps(_mm256_mul_ps(_mm256_set1_ps((float)-GAMMA), best), reward, _mm256_castsi256_ps(done));
+		_mm256_storeu_ps(&batch->target[first], target);
+		_mm256_storeu_si256((__m256i *)&batch->active[first], _mm256_andnot_si256(done, active));
+	}
+}
+
+// batchPortable with one game per lane of an AVX-512 register: the table lookups are gathers and the choices are
+// mask registers
+__attribute__((target("avx512f")))
+static void batchAvx512(const Agent *agent, Batch *batch, int player) {
+	int opponent = (player == X) ? O : X;
+	const float *q = &agent->q[0][0];
+	const __m512i zero = _mm512_setzero_si512();
+	const __m512i one = _mm512_set1_epi32(1);
+	const __m512i nine = _mm512_set1_epi32(NUM_ACTIONS);
+	const __m512i rows = _mm512_set1_epi32(0x3FF);
+	const __m512i powers = _mm512_setr_epi32(1, 3, 9, 27, 81, 243, 729, 2187, 6561, 0, 0, 0, 0, 0, 0, 0);
+	const __m512 lowest = _mm512_set1_ps(-FLT_MAX);
+	for (int first = 0; first < BATCH_GAMES; first += LANES) {
+		__m512i packed = _mm512_i32gather_epi32(_mm512_loadu_si512(&batch->state[player][first]), (const void *)states.packed, 4);
+		__m512i r = _mm512_loadu_si512(&batch->random[first]);
+		r = _mm512_xor_si512(r, _mm512_slli_epi32(r, 13));
+		r = _mm512_xor_si512(r, _mm512_srli_epi32(r, 17));
+		r = _mm512_xor_si512(r, _mm512_slli_epi32(r, 5));
+		_mm512_storeu_si512(&batch->random[first], r);
+		__m512i legal = _mm512_srli_epi32(packed, 13);
+		__m512i count = zero;
+		for (int i = 0; i < NUM_ACTIONS; i++) {
+			count = _mm512_add_epi32(count, _mm512_and_si512(_mm512_srli_epi32(legal, i), one));
+		}
+		__m512i skip = _mm512_srli_epi32(_mm512_mullo_epi32(_mm512_and_si512(r, _mm512_set1_epi32(0xFFFF)), count), 16);
+		__m512i base = _mm512_mullo_epi32(_mm512_and_si512(packed, rows), nine);
+		__m512 best = lowest;
+		__m512i action = zero, chosen = zero;
+		for (int i = 0; i < NUM_ACTIONS; i++) {
+			__m512i index = _mm512_set1_epi32(i);
+			__mmask16 bit = _mm512_test_epi32_mask(legal, _mm512_set1_epi32(1 << i));
+			__m512 value = _mm512_mask_i32gather_ps(lowest, bit, _mm512_add_epi32(base, index), q, 4);
+			__mmask16 better = _mm512_cmp_ps_mask(value, best, _CMP_GT_OQ);
+			action = _mm512_mask_mov_epi32(action, better, index);
+			best = _mm512_mask_mov_ps(best, better, value);
+			chosen = _mm512_mask_mov_epi32(chosen, bit & _mm512_cmpeq_epi32_mask(skip, zero), index);
+			skip = _mm512_mask_sub_epi32(skip, bit, skip, one);
+		}
+		__mmask16 explore = _mm512_cmplt_epu32_mask(_mm512_srli_epi32(r, 16), _mm512_set1_epi32(EPSILON_THRESHOLD));
+		action = _mm512_mask_mov_epi32(action, explore, chosen);
+		_mm512_storeu_si512(&batch->index[first], _mm512_add_epi32(base, action));
+		__m512i symmetry = _mm512_and_si512(_mm512_srli_epi32(packed, 10), _mm512_set1_epi32(7));
+		__m512i cell = _mm512_i32gather_epi32(_mm512_add_epi32(_mm512_mullo_epi32(symmetry, nine), action),
+			(const void *)&states.cell[0][0], 4);
+		__m512i active = _mm512_loadu_si512(&batch->active[first]);
+		__m512i mine = _mm512_or_si512(_mm512_loadu_si512(&batch->cells[player][first]),
+			_mm512_and_si512(_mm512_sllv_epi32(one, cell), active));
+		_mm512_storeu_si512(&batch->cells[player][first], mine);
+		__m512i power = _mm512_and_si512(_mm512_permutexvar_epi32(cell, powers), active);
+		__m512i state = _mm512_add_epi32(_mm512_loadu_si512(&batch->state[opponent][first]), _mm512_add_epi32(power, power));
+		_mm512_storeu_si512(&batch->state[player][first], _mm512_add_epi32(_mm512_loadu_si512(&batch->state[player][first]), power));
+		_mm512_storeu_si512(&batch->state[opponent][first], state);
+		__mmask16 win = 0;
+		for (int line = 0; line < 8; line++) {
+			__m512i mask = _mm512_set1_epi32(LINES[line]);
+			win |= _mm512_cmpeq_epi32_mask(_mm512_and_si512(mine, mask), mask);
+		}
+		__mmask16 draw = _mm512_cmpeq_epi32_mask(_mm512_or_si512(mine, _mm512_loadu_si512(&batch->cells[opponent][first])),
+			_mm512_set1_epi32(FULL_BOARD));
+		__mmask16 done = win | draw;
+		__m512i next = _mm512_i32gather_epi32(state, (const void *)states.packed, 4);
+		legal = _mm512_srli_epi32(next, 13);
+		base = _mm512_mullo_epi32(_mm512_and_si512(next, rows), nine);
+		best = lowest;
+		for (int i = 0; i < NUM_ACTIONS; i++) {
+			__mmask16 bit = _mm512_test_epi32_mask(legal, _mm512_set1_epi32(1 << i));
+			__m512 value = _mm512_mask_i32gather_ps(lowest, bit, _mm512_add_epi32(base, _mm512_set1_epi32(i)), q, 4);
+			best = _mm512_max_ps(best, value);
+		}
+		__m512 reward = _mm512_mask_blend_ps(win, _mm512_set1_ps((float)REWARD_DRAW), _mm512_set1_ps((float)REWARD_WIN));
+		__m512 target = _mm512_mask_blend_ps(done, _mm512_mul_ps(_mm512_set1_ps((float)-GAMMA), best), reward);
+		_mm512_storeu_ps(&batch->target[first], target);
+		_mm512_storeu_si512(&batch->active[first], _mm512_mask_mov_epi32(active, done, zero));
+	}
+}
+#endif
+
+//Function to choose the widest batched kernel the CPU supports
+static BatchKernel getBatchKernel(void) {
+#ifdef TTT_X86_DISPATCH
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) {
+		return batchAvx512;
+	}
+	if (__builtin_cpu_supports("avx2")) {
+		return batchAvx2;
+	}
+#endif
+	return batchPortable;
+}
+
+//Function to play `games` (at most BATCH_GAMES) training games in lockstep, the batched backend of playEpisode. At
+//every step all the games choose their move from the same Q-table, then the Q-values of their moves are updated
+//one game after another, so that two games updating the same value both count, as they would one after the other.
+//The kernel comes from getBatchKernel, chosen by the caller before any worker starts.
+void playBatch(Agent *agent, Batch *batch, int games, Rng *random, BatchKernel kernel) {
+	for (int g = 0; g < BATCH_GAMES; g++) {
+		batch->cells[X][g] = batch->cells[O][g] = 0;
+		batch->state[X][g] = batch->state[O][g] = 0;
+		batch->active[g] = g < games ? -1 : 0;
+		batch->random[g] = (unsigned)(rng_next(random) >> 32) | 1;
+	}
+	int player = X;
+	for (int move = 0; move < NUM_ACTIONS; move++) {
+		int active[BATCH_GAMES];
+		memcpy(active, batch->active, sizeof(active));
+		kernel(agent, batch, player);
+		float *q = &agent->q[0][0];
+		for (int g = 0; g < games; g++) {
+			if (active[g]) {
+				float *value = &q[batch->index[g]];
+				*value += (float)(ALPHA * (batch->target[g] - *value));
+			}
+		}
+		player = (player == X) ? O : X;
+	}
+}
+
+//Function to merge the copies of the workers into the agent: each Q-value becomes the mean of the copies that
+//changed it, added in worker order, and stays as it was if none did
+void mergeAgents(Agent *agent, Agent *copies, int workers) {
+	float *q = &agent->q[0][0];
+	for (int i = 0; i < NUM_CANONICAL_STATES * NUM_ACTIONS; i++) {
+		double sum = 0;
+		int changed = 0;
+		for (int w = 0; w < workers; w++) {
+			float value = (&copies[w].q[0][0])[i];
+			if (value != q[i]) {
+				sum += value;
+				changed++;
+			}
+		}
+		if (changed > 0) {
+			q[i] = (float)(sum / changed);
+		}
+	}
+}
+
+int saveQ(Agent *agent, const char *filename);
+void printCheckpointEvaluation(Agent *agent, int games, unsigned long long seed);
+
+//Function to train the agent with several workers, one per thread, each with its own copy of the Q-table and its
+//own random numbers. After every SYNC_EPISODES episodes of each worker the copies are merged into the agent and
+//the workers start again from the merged table; nothing is shared while they play. Training goes on until the
+//agent has played `episodes` episodes in total, so a table loaded from a checkpoint only plays the rest. The
+//random numbers of a round depend only on the seed and the episodes played before it: each round seeds a stream
+//and worker w takes the part of it w jumps of 2^128 numbers ahead. With one worker this is
+//plain serial training, and for a seed and a number of workers the result is always the same, resumed or not.
+//Every checkpoint_every episodes (0: never) the table is saved to checkpoint_path and, if evaluate_games is not
+//0, played that many games per side against the solver and a random player; returns the seconds this took. The backend plays the episodes
+//of each worker one at a time (playEpisode) or BATCH_GAMES at a time (playBatch).
+double train(Agent *agent, long long episodes, int workers, unsigned long long seed, Backend backend,
+	long long checkpoint_every, const char *checkpoint_path, int evaluate_games) {
+	double checkpoint_seconds = 0;
+	Agent *copies = malloc(workers * sizeof(Agent));
+	if (copies == NULL) {
+		printf("Not enough memory for %d workers\n", workers);
+		exit(1);
+	}
+	for (int w = 0; w < workers; w++) {
+		initAgent(&copies[w]);
+	}
+	BatchKernel kernel = getBatchKernel();
+	while (agent->episodes < episodes) {
+		long long round = episodes - agent->episodes < SYNC_EPISODES * workers ? episodes - agent->episodes : SYNC_EPISODES * workers;
+#pragma omp parallel for num_threads(workers) schedule(static)
+		for (int w = 0; w < workers; w++) {
+			Rng random;
+			rng_seed(&random, seed, agent->episodes);
+			for (int j = 0; j < w; j++) {
+				rng_jump(&random);
+			}
+			memcpy(copies[w].q, agent->q, Q_TABLE_BYTES);
+			long long count = round * (w + 1) / workers - round * w / workers;
+			if (backend == BACKEND_BATCH) {
+				Batch batch;
+				for (long long i = 0; i < count; i += BATCH_GAMES) {
+					playBatch(&copies[w], &batch, count - i < BATCH_GAMES ? (int)(count - i) : BATCH_GAMES, &random, kernel);
+				}
+			}
+			else {
+				for (long long i = 0; i < count; i++) {
+					playEpisode(&copies[w], &random);
+				}
+			}
+		}
+		mergeAgents(agent, copies, workers);
+		agent->episodes += round;
+		if (checkpoint_every > 0 && agent->episodes < episodes && agent->episodes / checkpoint_every != (agent->episodes - round) / checkpoint_every) {
+			double start = secondsNow();
+			if (saveQ(agent, checkpoint_path) == 0) {
+				printf("Checkpoint: %lld episodes saved to %s\n", agent->episodes, checkpoint_path);
+			}
+			else {
+				printf("Could not write the checkpoint %s\n", checkpoint_path);
+			}
+			if (evaluate_games > 0) {
+				printCheckpointEvaluation(agent, evaluate_games, seed);
+			}
+			checkpoint_seconds += secondsNow() - start;
+		}
+	}
+	for (int w = 0; w < workers; w++) {
+		freeAgent(&copies[w]);
+	}
+	free(copies);
+	return checkpoint_seconds;
+}
+
+//Function to get the move of a fixed opponent
+int getOpponentAction(Board *board, int player, Opponent opponent, Rng *random) {
+	int other = (player == X) ? O : X;
+	unsigned empty = ~(board->cells[X] | board->cells[O]) & FULL_BOARD;
+	if (opponent == OPPONENT_SOLVER) {
+		// Only the optimal moves are candidates; they are canonical actions, turned back like getBestAction does
+		int state = getState(board, player);
+		unsigned optimal = solver.optimal[states.row[state]];
+		int choice = (int)rng_below(random, __builtin_popcount(optimal));
+		for (int action = 0; action < NUM_ACTIONS; action++) {
+			if ((optimal >> action & 1) && choice-- == 0) {
+				return states.cell[states.symmetry[state]][action];
+			}
+		}
+	}
+	if (opponent == OPPONENT_BLOCKING) {
+		// First a cell that completes a line of its own, then one that completes a line of the agent
+		for (int pass = 0; pass < 2; pass++) {
+			int who = pass == 0 ? player : other;
+			for (int cell = 0; cell < NUM_ACTIONS; cell++) {
+				if ((empty >> cell & 1) && winning[board->cells[who] | 1 << cell]) {
+					return cell;
+				}
+			}
+		}
+	}
+	int count = 0;
+	for (int cell = 0; cell < NUM_ACTIONS; cell++) {
+		count += empty >> cell & 1;
+	}
+	int choice = (int)rng_below(random, count);
+	for (int cell = 0; cell < NUM_ACTIONS; cell++) {
+		if ((empty >> cell & 1) && choice-- == 0) {
+			return cell;
+		}
+	}
+	return -1;
+}
+
+//Function to play the greedy policy of the agent, as agentPlayer, against a fixed opponent, and to count how many
+//of its moves the solver finds optimal. Games are played in parallel in blocks of GAMES_PER_BLOCK, each block
+//with its own random numbers.
+Results evaluate(Agent *agent, int agentPlayer, Opponent opponent, int games, unsigned long long seed) {
+	long long wins = 0, draws = 0, losses = 0, moves = 0, optimal = 0;
+	int blocks = (games + GAMES_PER_BLOCK - 1) / GAMES_PER_BLOCK;
+#pragma omp parallel for schedule(static) reduction(+:wins, draws, losses, moves, optimal)
+	for (int b = 0; b < blocks; b++) {
+		Rng random;
+		rng_seed(&random, seed, b);
+		int end = (b + 1) * GAMES_PER_BLOCK < games ? (b + 1) * GAMES_PER_BLOCK : games;
+		for (int g = b * GAMES_PER_BLOCK; g < end; g++) {
+			Board board;
+			initBoard(&board);
+			int player = X;
+			while (true) {
+				int action;
+				if (player == agentPlayer) {
+					int state = getState(&board, player);
+					action = getBestAction(agent, state, 0.0, &random);
+					moves++;
+					optimal += solver.optimal[states.row[state]] >> SYMMETRY[states.symmetry[state]][action] & 1;
+				}
+				else {
+					action = getOpponentAction(&board, player, opponent, &random);
+				}
+				updateBoard(&board, action, player);
+				if (checkWin(&board)) {
+					if (player == agentPlayer) {
+						wins++;
+					}
+					else {
+						losses++;
+					}
+					break;
+				}
+				if (checkDraw(&board)) {
+					draws++;
+					break;
+				}
+				player = (player == X) ? O : X;
+			}
+		}
+	}
+	Results results = {wins, draws, losses, moves, optimal};
+	return results;
+}
+
+
+//Function to print the win and loss rates of the agent against an opponent, playing each side
+void printEvaluation(Agent *agent, Opponent opponent, const char *name, unsigned long long seed) {
+	Results asX = evaluate(agent, X, opponent, EVAL_GAMES, seed);
+	Results asO = evaluate(agent, O, opponent, EVAL_GAMES, seed + 1);
+	printf("  vs %s: as X %.2f%% won %.2f%% lost, as O %.2f%% won %.2f%% lost, %.2f%% optimal moves", name,
+		100.0 * asX.wins / EVAL_GAMES, 100.0 * asX.losses / EVAL_GAMES, 100.0 * asO.wins / EVAL_GAMES,
+		100.0 * asO.losses / EVAL_GAMES, 100.0 * (asX.optimalMoves + asO.optimalMoves) / (asX.moves + asO.moves));
+}
+
+//Function to print how the agent plays at a point of its training: its wins, draws and losses as X and as O
+//against the solver and against a random player, and the fraction of all its moves that were optimal
+void printCheckpointEvaluation(Agent *agent, int games, unsigned long long seed) {
+	static const Opponent opponents[] = {OPPONENT_SOLVER, OPPONENT_RANDOM};
+	static const char *names[] = {"solver", "random"};
+	long long moves = 0, optimal = 0;
+	double start = secondsNow();
+	printf("%10lld episodes:", agent->episodes);
+	for (int i = 0; i < 2; i++) {
+		Results asX = evaluate(agent, X, opponents[i], games, seed + 2 * i);
+		Results asO = evaluate(agent, O, opponents[i], games, seed + 2 * i + 1);
+		printf(" vs %s X %.1f/%.1f/%.1f O %.1f/%.1f/%.1f,", names[i], 100.0 * asX.wins / games, 100.0 * asX.draws / games,
+			100.0 * asX.losses / games, 100.0 * asO.wins / games, 100.0 * asO.draws / games, 100.0 * asO.losses / games);
+		moves += asX.moves + asO.moves;
+		optimal += asX.optimalMoves + asO.optimalMoves;
+	}
+	double seconds = secondsNow() - start;
+	printf(" %.2f%% optimal moves (%.0f games/s)\n", 100.0 * optimal / moves, 4.0 * games / seconds);
+}
+
+//Function to compare both backends with 1, 2, 4... workers: episodes per second against the scalar backend with
+//one worker, and how well the resulting policy plays against each fixed opponent
+void runBenchmark(int episodes, int max_workers, unsigned long long seed) {
+	printf("Self-play benchmark: %d episodes, %d threads available, %d games per side against each opponent\n", episodes,
+		numberOfThreads(), EVAL_GAMES);
+	static const char *names[] = {"scalar", "batch"};
+	Agent agent;
+	double serial = 0;
+	for (int workers = 1; workers <= max_workers; workers = (workers * 2 > max_workers && workers < max_workers) ? max_workers : workers * 2) {
+		for (int backend = BACKEND_SCALAR; backend <= BACKEND_BATCH; backend++) {
+			initAgent(&agent);
+			double start = secondsNow();
+			train(&agent, episodes, workers, seed, (Backend)backend, 0, NULL, 0);
+			double rate = episodes / (secondsNow() - start);
+			if (workers == 1 && backend == BACKEND_SCALAR) {
+				serial = rate;
+			}
+			printf("%2d workers, %-6s: %9.0f episodes/s (%.2fx)\n", workers, names[backend], rate, rate / serial);
+			printEvaluation(&agent, OPPONENT_RANDOM, "random", seed);
+			printf("\n");
+			printEvaluation(&agent, OPPONENT_BLOCKING, "blocking", seed);
+			printf("\n");
+			printEvaluation(&agent, OPPONENT_SOLVER, "solver", seed);
+			printf("\n");
+			freeAgent(&agent);
+		}
+	}
+}
+
+//Function to export the q-values to a .csv file: one row per canonical board, its encoding and then its 9 values
+void exportQ(Agent *agent, const char *filename) {
+	FILE *file = fopen(filename, "w");
+	if (file == NULL) {
+		printf("Could not write %s\n", filename);
+		return;
+	}
+	for (int i = 0; i < NUM_CANONICAL_STATES; i++) {
+		fprintf(file, "%d", states.canonical[i]);
+		for (int j = 0; j < NUM_ACTIONS; j++) {
+			fprintf(file, ",%f", agent->q[i][j]);
 		}
 		fprintf(file, "\n");
 	}
 	fclose(file);
 }
 
+//Function to save the Q-table to a binary file: the episodes it was trained for, the canonical encoding of each
+//row and the Q-values exactly as they are in memory. The file is written under a temporary name and renamed, so
+//a run stopped in the middle of a checkpoint leaves the previous one intact. Returns 0 on success, -1 on error.
+int saveQ(Agent *agent, const char *filename) {
+	BinaryWriter writer;
+	if (binary_writer_open(&writer, filename, Q_TABLE_MAGIC, Q_TABLE_VERSION) != 0) {
+		return (-1);
+	}
+	QTableHeader header = {NUM_CANONICAL_STATES, NUM_ACTIONS, agent->episodes};
+	binary_write(&writer, &header, sizeof(header));
+	binary_write(&writer, states.canonical, sizeof(states.canonical));
+	binary_write(&writer, agent->q, Q_TABLE_BYTES);
+	return (binary_writer_close(&writer));
+}
+
+//Function to load a Q-table saved by saveQ. The file is mapped and the agent plays straight from its pages, which
+//are read-only; to go on training, copy is true and the values are copied into a table of its own instead.
+//Tables whose rows are not the canonical boards of this program are refused. Returns 0 on success, -1 (after
+//printing why) on error.
+int loadQ(Agent *agent, const char *filename, bool copy) {
+	MappedFile file;
+	if (mapped_file_open(&file, filename) != 0) {
+		printf("Could not open Q-table %s\n", filename);
+		return (-1);
+	}
+	BinaryReader reader;
+	uint32_t version = binary_reader_open(&reader, file.data, file.size, Q_TABLE_MAGIC);
+	if (version != Q_TABLE_VERSION) {
+		printf("%s is not a version %d Q-table file\n", filename, Q_TABLE_VERSION);
+		mapped_file_close(&file);
+		return (-1);
+	}
+	const QTableHeader *header = binary_read_exact(&reader, sizeof(QTableHeader));
+	const int *canonical = NULL;
+	const float *q = NULL;
+	if (header != NULL && header->rows == NUM_CANONICAL_STATES && header->actions == NUM_ACTIONS && header->episodes >= 0) {
+		canonical = binary_read_exact(&reader, sizeof(states.canonical));
+		q = binary_read_exact(&reader, Q_TABLE_BYTES);
+	}
+	if (q == NULL || memcmp(canonical, states.canonical, sizeof(states.canonical)) != 0) {
+		printf("%s is truncated or corrupt\n", filename);
+		mapped_file_close(&file);
+		return (-1);
+	}
+	agent->episodes = header->episodes;
+	agent->player = X;
+	if (copy) {
+		agent->q = malloc(Q_TABLE_BYTES);
+		if (agent->q == NULL) {
+			printf("Not enough memory for the Q-table\n");
+			exit(1);
+		}
+		memcpy(agent->q, q, Q_TABLE_BYTES);
+		agent->mapped = false;
+		mapped_file_close(&file);
+	}
+	else {
+		agent->q = (float (*)[NUM_ACTIONS])q;
+		agent->mapped = true;
+		agent->file = file;
+	}
+	return (0);
+}
+
+//Function to train an agent on an m,n,k board and report the rate, the positions stored and the memory used
+static void trainMnkAgent(const MnkGame *game, QTable *table, long long episodes, Rng *random) {
+	double start = secondsNow();
+	trainMnk(game, table, episodes, random);
+	double seconds = secondsNow() - start;
+	printf("%d x %d board, %d in a row: trained for %lld episodes in %.3f s (%.0f episodes/s)\n", game->rows, game->columns,
+		game->win, episodes, seconds, episodes / seconds);
+	printf("Q-table: %u positions stored (room for %u), %lld evicted, %.1f MB\n", table->count, table->capacity,
+		table->evictions, qTableBytes(table) / 1048576.0);
+}
+
+//Function to print the win and loss rates of a trained m,n,k agent against a random player
+static void printMnkEvaluation(const MnkGame *game, QTable *table, Rng *random) {
+	Results first = evaluateMnk(game, table, 0, MNK_EVAL_GAMES, random);
+	Results second = evaluateMnk(game, table, 1, MNK_EVAL_GAMES, random);
+	printf("vs random: first %.2f%% won %.2f%% lost, second %.2f%% won %.2f%% lost", 100.0 * first.wins / MNK_EVAL_GAMES,
+		100.0 * first.losses / MNK_EVAL_GAMES, 100.0 * second.wins / MNK_EVAL_GAMES, 100.0 * second.losses / MNK_EVAL_GAMES);
+}
+
+//Function to train on boards of growing size with the hashed Q-table: rate, positions stored and memory
+void runBoardBenchmark(long long episodes, size_t memory, unsigned long long seed) {
+	static const int boards[][3] = {{3, 3, 3}, {4, 4, 3}, {4, 4, 4}, {5, 5, 4}, {6, 6, 4}, {7, 7, 5}, {8, 8, 5}};
+	printf("Board benchmark: %lld episodes per board, Q-table bounded to %.0f MB\n", episodes, memory / 1048576.0);
+	printf("board  k  episodes/s  positions   evicted    MB  vs random (first won/lost, second won/lost)\n");
+	for (size_t b = 0; b < sizeof(boards) / sizeof(boards[0]); b++) {
+		MnkGame game;
+		QTable table;
+		initMnkGame(&game, boards[b][0], boards[b][1], boards[b][2]);
+		if (initQTable(&table, game.cells, memory) != 0) {
+			printf("Not enough memory for the Q-table\n");
+			return;
+		}
+		Rng random;
+		rng_seed(&random, seed, b);
+		double start = secondsNow();
+		trainMnk(&game, &table, episodes, &random);
+		double rate = episodes / (secondsNow() - start);
+		Results first = evaluateMnk(&game, &table, 0, MNK_EVAL_GAMES, &random);
+		Results second = evaluateMnk(&game, &table, 1, MNK_EVAL_GAMES, &random);
+		printf("%dx%d  %2d  %10.0f  %9u  %8lld  %5.1f  %5.1f%%/%4.1f%%, %5.1f%%/%4.1f%%\n", game.rows, game.columns, game.win,
+			rate, table.count, table.evictions, qTableBytes(&table) / 1048576.0, 100.0 * first.wins / MNK_EVAL_GAMES,
+			100.0 * first.losses / MNK_EVAL_GAMES, 100.0 * second.wins / MNK_EVAL_GAMES, 100.0 * second.losses / MNK_EVAL_GAMES);
+		freeQTable(&table);
+		freeMnkGame(&game);
+	}
+}
+
+//Function to train on an m,n,k board and play against the agent; you are X and move first
+int playMnk(int rows, int columns, int win, long long episodes, size_t memory, unsigned long long seed) {
+	MnkGame game;
+	if (initMnkGame(&game, rows, columns, win) != 0) {
+		printf("A board must have at most %d cells, and the line length must fit in it\n", MAX_MNK_CELLS);
+		return 1;
+	}
+	QTable table;
+	if (initQTable(&table, game.cells, memory) != 0) {
+		printf("Not enough memory for the Q-table\n");
+		freeMnkGame(&game);
+		return 1;
+	}
+	Rng random;
+	rng_seed(&random, seed, 0);
+	trainMnkAgent(&game, &table, episodes, &random);
+	printMnkEvaluation(&game, &table, &random);
+	printf("\n");
+	uint64_t x = 0, o = 0;
+	bool human = true;
+	while (true) {
+		printMnkBoard(&game, x, o);
+		int action;
+		if (human) {
+			printf("Enter the action: ");
+			if (scanf("%d", &action) != 1) {
+				break;
+			}
+			if (action < 0 || action >= game.cells || ((x | o) >> action & 1)) {
+				printf("Choose an empty cell from 0 to %d\n", game.cells - 1);
+				continue;
+			}
+			x |= UINT64_C(1) << action;
+		}
+		else {
+			StateKey key = {o, x};
+			action = getMnkAction(&game, &table, key, 0.0, &random);
+			o |= UINT64_C(1) << action;
+		}
+		if (mnkWins(&game, human ? x : o, action)) {
+			printMnkBoard(&game, x, o);
+			printf(human ? "You win!\n" : "You lose!\n");
+			break;
+		}
+		if ((x | o) == game.full) {
+			printMnkBoard(&game, x, o);
+			printf("Draw!\n");
+			break;
+		}
+		human = !human;
+	}
+	freeQTable(&table);
+	freeMnkGame(&game);
+	return 0;
+}
+
 //Function to play against the agent
-int main (){
+int main (int argc, char **argv){
+	long long episodes = EPISODES;
+	int workers = numberOfThreads();
+	unsigned long long seed = 1;
+	int bench_episodes = 0;
+	long long checkpoint_every = 0;
+	int evaluate_games = 0;
+	Backend backend = BACKEND_SCALAR;
+	const char *model_path = NULL;
+	const char *resume_path = NULL;
+	const char *save_path = NULL;
+	const char *csv_path = NULL;
+	int rows = BOARD_SIZE, columns = BOARD_SIZE, win = 0;
+	size_t memory = (size_t)MNK_MEMORY_MB << 20;
+	long long board_bench_episodes = 0;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--episodes") == 0 && i + 1 < argc) {
+			episodes = atoll(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--model") == 0 && i + 1 < argc) {
+			model_path = argv[++i];
+		}
+		else if (strcmp(argv[i], "--resume") == 0 && i + 1 < argc) {
+			resume_path = argv[++i];
+		}
+		else if (strcmp(argv[i], "--backend") == 0 && i + 1 < argc) {
+			i++;
+			if (strcmp(argv[i], "scalar") == 0) {
+				backend = BACKEND_SCALAR;
+			}
+			else if (strcmp(argv[i], "batch") == 0) {
+				backend = BACKEND_BATCH;
+			}
+			else {
+				printf("Unknown backend %s (scalar or batch)\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--save") == 0 && i + 1 < argc) {
+			save_path = argv[++i];
+		}
+		else if (strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc) {
+			checkpoint_every = atoll(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--evaluate") == 0) {
+			evaluate_games = EVAL_GAMES;
+			if (i + 1 < argc && argv[i + 1][0] != '-') {
+				evaluate_games = atoi(argv[++i]);
+			}
+		}
+		else if (strcmp(argv[i], "--csv") == 0) {
+			csv_path = "q_table.csv";
+			if (i + 1 < argc && argv[i + 1][0] != '-') {
+				csv_path = argv[++i];
+			}
+		}
+		else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+			workers = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--board") == 0 && i + 2 < argc) {
+			rows = atoi(argv[++i]);
+			columns = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--win") == 0 && i + 1 < argc) {
+			win = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--memory") == 0 && i + 1 < argc) {
+			memory = (size_t)atoll(argv[++i]) << 20;
+		}
+		else if (strcmp(argv[i], "--bench-boards") == 0) {
+			board_bench_episodes = 200000;
+			if (i + 1 < argc && argv[i + 1][0] != '-') {
+				board_bench_episodes = atoll(argv[++i]);
+			}
+		}
+		else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+			seed = strtoull(argv[++i], NULL, 10);
+		}
+		else if (strcmp(argv[i], "--bench") == 0) {
+			bench_episodes = 1000000;
+			if (i + 1 < argc && argv[i + 1][0] != '-') {
+				bench_episodes = atoi(argv[++i]);
+			}
+		}
+		else {
+			printf("Usage: %s [--episodes n] [--threads n] [--seed n] [--model file | --resume file] [--save file] [--checkpoint n] [--evaluate [games]] [--csv [file]] [--backend scalar|batch] [--bench [episodes]] [--board rows columns [--win k] [--memory MB]] [--bench-boards [episodes]]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (workers < 1) {
+		workers = 1;
+	}
+	if (win == 0) {
+		win = rows < columns ? rows : columns;
+	}
+	if (board_bench_episodes > 0) {
+		runBoardBenchmark(board_bench_episodes, memory, seed);
+		return 0;
+	}
+	if (rows != BOARD_SIZE || columns != BOARD_SIZE || win != BOARD_SIZE) {
+		// Any other board is trained with the hashed Q-table, on one thread
+		if (model_path != NULL || resume_path != NULL || save_path != NULL || csv_path != NULL || backend != BACKEND_SCALAR) {
+			printf("--model, --resume, --save, --csv and --backend are only for the 3 x 3 board\n");
+			return 1;
+		}
+		return playMnk(rows, columns, win, episodes, memory, seed);
+	}
+	initStates();
+	double solver_start = secondsNow();
+	initSolver();
+	if (evaluate_games > 0) {
+		static const char *outcomes[] = {"a loss", "a draw", "a win"};
+		printf("Solved %d positions in %.2f ms (%lld nodes): the empty board is %s for X\n", states.count,
+			(secondsNow() - solver_start) * 1e3, solver.nodes, outcomes[solver.value[states.row[0]] + 1]);
+	}
+	if (bench_episodes > 0) {
+		runBenchmark(bench_episodes, workers, seed);
+		return 0;
+	}
+
 	Agent agent;
-	initAgent(&agent);
 	Board board;
 	initBoard(&board);
-	train(&agent);
-	exportQ(&agent);
+	if (model_path != NULL) {
+		if (loadQ(&agent, model_path, false) != 0) {
+			return 1;
+		}
+		printf("Loaded %s, trained for %lld episodes\n", model_path, agent.episodes);
+	}
+	else {
+		if (resume_path != NULL) {
+			if (loadQ(&agent, resume_path, true) != 0) {
+				return 1;
+			}
+			printf("Resuming %s from %lld episodes\n", resume_path, agent.episodes);
+			if (save_path == NULL) {
+				save_path = resume_path;
+			}
+		}
+		else {
+			initAgent(&agent);
+		}
+		if (checkpoint_every > 0 && save_path == NULL) {
+			save_path = "q_table.bin";
+		}
+		long long resumed = agent.episodes;
+		double start = secondsNow();
+		double checkpoint_seconds = train(&agent, episodes, workers, seed, backend, checkpoint_every, save_path, evaluate_games);
+		double seconds = secondsNow() - start - checkpoint_seconds;
+		printf("Trained for %lld episodes with %d workers in %.3f s (%.0f episodes/s)\n", agent.episodes - resumed, workers,
+			seconds, (agent.episodes - resumed) / seconds);
+		if (save_path != NULL) {
+			if (saveQ(&agent, save_path) != 0) {
+				printf("Could not write %s\n", save_path);
+			}
+		}
+	}
+	if (csv_path != NULL) {
+		exportQ(&agent, csv_path);
+	}
+	if (evaluate_games > 0) {
+		// Evaluate instead of playing
+		printCheckpointEvaluation(&agent, evaluate_games, seed);
+		freeAgent(&agent);
+		return 0;
+	}
 	while (!gameOver(&board, agent.player)) {
 		printBoard(&board);
 		if (agent.player == X) {
 			int action;
 			printf("Enter the action: ");
-			scanf("%d", &action);
+			if (scanf("%d", &action) != 1) {
+				freeAgent(&agent);
+				return 1;
+			}
+			if (action < 0 || action >= NUM_ACTIONS || !isEmpty(&board, action)) {
+				printf("Choose an empty cell from 0 to 8\n");
+				continue;
+			}
 			updateBoard(&board, action, agent.player);
 		}
 		else {
 			int state = getState(&board, agent.player);
-			int action = getBestAction(&agent, state);
+			int action = getBestAction(&agent, state, 0.0, NULL);
 			updateBoard(&board, action, agent.player);
 		}
 		agent.player = (agent.player == X) ? O : X;
@@ -249,5 +1432,6 @@ int main (){
 	else {
 		printf("Draw!\n");
 	}
+	freeAgent(&agent);
 	return 0;
-}
\ No newline at end of file
+}
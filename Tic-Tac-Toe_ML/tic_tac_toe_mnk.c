@@ -0,0 +1,403 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <float.h>
+
+#include "tic_tac_toe_mnk.h"
+
+#define EMPTY_ROW UINT32_MAX
+#define CHUNK_ROWS 4096     // rows the pool allocates at a time
+#define INITIAL_SLOTS 4096
+
+int initMnkGame(MnkGame *game, int rows, int columns, int win) {
+	memset(game, 0, sizeof(*game));
+	int longest = rows > columns ? rows : columns;
+	if (rows < 1 || columns < 1 || rows * columns > MAX_MNK_CELLS || win < 1 || win > longest) {
+		return (-1);
+	}
+	game->rows = rows;
+	game->columns = columns;
+	game->win = win;
+	game->cells = rows * columns;
+	game->full = game->cells == 64 ? UINT64_MAX : (UINT64_C(1) << game->cells) - 1;
+	// Runs of `win` cells starting at each cell: right, down, down-right and down-left
+	static const int directions[4][2] = {{0, 1}, {1, 0}, {1, 1}, {1, -1}};
+	game->lines = malloc(4 * game->cells * sizeof(uint64_t));
+	for (int r = 0; r < rows; r++) {
+		for (int c = 0; c < columns; c++) {
+			for (int d = 0; d < 4; d++) {
+				int endRow = r + (win - 1) * directions[d][0];
+				int endColumn = c + (win - 1) * directions[d][1];
+				if (endRow >= rows || endColumn < 0 || endColumn >= columns || (win == 1 && d > 0)) {
+					continue;
+				}
+				uint64_t line = 0;
+				for (int i = 0; i < win; i++) {
+					line |= UINT64_C(1) << ((r + i * directions[d][0]) * columns + c + i * directions[d][1]);
+				}
+				game->lines[game->lineCount++] = line;
+			}
+		}
+	}
+	game->cellLineStart = calloc(game->cells + 1, sizeof(int));
+	for (int l = 0; l < game->lineCount; l++) {
+		for (int cell = 0; cell < game->cells; cell++) {
+			game->cellLineStart[cell + 1] += game->lines[l] >> cell & 1;
+		}
+	}
+	for (int cell = 0; cell < game->cells; cell++) {
+		game->cellLineStart[cell + 1] += game->cellLineStart[cell];
+	}
+	game->cellLines = malloc((game->cellLineStart[game->cells] + 1) * sizeof(int));
+	int *next = malloc(game->cells * sizeof(int));
+	memcpy(next, game->cellLineStart, game->cells * sizeof(int));
+	for (int l = 0; l < game->lineCount; l++) {
+		for (int cell = 0; cell < game->cells; cell++) {
+			if (game->lines[l] >> cell & 1) {
+				game->cellLines[next[cell]++] = l;
+			}
+		}
+	}
+	free(next);
+	return (0);
+}
+
+void freeMnkGame(MnkGame *game) {
+	free(game->lines);
+	free(game->cellLines);
+	free(game->cellLineStart);
+}
+
+bool mnkWins(const MnkGame *game, uint64_t cells, int cell) {
+	for (int i = game->cellLineStart[cell]; i < game->cellLineStart[cell + 1]; i++) {
+		uint64_t line = game->lines[game->cellLines[i]];
+		if ((cells & line) == line) {
+			return (true);
+		}
+	}
+	return (false);
+}
+
+void printMnkBoard(const MnkGame *game, uint64_t x, uint64_t o) {
+	for (int i = 0; i < game->rows; i++) {
+		for (int j = 0; j < game->columns; j++) {
+			int cell = i * game->columns + j;
+			if (x >> cell & 1) {
+				printf("X");
+			}
+			else if (o >> cell & 1) {
+				printf("O");
+			}
+			else {
+				printf(" ");
+			}
+			if (j < game->columns - 1) {
+				printf("|");
+			}
+		}
+		printf("\n");
+		if (i < game->rows - 1) {
+			for (int j = 0; j < 2 * game->columns - 1; j++) {
+				printf("-");
+			}
+			printf("\n");
+		}
+	}
+}
+
+int initQTable(QTable *table, int actions, size_t memory) {
+	memset(table, 0, sizeof(*table));
+	size_t rowBytes = actions * sizeof(float);
+	// There are at least twice as many slots as rows, a power of two of them, and the rows get the memory the
+	// slots leave: try every number of slots that fits and keep the one that leaves room for the most rows
+	size_t slots = 0, rows = 0;
+	for (size_t tried = 32; tried * sizeof(QSlot) < memory; tried *= 2) {
+		size_t fit = (memory - tried * sizeof(QSlot)) / rowBytes / CHUNK_ROWS * CHUNK_ROWS;
+		fit = fit < tried / 2 ? fit : tried / 2;
+		if (fit > rows) {
+			rows = fit;
+			slots = tried;
+		}
+	}
+	if (rows < 16) {
+		return (-1);
+	}
+	// The slots start small and double as rows are stored, up to `slots`
+	table->maxSlots = slots;
+	slots = slots < INITIAL_SLOTS ? slots : INITIAL_SLOTS;
+	table->slots = malloc(slots * sizeof(QSlot));
+	table->chunks = calloc((rows + CHUNK_ROWS - 1) / CHUNK_ROWS, sizeof(float *));
+	if (table->slots == NULL || table->chunks == NULL) {
+		freeQTable(table);
+		return (-1);
+	}
+	for (size_t i = 0; i < slots; i++) {
+		table->slots[i].row = EMPTY_ROW;
+	}
+	table->mask = slots - 1;
+	table->actions = actions;
+	table->capacity = (uint32_t)rows;
+	return (0);
+}
+
+void freeQTable(QTable *table) {
+	if (table->chunks != NULL) {
+		for (uint32_t i = 0; i < (table->capacity + CHUNK_ROWS - 1) / CHUNK_ROWS; i++) {
+			free(table->chunks[i]);
+		}
+	}
+	free(table->chunks);
+	free(table->slots);
+	memset(table, 0, sizeof(*table));
+}
+
+size_t qTableBytes(const QTable *table) {
+	size_t chunks = (table->allocated + CHUNK_ROWS - 1) / CHUNK_ROWS;
+	return (table->mask + 1) * sizeof(QSlot) + chunks * CHUNK_ROWS * table->actions * sizeof(float);
+}
+
+static size_t hashKey(const QTable *table, StateKey key) {
+	uint64_t h = key.mine * 0x9E3779B97F4A7C15ull ^ (key.theirs + 0x632BE59BD9B4E019ull) * 0xC2B2AE3D27D4EB4Full;
+	h ^= h >> 29;
+	h *= 0xBF58476D1CE4E5B9ull;
+	h ^= h >> 32;
+	return (size_t)h & table->mask;
+}
+
+static float *rowValues(const QTable *table, uint32_t row) {
+	return table->chunks[row / CHUNK_ROWS] + (size_t)(row % CHUNK_ROWS) * table->actions;
+}
+
+//Function to get the slot of a key, or the free slot where it would go
+static size_t findSlot(const QTable *table, StateKey key) {
+	size_t i = hashKey(table, key);
+	while (table->slots[i].row != EMPTY_ROW &&
+		(table->slots[i].key.mine != key.mine || table->slots[i].key.theirs != key.theirs)) {
+		i = (i + 1) & table->mask;
+	}
+	return i;
+}
+
+float *findQ(QTable *table, StateKey key) {
+	QSlot *slot = &table->slots[findSlot(table, key)];
+	if (slot->row == EMPTY_ROW) {
+		return NULL;
+	}
+	slot->referenced = 1;
+	return rowValues(table, slot->row);
+}
+
+//Function to empty a slot, moving back the keys after it that would no longer be found (no tombstones)
+static void removeSlot(QTable *table, size_t i) {
+	size_t j = i;
+	while (true) {
+		j = (j + 1) & table->mask;
+		if (table->slots[j].row == EMPTY_ROW) {
+			break;
+		}
+		size_t home = hashKey(table, table->slots[j].key);
+		// The key in j can fill the hole in i if its home is not cyclically in (i, j]
+		bool between = (i <= j) ? (home > i && home <= j) : (home > i || home <= j);
+		if (!between) {
+			table->slots[i] = table->slots[j];
+			i = j;
+		}
+	}
+	table->slots[i].row = EMPTY_ROW;
+}
+
+//Function to double the slots and insert every key again
+static void growSlots(QTable *table) {
+	QSlot *old = table->slots;
+	size_t oldCount = table->mask + 1;
+	table->slots = malloc(2 * oldCount * sizeof(QSlot));
+	if (table->slots == NULL) {
+		printf("Not enough memory for the Q-table\n");
+		exit(1);
+	}
+	table->mask = 2 * oldCount - 1;
+	for (size_t i = 0; i <= table->mask; i++) {
+		table->slots[i].row = EMPTY_ROW;
+	}
+	for (size_t i = 0; i < oldCount; i++) {
+		if (old[i].row != EMPTY_ROW) {
+			table->slots[findSlot(table, old[i].key)] = old[i];
+		}
+	}
+	table->hand = 0;
+	free(old);
+}
+
+//Function to evict the first row the clock hand finds unused since its last pass; returns the row it frees
+static uint32_t evictRow(QTable *table) {
+	while (true) {
+		QSlot *slot = &table->slots[table->hand];
+		if (slot->row != EMPTY_ROW) {
+			if (!slot->referenced) {
+				uint32_t row = slot->row;
+				removeSlot(table, table->hand);
+				table->count--;
+				table->evictions++;
+				return row;
+			}
+			slot->referenced = 0;
+		}
+		table->hand = (table->hand + 1) & table->mask;
+	}
+}
+
+float *insertQ(QTable *table, StateKey key) {
+	size_t i = findSlot(table, key);
+	if (table->slots[i].row != EMPTY_ROW) {
+		table->slots[i].referenced = 1;
+		return rowValues(table, table->slots[i].row);
+	}
+	uint32_t row;
+	if (table->count == table->capacity) {
+		// Rows are only freed here, and the freed row is taken at once, so the pool never has free rows
+		row = evictRow(table);
+		i = findSlot(table, key);
+	}
+	else {
+		if (2 * (size_t)(table->count + 1) > table->mask + 1 && table->mask + 1 < table->maxSlots) {
+			growSlots(table);
+			i = findSlot(table, key);
+		}
+		row = table->allocated++;
+		if (row % CHUNK_ROWS == 0) {
+			table->chunks[row / CHUNK_ROWS] = malloc((size_t)CHUNK_ROWS * table->actions * sizeof(float));
+			if (table->chunks[row / CHUNK_ROWS] == NULL) {
+				printf("Not enough memory for the Q-table\n");
+				exit(1);
+			}
+		}
+	}
+	table->slots[i].key = key;
+	table->slots[i].row = row;
+	table->slots[i].referenced = 1;
+	table->count++;
+	table->inserts++;
+	float *values = rowValues(table, row);
+	memset(values, 0, table->actions * sizeof(float));
+	return values;
+}
+
+//Function to get the n-th (from 0) set bit of a mask
+static int nthBit(uint64_t mask, int n) {
+	for (int i = 0; i < n; i++) {
+		mask &= mask - 1;
+	}
+	return __builtin_ctzll(mask);
+}
+
+int getMnkAction(const MnkGame *game, QTable *table, StateKey key, double epsilon, Rng *random) {
+	uint64_t empty = ~(key.mine | key.theirs) & game->full;
+	if (epsilon > 0 && rng_uniform(random) < epsilon) {
+		return nthBit(empty, (int)rng_below(random, __builtin_popcountll(empty)));
+	}
+	const float *values = findQ(table, key);
+	if (values == NULL) {
+		return nthBit(empty, (int)rng_below(random, __builtin_popcountll(empty)));
+	}
+	float best = -FLT_MAX;
+	int action = -1;
+	int ties = 0;
+	for (uint64_t left = empty; left != 0; left &= left - 1) {
+		int cell = __builtin_ctzll(left);
+		if (values[cell] > best) {
+			best = values[cell];
+			action = cell;
+			ties = 1;
+		}
+		else if (values[cell] == best && rng_below(random, ++ties) == 0) {
+			action = cell;
+		}
+	}
+	return action;
+}
+
+//Function to get the best Q-value of the player to move, 0 for a position that is not in the table
+static float getMnkMaxQ(const MnkGame *game, QTable *table, StateKey key) {
+	const float *values = findQ(table, key);
+	if (values == NULL) {
+		return 0.0f;
+	}
+	uint64_t empty = ~(key.mine | key.theirs) & game->full;
+	float best = -FLT_MAX;
+	for (; empty != 0; empty &= empty - 1) {
+		int cell = __builtin_ctzll(empty);
+		best = values[cell] > best ? values[cell] : best;
+	}
+	return best;
+}
+
+//Function to play one training game of the agent against itself, learning every move from the point of view
+//of the player who makes it, against the best reply the opponent knows
+static void playMnkEpisode(const MnkGame *game, QTable *table, Rng *random) {
+	StateKey key = {0, 0};
+	while (true) {
+		int action = getMnkAction(game, table, key, EPSILON, random);
+		uint64_t mine = key.mine | UINT64_C(1) << action;
+		StateKey next = {key.theirs, mine};
+		double target;
+		bool done = true;
+		if (mnkWins(game, mine, action)) {
+			target = REWARD_WIN;
+		}
+		else if ((mine | key.theirs) == game->full) {
+			target = REWARD_DRAW;
+		}
+		else {
+			target = -GAMMA * getMnkMaxQ(game, table, next);
+			done = false;
+		}
+		float *q = &insertQ(table, key)[action];
+		*q += (float)(ALPHA * (target - *q));
+		if (done) {
+			return;
+		}
+		key = next;
+	}
+}
+
+void trainMnk(const MnkGame *game, QTable *table, long long episodes, Rng *random) {
+	for (long long i = 0; i < episodes; i++) {
+		playMnkEpisode(game, table, random);
+	}
+}
+
+Results evaluateMnk(const MnkGame *game, QTable *table, int agentPlayer, int games, Rng *random) {
+	Results results = {0, 0, 0, 0, 0};
+	for (int g = 0; g < games; g++) {
+		StateKey key = {0, 0};
+		int player = 0;
+		while (true) {
+			int action;
+			if (player == agentPlayer) {
+				action = getMnkAction(game, table, key, 0.0, random);
+			}
+			else {
+				uint64_t empty = ~(key.mine | key.theirs) & game->full;
+				action = nthBit(empty, (int)rng_below(random, __builtin_popcountll(empty)));
+			}
+			uint64_t mine = key.mine | UINT64_C(1) << action;
+			if (mnkWins(game, mine, action)) {
+				if (player == agentPlayer) {
+					results.wins++;
+				}
+				else {
+					results.losses++;
+				}
+				break;
+			}
+			if ((mine | key.theirs) == game->full) {
+				results.draws++;
+				break;
+			}
+			key.mine = key.theirs;
+			key.theirs = mine;
+			player = 1 - player;
+		}
+	}
+	return results;
+}
@@ -0,0 +1,104 @@
+#ifndef TIC_TAC_TOE_MNK_H
+#define TIC_TAC_TOE_MNK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../common/random.h"
+
+// m,n,k-games: a board of `rows` × `columns` cells (at most 64) where the first player with `win` pieces in a
+// row, column or diagonal wins. Tic-tac-toe is the 3,3,3-game. The board is one 64-bit mask per player, and a
+// position seen by the player to move is the 128-bit key {their cells, the opponent's cells}, so there is no
+// limit on the number of positions a board can have: the Q-values of the positions actually visited are kept
+// in a hash table of bounded size.
+
+#define MAX_MNK_CELLS 64
+
+// Learning parameters, the same for every board
+#define ALPHA 0.5
+#define GAMMA 0.9
+#define EPSILON 0.2
+#define REWARD_WIN 1.0
+#define REWARD_LOSE (-1.0)
+#define REWARD_DRAW 0.5
+
+// Outcome of a set of games, from the point of view of the agent
+typedef struct {
+	long long wins;
+	long long draws;
+	long long losses;
+	long long moves;            // moves of the agent
+	long long optimalMoves;     // of them, moves that keep the game-theoretic value (3 × 3 only, see the solver)
+} Results;
+
+typedef struct {
+	int rows;
+	int columns;
+	int win;
+	int cells;
+	uint64_t full;          // one bit per cell
+	int lineCount;
+	uint64_t *lines;        // every run of `win` cells in a row, column or diagonal
+	int *cellLines;         // the lines through cell c are cellLines[cellLineStart[c]] .. cellLines[cellLineStart[c + 1] - 1]
+	int *cellLineStart;
+} MnkGame;
+
+// Position seen by the player to move
+typedef struct {
+	uint64_t mine;
+	uint64_t theirs;
+} StateKey;
+
+// Slot of the hash table: a key and the row of its Q-values in the pool
+typedef struct {
+	StateKey key;
+	uint32_t row;           // EMPTY_ROW if the slot is free
+	uint32_t referenced;    // set when the row is used, cleared as the eviction clock passes
+} QSlot;
+
+// Q-table of an m,n,k-game: an open-addressing hash table (linear probing) from position keys to rows of
+// `actions` Q-values. Rows come from a pool that grows in chunks as positions are visited, up to `capacity`
+// rows; once it is full, inserting a new position evicts one that has not been used since the clock hand last
+// passed it (second chance). The slots array doubles as rows are stored and is never more than half full, so
+// probes stay short; the slots and the rows together stay within the memory given to initQTable.
+typedef struct {
+	QSlot *slots;
+	size_t mask;            // number of slots - 1
+	size_t maxSlots;        // the slots double up to this many as rows are stored
+	int actions;
+	uint32_t capacity;      // maximum number of rows
+	uint32_t count;         // rows in use
+	uint32_t allocated;     // rows handed out from the chunks so far
+	float **chunks;
+	size_t hand;            // eviction clock, over the slots
+	long long inserts;
+	long long evictions;
+} QTable;
+
+//Function to set up an m,n,k-game; returns 0, or -1 if the sizes are not valid
+int initMnkGame(MnkGame *game, int rows, int columns, int win);
+void freeMnkGame(MnkGame *game);
+//Function to check whether the cells of a player, after a move in `cell`, contain a whole line through it
+bool mnkWins(const MnkGame *game, uint64_t cells, int cell);
+void printMnkBoard(const MnkGame *game, uint64_t x, uint64_t o);
+
+//Function to create a Q-table that uses at most about `memory` bytes; returns 0, or -1 if there is not enough
+//memory for a useful table
+int initQTable(QTable *table, int actions, size_t memory);
+void freeQTable(QTable *table);
+//Function to find the Q-values of a position, NULL if it has never been stored (or was evicted)
+float *findQ(QTable *table, StateKey key);
+//Function to find the Q-values of a position, storing it with all values at 0 if it is not there yet
+float *insertQ(QTable *table, StateKey key);
+//Function to get the bytes the table takes now: its slots and the chunks of rows allocated so far
+size_t qTableBytes(const QTable *table);
+
+//Function to train the agent by self-play, like playEpisode for the 3 × 3 board
+void trainMnk(const MnkGame *game, QTable *table, long long episodes, Rng *random);
+//Function to choose the move of the player to move: epsilon-greedy, ties broken at random
+int getMnkAction(const MnkGame *game, QTable *table, StateKey key, double epsilon, Rng *random);
+//Function to play the greedy agent, as agentPlayer (0: first, 1: second), against a random player
+Results evaluateMnk(const MnkGame *game, QTable *table, int agentPlayer, int games, Rng *random);
+
+#endif
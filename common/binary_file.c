@@ -0,0 +1,139 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "binary_file.h"
+
+static const char zeros[BINARY_ALIGN];
+
+// Copies the magic string into its fixed-size field, zero-padded (an 8-character magic fills it without a terminator)
+static void set_magic(char* field, const char* magic)
+{
+    size_t length = strlen(magic);
+    memset(field, 0, BINARY_MAGIC_SIZE);
+    memcpy(field, magic, length < BINARY_MAGIC_SIZE ? length : BINARY_MAGIC_SIZE);
+}
+
+static size_t align_up(size_t offset)
+{
+    return ((offset + BINARY_ALIGN - 1) / BINARY_ALIGN * BINARY_ALIGN);
+}
+
+static void write_bytes(BinaryWriter* writer, const void* data, size_t size)
+{
+    if (writer->failed || size == 0)
+        return;
+    if (fwrite(data, 1, size, writer->file) != size)
+        writer->failed = 1;
+    writer->offset += size;
+}
+
+static void write_padding(BinaryWriter* writer)
+{
+    write_bytes(writer, zeros, align_up(writer->offset) - writer->offset);
+}
+
+int binary_writer_open(BinaryWriter* writer, const char* path, const char* magic, uint32_t version)
+{
+    size_t length = strlen(path);
+    writer->path = (char*)malloc(length + 1);
+    writer->temp_path = (char*)malloc(length + 5);
+    memcpy(writer->path, path, length + 1);
+    memcpy(writer->temp_path, path, length);
+    memcpy(writer->temp_path + length, ".tmp", 5);
+    writer->offset = 0;
+    writer->failed = 0;
+    writer->file = fopen(writer->temp_path, "wb");
+    if (writer->file == NULL)
+    {
+        free(writer->path);
+        free(writer->temp_path);
+        return (-1);
+    }
+    BinaryHeader header;
+    memset(&header, 0, sizeof(header));
+    set_magic(header.magic, magic);
+    header.version = version;
+    header.byte_order = BINARY_BYTE_ORDER;
+    write_bytes(writer, &header, sizeof(header));
+    write_padding(writer);
+    return (0);
+}
+
+void binary_write(BinaryWriter* writer, const void* data, size_t size)
+{
+    uint64_t length = size;
+    write_bytes(writer, &length, sizeof(length));
+    write_padding(writer);
+    write_bytes(writer, data, size);
+    write_padding(writer);
+}
+
+int binary_writer_close(BinaryWriter* writer)
+{
+    if (fflush(writer->file) != 0)
+        writer->failed = 1;
+    if (fclose(writer->file) != 0)
+        writer->failed = 1;
+    if (!writer->failed)
+    {
+#ifdef _WIN32
+        remove(writer->path);  // rename does not replace an existing file on Windows
+#endif
+        if (rename(writer->temp_path, writer->path) != 0)
+            writer->failed = 1;
+    }
+    if (writer->failed)
+        remove(writer->temp_path);
+    free(writer->path);
+    free(writer->temp_path);
+    return (writer->failed ? -1 : 0);
+}
+
+uint32_t binary_reader_open(BinaryReader* reader, const char* data, size_t size, const char* magic)
+{
+    reader->data = data;
+    reader->size = size;
+    reader->offset = align_up(sizeof(BinaryHeader));
+    reader->failed = 0;
+    BinaryHeader header;
+    char expected[BINARY_MAGIC_SIZE];
+    set_magic(expected, magic);
+    if (size < reader->offset)
+        return (0);
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, expected, sizeof(expected)) != 0 || header.byte_order != BINARY_BYTE_ORDER)
+        return (0);
+    return (header.version);
+}
+
+const void* binary_read(BinaryReader* reader, size_t* size)
+{
+    uint64_t length;
+    size_t start = align_up(reader->offset + sizeof(length));
+    if (reader->failed || start > reader->size)
+    {
+        reader->failed = 1;
+        return (NULL);
+    }
+    memcpy(&length, reader->data + reader->offset, sizeof(length));
+    if (length > reader->size - start)
+    {
+        reader->failed = 1;
+        return (NULL);
+    }
+    reader->offset = align_up(start + (size_t)length);
+    *size = (size_t)length;
+    return (reader->data + start);
+}
+
+const void* binary_read_exact(BinaryReader* reader, size_t size)
+{
+    size_t length;
+    const void* block = binary_read(reader, &length);
+    if (block != NULL && length != size)
+    {
+        reader->failed = 1;
+        return (NULL);
+    }
+    return (block);
+}
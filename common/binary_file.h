@@ -0,0 +1,54 @@
+#ifndef BINARY_FILE_H
+#define BINARY_FILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Versioned binary files made of blocks, shared by the programs that save trained models.
+// Every block is its size as a 64-bit integer followed by the bytes, which start at a multiple of
+// BINARY_ALIGN from the beginning of the file. A file mapped into memory (the mapping starts on a
+// page boundary) can therefore be used in place: arrays come out aligned for the SIMD kernels.
+
+#define BINARY_ALIGN 64
+#define BINARY_MAGIC_SIZE 8
+
+// File header: a magic string naming the kind of file, and its format version
+typedef struct {
+    char magic[BINARY_MAGIC_SIZE];
+    uint32_t version;
+    uint32_t byte_order;  // BINARY_BYTE_ORDER as written, so a file from a machine of the other endianness is refused
+} BinaryHeader;
+
+#define BINARY_BYTE_ORDER 0x01020304u
+
+typedef struct {
+    FILE* file;
+    char* path;       // final name; the blocks go to a temporary file renamed over it on close
+    char* temp_path;
+    uint64_t offset;
+    int failed;
+} BinaryWriter;
+
+typedef struct {
+    const char* data;
+    size_t size;
+    size_t offset;
+    int failed;
+} BinaryReader;
+
+// Starts writing `path` with the given header; returns 0 on success, -1 if the file cannot be created
+int binary_writer_open(BinaryWriter* writer, const char* path, const char* magic, uint32_t version);
+void binary_write(BinaryWriter* writer, const void* data, size_t size);
+// Finishes the file and replaces `path` with it, so a reader never sees a half-written file.
+// Returns 0 on success, -1 (and leaves any previous file in place) if a write failed.
+int binary_writer_close(BinaryWriter* writer);
+
+// Checks the header of the mapped bytes; returns the version, or 0 if the magic or byte order does not match
+uint32_t binary_reader_open(BinaryReader* reader, const char* data, size_t size, const char* magic);
+// Returns the next block and its size, or NULL (and marks the reader failed) past the end of the data
+const void* binary_read(BinaryReader* reader, size_t* size);
+// Returns the next block if it is exactly `size` bytes, NULL (and marks the reader failed) otherwise
+const void* binary_read_exact(BinaryReader* reader, size_t size);
+
+#endif
@@ -0,0 +1,519 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "dataset.h"
+
+// Files smaller than this are parsed on one thread
+#define PARALLEL_MIN_BYTES (4 << 20)
+// Longest token handed to strtod; longer ones are parsed approximately
+#define MAX_TOKEN 128
+
+// Powers of ten that are exact in a double
+static const double exact_powers_of_ten[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                             1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+static uint32_t hash_name(const char* name, size_t length)
+{
+    uint32_t hash = 2166136261u;  // FNV-1a
+    for (size_t i = 0; i < length; i++)
+    {
+        hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+    }
+    return (hash);
+}
+
+void label_table_init(LabelTable* table)
+{
+    table->names = NULL;
+    table->count = 0;
+    table->capacity = 0;
+    table->slot_count = 16;
+    table->slots = (int*)calloc(table->slot_count, sizeof(int));
+}
+
+void label_table_free(LabelTable* table)
+{
+    for (int i = 0; i < table->count; i++)
+    {
+        free(table->names[i]);
+    }
+    free(table->names);
+    free(table->slots);
+    table->names = NULL;
+    table->slots = NULL;
+    table->count = 0;
+    table->capacity = 0;
+    table->slot_count = 0;
+}
+
+// Function to find the slot of a name: the slot holding it, or the empty slot where it would go
+static int find_slot(const LabelTable* table, const char* name, size_t length)
+{
+    int mask = table->slot_count - 1;
+    int slot = (int)(hash_name(name, length) & (uint32_t)mask);
+    while (table->slots[slot] != 0)
+    {
+        const char* other = table->names[table->slots[slot] - 1];
+        if (strncmp(other, name, length) == 0 && other[length] == '\0')
+            break;
+        slot = (slot + 1) & mask;
+    }
+    return (slot);
+}
+
+int label_table_intern(LabelTable* table, const char* name, size_t length)
+{
+    int slot = find_slot(table, name, length);
+    if (table->slots[slot] != 0)
+        return (table->slots[slot] - 1);
+
+    if (table->count == table->capacity)
+    {
+        table->capacity = table->capacity ? 2 * table->capacity : 8;
+        table->names = (char**)realloc(table->names, table->capacity * sizeof(char*));
+    }
+    int id = table->count++;
+    table->names[id] = (char*)malloc(length + 1);
+    memcpy(table->names[id], name, length);
+    table->names[id][length] = '\0';
+    table->slots[slot] = id + 1;
+
+    // Keep the table at most half full
+    if (2 * table->count > table->slot_count)
+    {
+        free(table->slots);
+        table->slot_count *= 2;
+        table->slots = (int*)calloc(table->slot_count, sizeof(int));
+        for (int i = 0; i < table->count; i++)
+        {
+            table->slots[find_slot(table, table->names[i], strlen(table->names[i]))] = i + 1;
+        }
+    }
+    return (id);
+}
+
+int label_table_find(const LabelTable* table, const char* name)
+{
+    int slot = find_slot(table, name, strlen(name));
+    return (table->slots[slot] - 1);
+}
+
+static int is_digit(char c)
+{
+    return (c >= '0' && c <= '9');
+}
+
+// Function to parse a number with strtod from a bounded copy of the token, for inputs the fast path does not handle
+static const char* parse_number_slow(const char* p, const char* end, double* value)
+{
+    char token[MAX_TOKEN];
+    size_t length = 0;
+    while (p + length < end && length < MAX_TOKEN - 1 && p[length] != ',' && p[length] != '\n')
+    {
+        token[length] = p[length];
+        length++;
+    }
+    token[length] = '\0';
+    char* stop;
+    *value = strtod(token, &stop);
+    if (stop == token)
+        return (NULL);
+    return (p + (stop - token));
+}
+
+const char* parse_number(const char* p, const char* end, double* value)
+{
+    const char* start = p;
+    int negative = 0;
+    if (p < end && (*p == '-' || *p == '+'))
+    {
+        negative = (*p == '-');
+        p++;
+    }
+
+    uint64_t mantissa = 0;
+    int digits = 0;     // significant digits kept in the mantissa
+    int dropped = 0;    // significant digits that did not fit
+    int exponent = 0;
+    int seen = 0;
+    while (p < end && is_digit(*p))
+    {
+        if (digits < 19)
+        {
+            mantissa = mantissa * 10 + (*p - '0');
+            if (mantissa != 0)
+                digits++;
+        }
+        else
+        {
+            exponent++;
+            dropped = 1;
+        }
+        p++;
+        seen = 1;
+    }
+    if (p < end && *p == '.')
+    {
+        p++;
+        while (p < end && is_digit(*p))
+        {
+            if (digits < 19)
+            {
+                mantissa = mantissa * 10 + (*p - '0');
+                if (mantissa != 0)
+                    digits++;
+                exponent--;
+            }
+            else
+            {
+                dropped = 1;
+            }
+            p++;
+            seen = 1;
+        }
+    }
+    if (!seen)
+        return (parse_number_slow(start, end, value));  // nan, inf, ...
+
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        const char* e = p + 1;
+        int exponent_negative = 0;
+        if (e < end && (*e == '-' || *e == '+'))
+        {
+            exponent_negative = (*e == '-');
+            e++;
+        }
+        if (e < end && is_digit(*e))
+        {
+            int written = 0;
+            while (e < end && is_digit(*e))
+            {
+                if (written < 10000)
+                    written = written * 10 + (*e - '0');
+                e++;
+            }
+            exponent += exponent_negative ? -written : written;
+            p = e;
+        }
+    }
+
+    // Clinger's fast path: both the mantissa and the power of ten are exact doubles, so one rounding gives the exact result
+    if (!dropped && mantissa <= (1ull << 53) && exponent >= -22 && exponent <= 22)
+    {
+        double result = (double)mantissa;
+        result = (exponent < 0) ? result / exact_powers_of_ten[-exponent] : result * exact_powers_of_ten[exponent];
+        *value = negative ? -result : result;
+        return (p);
+    }
+    if (p - start < MAX_TOKEN)
+        return (parse_number_slow(start, end, value));
+    *value = (negative ? -1.0 : 1.0) * (double)mantissa;
+    for (; exponent > 0; exponent--)
+        *value *= 10;
+    for (; exponent < 0; exponent++)
+        *value /= 10;
+    return (p);
+}
+
+static const char* skip_spaces(const char* p, const char* end)
+{
+    while (p < end && (*p == ' ' || *p == '\t'))
+        p++;
+    return (p);
+}
+
+// Function to find the end of the line starting at p (the '\n' or the end of the file) and where the next one starts
+static const char* line_end(const char* p, const char* end, const char** next)
+{
+    const char* newline = (const char*)memchr(p, '\n', end - p);
+    *next = newline ? newline + 1 : end;
+    const char* stop = newline ? newline : end;
+    if (stop > p && stop[-1] == '\r')
+        stop--;
+    return (stop);
+}
+
+// Function to check whether a whole field [p, end) is a number
+static int is_numeric_field(const char* p, const char* end)
+{
+    double value;
+    p = skip_spaces(p, end);
+    const char* after = parse_number(p, end, &value);
+    return (after != NULL && skip_spaces(after, end) == end);
+}
+
+// Function to work out the layout of the file from its first non-blank line(s): the number of numeric
+// columns and whether a class column follows them. Skips a header line. Returns 0 on success.
+static int detect_layout(CsvReader* reader)
+{
+    const char* end = reader->file.data + reader->file.size;
+    const char* p = reader->file.data;
+    int header_seen = 0;
+    while (p < end)
+    {
+        const char* next;
+        const char* stop = line_end(p, end, &next);
+        if (skip_spaces(p, stop) == stop)
+        {
+            p = next;
+            continue;
+        }
+        int fields = 0, numeric = 0, last_numeric = 0;
+        const char* field = p;
+        for (;;)
+        {
+            const char* comma = (const char*)memchr(field, ',', stop - field);
+            const char* field_end = comma ? comma : stop;
+            last_numeric = is_numeric_field(field, field_end);
+            numeric += last_numeric;
+            fields++;
+            if (!comma)
+                break;
+            field = comma + 1;
+        }
+        if (numeric == 0 && !header_seen)
+        {
+            header_seen = 1;
+            p = next;
+            continue;
+        }
+        reader->has_labels = !last_numeric;
+        reader->cols = fields - reader->has_labels;
+        reader->data_start = p;
+        if (numeric != reader->cols || reader->cols == 0)
+            return (-1);  // text outside the last column
+        return (0);
+    }
+    return (-1);
+}
+
+int csv_reader_open(CsvReader* reader, const char* path)
+{
+    memset(reader, 0, sizeof(*reader));
+    if (mapped_file_open(&reader->file, path) != 0)
+        return (-1);
+    mapped_file_sequential(&reader->file);
+    if (detect_layout(reader) != 0)
+    {
+        mapped_file_close(&reader->file);
+        return (-1);
+    }
+    reader->cursor = reader->data_start;
+    label_table_init(&reader->classes);
+    return (0);
+}
+
+// Function to parse one line into its feature values and class id; returns 0 if it does not match the layout
+static int parse_line(int cols, int has_labels, LabelTable* classes, const char* p, const char* end, double* values, int* label)
+{
+    for (int c = 0; c < cols; c++)
+    {
+        p = parse_number(skip_spaces(p, end), end, &values[c]);
+        if (p == NULL)
+            return (0);
+        p = skip_spaces(p, end);
+        if (c < cols - 1 || has_labels)
+        {
+            if (p == end || *p != ',')
+                return (0);
+            p++;
+        }
+    }
+    if (!has_labels)
+        return (skip_spaces(p, end) == end);
+    p = skip_spaces(p, end);
+    while (end > p && (end[-1] == ' ' || end[-1] == '\t'))
+        end--;
+    if (p == end)
+        return (0);
+    *label = label_table_intern(classes, p, end - p);
+    return (1);
+}
+
+// Function to parse up to max_rows samples from *cursor onwards, advancing it; blank lines are ignored
+// and malformed ones counted in *skipped. Returns the number of samples stored.
+static size_t parse_lines(const char** cursor, const char* end, int cols, int has_labels, LabelTable* classes, double* values, int* labels,
+                          size_t max_rows, size_t* skipped)
+{
+    size_t rows = 0;
+    while (rows < max_rows && *cursor < end)
+    {
+        const char* line = *cursor;
+        const char* stop = line_end(line, end, cursor);
+        if (skip_spaces(line, stop) == stop)
+            continue;
+        int label = 0;
+        if (!parse_line(cols, has_labels, classes, line, stop, values + rows * cols, &label))
+        {
+            (*skipped)++;
+            continue;
+        }
+        if (labels != NULL)
+            labels[rows] = label;
+        rows++;
+    }
+    return (rows);
+}
+
+size_t csv_reader_read(CsvReader* reader, double* values, int* labels, size_t max_rows)
+{
+    const char* end = reader->file.data + reader->file.size;
+    return (parse_lines(&reader->cursor, end, reader->cols, reader->has_labels, &reader->classes, values, labels, max_rows, &reader->skipped));
+}
+
+void csv_reader_rewind(CsvReader* reader)
+{
+    reader->cursor = reader->data_start;
+    reader->skipped = 0;
+}
+
+void csv_reader_close(CsvReader* reader)
+{
+    mapped_file_close(&reader->file);
+    label_table_free(&reader->classes);
+}
+
+// A slice of the file, cut at line boundaries, parsed by one thread
+typedef struct {
+    const char* start;
+    const char* end;
+    size_t first_row;  // where its rows are written: the number of lines before it, an upper bound of the samples
+    size_t rows;
+    size_t skipped;
+    LabelTable classes;  // class ids local to the chunk
+} Chunk;
+
+// Function to count the lines in [p, end), a last line without '\n' included
+static size_t count_lines(const char* p, const char* end)
+{
+    size_t lines = 0;
+    while (p < end)
+    {
+        const char* newline = (const char*)memchr(p, '\n', end - p);
+        lines++;
+        if (newline == NULL)
+            break;
+        p = newline + 1;
+    }
+    return (lines);
+}
+
+int dataset_load(const char* path, Dataset* dataset)
+{
+    memset(dataset, 0, sizeof(*dataset));
+    CsvReader reader;
+    if (csv_reader_open(&reader, path) != 0)
+    {
+        printf("Could not read a dataset from %s\n", path);
+        return (-1);
+    }
+    int cols = reader.cols;
+    int has_labels = reader.has_labels;
+    const char* end = reader.file.data + reader.file.size;
+
+    // Cut the file into chunks at line boundaries, several per thread so uneven ones balance out
+    int chunk_count = 1;
+#ifdef _OPENMP
+    if ((size_t)(end - reader.data_start) >= PARALLEL_MIN_BYTES)
+        chunk_count = 4 * omp_get_max_threads();
+#endif
+    Chunk* chunks = (Chunk*)calloc(chunk_count, sizeof(Chunk));
+    const char* p = reader.data_start;
+    for (int c = 0; c < chunk_count; c++)
+    {
+        chunks[c].start = p;
+        const char* cut = reader.data_start + (size_t)(end - reader.data_start) * (c + 1) / chunk_count;
+        if (cut < p)
+            cut = p;
+        if (c < chunk_count - 1 && cut < end)
+        {
+            const char* newline = (const char*)memchr(cut, '\n', end - cut);
+            cut = newline ? newline + 1 : end;
+        }
+        else
+        {
+            cut = end;
+        }
+        chunks[c].end = cut;
+        p = cut;
+    }
+
+    // Every chunk gets room for one sample per line, so all of them parse straight into the final buffers
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int c = 0; c < chunk_count; c++)
+    {
+        chunks[c].rows = count_lines(chunks[c].start, chunks[c].end);
+    }
+    size_t lines = 0;
+    for (int c = 0; c < chunk_count; c++)
+    {
+        chunks[c].first_row = lines;
+        lines += chunks[c].rows;
+    }
+    dataset->cols = cols;
+    dataset->values = (double*)malloc((lines > 0 ? lines : 1) * cols * sizeof(double));
+    if (has_labels)
+        dataset->labels = (int*)malloc((lines > 0 ? lines : 1) * sizeof(int));
+
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int c = 0; c < chunk_count; c++)
+    {
+        Chunk* chunk = &chunks[c];
+        label_table_init(&chunk->classes);
+        const char* cursor = chunk->start;
+        chunk->rows = parse_lines(&cursor, chunk->end, cols, has_labels, &chunk->classes, dataset->values + chunk->first_row * cols,
+                                  has_labels ? dataset->labels + chunk->first_row : NULL, SIZE_MAX, &chunk->skipped);
+    }
+
+    // Close the gaps left by blank and malformed lines, and renumber the classes in order of first appearance
+    label_table_init(&dataset->classes);
+    for (int c = 0; c < chunk_count; c++)
+    {
+        Chunk* chunk = &chunks[c];
+        if (dataset->rows != chunk->first_row)
+            memmove(dataset->values + dataset->rows * cols, dataset->values + chunk->first_row * cols, chunk->rows * cols * sizeof(double));
+        if (has_labels)
+        {
+            int* global_ids = (int*)malloc((chunk->classes.count > 0 ? chunk->classes.count : 1) * sizeof(int));
+            for (int i = 0; i < chunk->classes.count; i++)
+            {
+                const char* name = chunk->classes.names[i];
+                global_ids[i] = label_table_intern(&dataset->classes, name, strlen(name));
+            }
+            for (size_t i = 0; i < chunk->rows; i++)
+            {
+                dataset->labels[dataset->rows + i] = global_ids[dataset->labels[chunk->first_row + i]];
+            }
+            free(global_ids);
+        }
+        dataset->rows += chunk->rows;
+        dataset->skipped += chunk->skipped;
+        label_table_free(&chunk->classes);
+    }
+    free(chunks);
+    csv_reader_close(&reader);
+
+    if (dataset->rows == 0)
+    {
+        printf("No samples found in %s\n", path);
+        dataset_free(dataset);
+        return (-1);
+    }
+    return (0);
+}
+
+void dataset_free(Dataset* dataset)
+{
+    free(dataset->values);
+    free(dataset->labels);
+    if (dataset->classes.slots != NULL)
+        label_table_free(&dataset->classes);
+    memset(dataset, 0, sizeof(*dataset));
+}
@@ -0,0 +1,65 @@
+#ifndef DATASET_H
+#define DATASET_H
+
+#include <stddef.h>
+
+#include "mapped_file.h"
+
+// CSV dataset loading shared by the KNN and K-means programs.
+// A file holds one sample per line: any number of numeric feature columns, optionally followed by a
+// text class column (like the species in iris.data). A first line that does not start with a number
+// is taken as a header. Blank lines are ignored and lines with the wrong number of fields are skipped.
+
+// Class names interned into small integer ids, in order of first appearance
+typedef struct {
+    char** names;     // id -> name
+    int count;
+    int capacity;
+    int* slots;       // open-addressing hash table of id + 1, 0 for an empty slot
+    int slot_count;   // power of two
+} LabelTable;
+
+typedef struct {
+    size_t rows;
+    int cols;            // numeric feature columns
+    double* values;      // rows * cols, row-major
+    int* labels;         // class id of every row, NULL when the file has no class column
+    LabelTable classes;
+    size_t skipped;      // malformed lines that were ignored
+} Dataset;
+
+// Incremental reader over a mapped CSV file, for loading it in fixed-size batches
+typedef struct {
+    MappedFile file;
+    const char* cursor;
+    const char* data_start;  // first line after the header
+    int cols;
+    int has_labels;
+    LabelTable classes;
+    size_t skipped;
+} CsvReader;
+
+void label_table_init(LabelTable* table);
+void label_table_free(LabelTable* table);
+// Returns the id of the name, adding it if it is new
+int label_table_intern(LabelTable* table, const char* name, size_t length);
+// Returns the id of the name, or -1 if it was never interned
+int label_table_find(const LabelTable* table, const char* name);
+
+// Parses a number from [p, end) into *value and returns the first character after it, or NULL if there is none.
+// Plain decimal numbers are converted exactly without strtod; anything else falls back to it.
+const char* parse_number(const char* p, const char* end, double* value);
+
+// Maps the file and detects its layout from the first line; returns 0 on success, -1 on error
+int csv_reader_open(CsvReader* reader, const char* path);
+// Reads up to max_rows samples into values (max_rows * cols) and labels (may be NULL); returns how many were read, 0 at the end
+size_t csv_reader_read(CsvReader* reader, double* values, int* labels, size_t max_rows);
+// Goes back to the first sample; class ids keep their meaning across passes
+void csv_reader_rewind(CsvReader* reader);
+void csv_reader_close(CsvReader* reader);
+
+// Loads the whole file; returns 0 on success and -1 (after printing why) on error
+int dataset_load(const char* path, Dataset* dataset);
+void dataset_free(Dataset* dataset);
+
+#endif
@@ -0,0 +1,159 @@
+#include "mapped_file.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+int mapped_file_open(MappedFile* file, const char* path)
+{
+    file->data = NULL;
+    file->size = 0;
+    file->mapping = NULL;
+    file->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file->file == INVALID_HANDLE_VALUE)
+        return (-1);
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file->file, &size))
+    {
+        CloseHandle(file->file);
+        return (-1);
+    }
+    file->size = (size_t)size.QuadPart;
+    if (file->size == 0)
+        return (0);
+    file->mapping = CreateFileMappingA(file->file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (file->mapping != NULL)
+        file->data = (const char*)MapViewOfFile(file->mapping, FILE_MAP_READ, 0, 0, 0);
+    if (file->data == NULL)
+    {
+        mapped_file_close(file);
+        return (-1);
+    }
+    return (0);
+}
+
+int mapped_file_copy(MappedFile* file, const void* data, size_t size)
+{
+    file->file = INVALID_HANDLE_VALUE;
+    file->data = NULL;
+    file->size = 0;
+    file->mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)((unsigned long long)size >> 32), (DWORD)size, NULL);
+    void* view = (file->mapping != NULL) ? MapViewOfFile(file->mapping, FILE_MAP_WRITE, 0, 0, size) : NULL;
+    if (view == NULL)
+    {
+        mapped_file_close(file);
+        return (-1);
+    }
+    memcpy(view, data, size);
+    file->data = (const char*)view;
+    file->size = size;
+    return (0);
+}
+
+void mapped_file_sequential(const MappedFile* file)
+{
+    (void)file;  // FILE_FLAG_SEQUENTIAL_SCAN was already given when opening
+}
+
+void mapped_file_release(const MappedFile* file, const void* data, size_t size)
+{
+    (void)file;
+    VirtualUnlock((void*)data, size);  // unlocking pages that are not locked takes them out of the working set
+}
+
+void mapped_file_close(MappedFile* file)
+{
+    if (file->data != NULL)
+        UnmapViewOfFile(file->data);
+    if (file->mapping != NULL)
+        CloseHandle(file->mapping);
+    if (file->file != INVALID_HANDLE_VALUE)
+        CloseHandle(file->file);
+    file->data = NULL;
+    file->size = 0;
+    file->mapping = NULL;
+    file->file = INVALID_HANDLE_VALUE;
+}
+#else
+int mapped_file_open(MappedFile* file, const char* path)
+{
+    file->data = NULL;
+    file->size = 0;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return (-1);
+    struct stat info;
+    if (fstat(fd, &info) != 0)
+    {
+        close(fd);
+        return (-1);
+    }
+    file->size = (size_t)info.st_size;
+    if (file->size > 0)
+    {
+        void* data = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+        {
+            close(fd);
+            file->size = 0;
+            return (-1);
+        }
+        file->data = (const char*)data;
+    }
+    close(fd);  // the mapping keeps its own reference to the file
+    return (0);
+}
+
+int mapped_file_copy(MappedFile* file, const void* data, size_t size)
+{
+    file->data = NULL;
+    file->size = 0;
+    FILE* temp = tmpfile();
+    if (temp == NULL)
+        return (-1);
+    void* mapped = MAP_FAILED;
+    if (fwrite(data, 1, size, temp) == size && fflush(temp) == 0)
+        mapped = mmap(NULL, size, PROT_READ, MAP_SHARED, fileno(temp), 0);
+    fclose(temp);  // tmpfile already removed the name; the mapping keeps the file until munmap
+    if (mapped == MAP_FAILED)
+        return (-1);
+    file->data = (const char*)mapped;
+    file->size = size;
+    return (0);
+}
+
+void mapped_file_sequential(const MappedFile* file)
+{
+    if (file->data != NULL)
+        posix_madvise((void*)file->data, file->size, POSIX_MADV_SEQUENTIAL);
+}
+
+void mapped_file_release(const MappedFile* file, const void* data, size_t size)
+{
+    (void)file;
+    // Only whole pages can be dropped, so the range shrinks to the pages it covers entirely
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    uintptr_t first = ((uintptr_t)data + page - 1) / page * page;
+    uintptr_t last = ((uintptr_t)data + size) / page * page;
+    if (last > first)
+        madvise((void*)first, last - first, MADV_DONTNEED);
+}
+
+void mapped_file_close(MappedFile* file)
+{
+    if (file->data != NULL)
+        munmap((void*)file->data, file->size);
+    file->data = NULL;
+    file->size = 0;
+}
+#endif
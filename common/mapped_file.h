@@ -0,0 +1,34 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <stddef.h>
+
+// Read-only view of a whole file through the OS page cache (mmap, or a file mapping on Windows).
+// Nothing is copied: pages are read from disk the first time they are touched.
+typedef struct {
+    const char* data;
+    size_t size;
+#ifdef _WIN32
+    void* file;
+    void* mapping;
+#endif
+} MappedFile;
+
+// Maps the file; returns 0 on success and -1 if it cannot be opened or mapped
+int mapped_file_open(MappedFile* file, const char* path);
+
+// Copies `size` (> 0) bytes to a temporary file and maps it read-only, so the copy lives in the page cache, which
+// the OS can drop and read again, rather than in the process's own memory (on Windows, in a mapping backed by
+// the paging file). The file goes away with mapped_file_close. Returns 0 on success, -1 if it cannot be made.
+int mapped_file_copy(MappedFile* file, const void* data, size_t size);
+
+// Tells the OS the file will be read front to back, so it reads ahead aggressively
+void mapped_file_sequential(const MappedFile* file);
+
+// Tells the OS `size` bytes at `data`, inside the file, will not be read again: their pages stop counting towards
+// the process's memory, and are read again from the page cache if they are touched after all
+void mapped_file_release(const MappedFile* file, const void* data, size_t size);
+
+void mapped_file_close(MappedFile* file);
+
+#endif
@@ -0,0 +1,248 @@
+#include <string.h>
+
+#include "random.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RNG_X86_DISPATCH 1
+#endif
+
+// What the bulk kernels write for each number: its bits, or a double or float in [0, 1) made by putting random
+// bits under the exponent of 1.0 and subtracting 1
+typedef enum
+{
+    FORMAT_BITS,
+    FORMAT_DOUBLE,
+    FORMAT_FLOAT
+} Format;
+
+// A kernel takes `steps` steps of every lane, writing the RNG_LANES numbers of each step in lane order
+typedef void (*LanesKernel)(RngLanes* lanes, void* out, size_t steps, Format format);
+
+static LanesKernel kernel = NULL;
+static const char* kernel_name = "portable";
+
+static uint64_t splitmix64(uint64_t* x)
+{
+    uint64_t z = (*x += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return (z ^ (z >> 31));
+}
+
+void rng_seed(Rng* rng, uint64_t seed, uint64_t stream)
+{
+    // The stream number is hashed before it is mixed with the seed, so nearby seeds and streams give
+    // unrelated states; splitmix64 then spreads the 64 bits over the 256 of the state
+    uint64_t x = stream;
+    x = seed ^ splitmix64(&x);
+    for (int i = 0; i < 4; i++)
+    {
+        rng->s[i] = splitmix64(&x);
+    }
+}
+
+void rng_jump(Rng* rng)
+{
+    static const uint64_t jump[4] = {0x180EC6D33CFD0ABAull, 0xD5A61266F0C9392Cull, 0xA9582618E03FC9AAull, 0x39ABDC4529B1661Cull};
+    uint64_t s[4] = {0, 0, 0, 0};
+    for (int i = 0; i < 4; i++)
+    {
+        for (int b = 0; b < 64; b++)
+        {
+            if (jump[i] & (1ull << b))
+            {
+                for (int w = 0; w < 4; w++)
+                {
+                    s[w] ^= rng->s[w];
+                }
+            }
+            rng_next(rng);
+        }
+    }
+    memcpy(rng->s, s, sizeof(s));
+}
+
+Rng rng_split(Rng* rng)
+{
+    Rng child = *rng;
+    rng_jump(rng);
+    return (child);
+}
+
+void rng_lanes_init(RngLanes* lanes, Rng* rng)
+{
+    for (int l = 0; l < RNG_LANES; l++)
+    {
+        Rng lane = rng_split(rng);
+        for (int w = 0; w < 4; w++)
+        {
+            lanes->s[w][l] = lane.s[w];
+        }
+    }
+}
+
+static void lanes_portable(RngLanes* lanes, void* out, size_t steps, Format format)
+{
+    uint64_t (*s)[RNG_LANES] = lanes->s;
+    uint64_t* bits = (uint64_t*)out;
+    double* doubles = (double*)out;
+    float* floats = (float*)out;
+    for (size_t i = 0; i < steps; i++)
+    {
+        for (int l = 0; l < RNG_LANES; l++)
+        {
+            uint64_t result = rng_rotl(s[1][l] * 5, 7) * 9;
+            uint64_t t = s[1][l] << 17;
+            s[2][l] ^= s[0][l];
+            s[3][l] ^= s[1][l];
+            s[1][l] ^= s[2][l];
+            s[0][l] ^= s[3][l];
+            s[2][l] ^= t;
+            s[3][l] = rng_rotl(s[3][l], 45);
+            if (format == FORMAT_BITS)
+            {
+                bits[i * RNG_LANES + l] = result;
+            }
+            else if (format == FORMAT_DOUBLE)
+            {
+                uint64_t x = (result >> 12) | 0x3FF0000000000000ull;
+                double value;
+                memcpy(&value, &x, sizeof(value));
+                doubles[i * RNG_LANES + l] = value - 1.0;
+            }
+            else
+            {
+                uint32_t x = (uint32_t)(result >> 41) | 0x3F800000u;
+                float value;
+                memcpy(&value, &x, sizeof(value));
+                floats[i * RNG_LANES + l] = value - 1.0f;
+            }
+        }
+    }
+}
+
+#ifdef RNG_X86_DISPATCH
+// The lanes as one GCC vector, which the compiler splits into the registers the CPU has
+typedef uint64_t VectorLanes __attribute__((vector_size(RNG_LANES * sizeof(uint64_t))));
+typedef uint32_t VectorLanes32 __attribute__((vector_size(RNG_LANES * sizeof(uint32_t))));
+typedef double VectorDoubles __attribute__((vector_size(RNG_LANES * sizeof(double))));
+typedef float VectorFloats __attribute__((vector_size(RNG_LANES * sizeof(float))));
+
+// The step of lanes_portable on whole vectors; the multiplications by 5 and 9 are shifts and adds, which
+// every vector unit has
+static inline __attribute__((always_inline)) void lanes_vector(RngLanes* lanes, void* out, size_t steps, Format format)
+{
+    VectorLanes s0, s1, s2, s3;
+    memcpy(&s0, lanes->s[0], sizeof(s0));
+    memcpy(&s1, lanes->s[1], sizeof(s1));
+    memcpy(&s2, lanes->s[2], sizeof(s2));
+    memcpy(&s3, lanes->s[3], sizeof(s3));
+    for (size_t i = 0; i < steps; i++)
+    {
+        VectorLanes x = (s1 << 2) + s1;
+        x = (x << 7) | (x >> 57);
+        VectorLanes result = (x << 3) + x;
+        VectorLanes t = s1 << 17;
+        s2 ^= s0;
+        s3 ^= s1;
+        s1 ^= s2;
+        s0 ^= s3;
+        s2 ^= t;
+        s3 = (s3 << 45) | (s3 >> 19);
+        if (format == FORMAT_BITS)
+        {
+            memcpy((uint64_t*)out + i * RNG_LANES, &result, sizeof(result));
+        }
+        else if (format == FORMAT_DOUBLE)
+        {
+            VectorLanes exponent = (result >> 12) | 0x3FF0000000000000ull;
+            VectorDoubles value = (VectorDoubles)exponent - 1.0;
+            memcpy((double*)out + i * RNG_LANES, &value, sizeof(value));
+        }
+        else
+        {
+            VectorLanes32 exponent = __builtin_convertvector(result >> 41, VectorLanes32) | 0x3F800000u;
+            VectorFloats value = (VectorFloats)exponent - 1.0f;
+            memcpy((float*)out + i * RNG_LANES, &value, sizeof(value));
+        }
+    }
+    memcpy(lanes->s[0], &s0, sizeof(s0));
+    memcpy(lanes->s[1], &s1, sizeof(s1));
+    memcpy(lanes->s[2], &s2, sizeof(s2));
+    memcpy(lanes->s[3], &s3, sizeof(s3));
+}
+
+__attribute__((target("avx2")))
+static void lanes_avx2(RngLanes* lanes, void* out, size_t steps, Format format)
+{
+    lanes_vector(lanes, out, steps, format);
+}
+
+__attribute__((target("avx512f")))
+static void lanes_avx512(RngLanes* lanes, void* out, size_t steps, Format format)
+{
+    lanes_vector(lanes, out, steps, format);
+}
+#endif
+
+// The choice is made in locals and the kernel published last, so a later call only reads it
+void rng_init(void)
+{
+    if (kernel != NULL)
+        return;
+    LanesKernel chosen = lanes_portable;
+    const char* name = "portable";
+#ifdef RNG_X86_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+    {
+        chosen = lanes_avx512;
+        name = "avx512";
+    }
+    else if (__builtin_cpu_supports("avx2"))
+    {
+        chosen = lanes_avx2;
+        name = "avx2";
+    }
+#endif
+    kernel_name = name;
+    kernel = chosen;
+}
+
+const char* rng_kernel_name(void)
+{
+    rng_init();
+    return (kernel_name);
+}
+
+// Function to write `count` numbers in the given format: whole steps straight into `out`, and the numbers
+// wanted from a last partial step through a buffer
+static void fill(RngLanes* lanes, void* out, size_t count, Format format)
+{
+    rng_init();
+    size_t size = format == FORMAT_FLOAT ? sizeof(float) : sizeof(uint64_t);
+    size_t steps = count / RNG_LANES;
+    kernel(lanes, out, steps, format);
+    size_t rest = count - steps * RNG_LANES;
+    if (rest > 0)
+    {
+        uint64_t last[RNG_LANES];
+        kernel(lanes, last, 1, format);
+        memcpy((char*)out + steps * RNG_LANES * size, last, rest * size);
+    }
+}
+
+void rng_fill(RngLanes* lanes, uint64_t* out, size_t count)
+{
+    fill(lanes, out, count, FORMAT_BITS);
+}
+
+void rng_fill_uniform(RngLanes* lanes, double* out, size_t count)
+{
+    fill(lanes, out, count, FORMAT_DOUBLE);
+}
+
+void rng_fill_uniform_float(RngLanes* lanes, float* out, size_t count)
+{
+    fill(lanes, out, count, FORMAT_FLOAT);
+}
@@ -0,0 +1,90 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Pseudorandom numbers shared by the programs: xoshiro256** (Blackman and Vigna), 256 bits of state and a
+// period of 2^256 - 1. There is no global state, so threads never contend for a generator and a run only
+// depends on its seed. Work split in fixed blocks gives every block the generator of its own stream number;
+// work split between threads or SIMD lanes uses rng_split, which hands out generators 2^128 numbers apart.
+
+typedef struct
+{
+    uint64_t s[4];
+} Rng;
+
+// Generators advanced together by the bulk functions
+#define RNG_LANES 8
+
+// RNG_LANES generators stored word by word, so one step of all of them is a handful of vector instructions
+typedef struct
+{
+    uint64_t s[4][RNG_LANES];
+} RngLanes;
+
+// Sets up the generator of stream `stream` of a seed; different streams of the same seed are unrelated
+void rng_seed(Rng* rng, uint64_t seed, uint64_t stream);
+// Moves the generator 2^128 numbers ahead
+void rng_jump(Rng* rng);
+// Returns a generator that starts where `rng` is and jumps `rng` past every number the returned one can draw
+Rng rng_split(Rng* rng);
+
+static inline uint64_t rng_rotl(uint64_t x, int k)
+{
+    return ((x << k) | (x >> (64 - k)));
+}
+
+static inline uint64_t rng_next(Rng* rng)
+{
+    uint64_t* s = rng->s;
+    uint64_t result = rng_rotl(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rng_rotl(s[3], 45);
+    return (result);
+}
+
+// Returns a number in [0, 1) with 53 random bits
+static inline double rng_uniform(Rng* rng)
+{
+    return ((rng_next(rng) >> 11) * (1.0 / 9007199254740992.0));
+}
+
+// Returns an integer in [0, n), n > 0, with every value equally likely (Lemire's multiply-and-reject:
+// a division only happens in the rare case that a draw may have to be rejected)
+static inline uint32_t rng_below(Rng* rng, uint32_t n)
+{
+    uint64_t product = (rng_next(rng) >> 32) * n;
+    uint32_t low = (uint32_t)product;
+    if (low < n)
+    {
+        uint32_t threshold = (0u - n) % n;
+        while (low < threshold)
+        {
+            product = (rng_next(rng) >> 32) * n;
+            low = (uint32_t)product;
+        }
+    }
+    return ((uint32_t)(product >> 32));
+}
+
+// Picks the bulk kernel for this CPU. The bulk functions pick it on first use; code that first uses them inside
+// a parallel region calls this before it, so the threads only ever read the choice.
+void rng_init(void);
+// Splits RNG_LANES generators off `rng` for the bulk functions
+void rng_lanes_init(RngLanes* lanes, Rng* rng);
+// Fills `out` with `count` numbers, taking one from each lane in turn. A call ends on a whole step of the
+// lanes, so only calls for multiples of RNG_LANES numbers continue each other's sequence exactly.
+void rng_fill(RngLanes* lanes, uint64_t* out, size_t count);
+// The same as numbers in [0, 1), with 52 random bits for doubles and 23 for floats
+void rng_fill_uniform(RngLanes* lanes, double* out, size_t count);
+void rng_fill_uniform_float(RngLanes* lanes, float* out, size_t count);
+// Name of the bulk kernel chosen for this CPU; every kernel gives the same numbers
+const char* rng_kernel_name(void);
+
+#endif